@@ -0,0 +1,103 @@
+/*
+    Read-only table of all off-shell currents of one event, together with
+    the subset momenta and invariants, stored contiguously and indexed by
+    the bitmask of the subset of the first n - 1 legs.
+*/
+#include <complex>
+#include <vector>
+
+#include "currenttable.h"
+#include "definitions.h"
+#include "fourvector.h"
+
+//Constructor: default
+CurrentTable::CurrentTable ()
+    : amplitude_ (0), numberOfLegs_ (0), hasMomenta_ (false) {}
+
+//Resize for a multiplicity
+void CurrentTable::resize (const unsigned int& numberOfLegs,
+                           const bool& hasMomenta)
+{
+    unsigned int entries = (numberOfLegs < 3) ? 0 : 1u << (numberOfLegs - 1);
+
+    currents_.assign (entries, 0);
+    invariants_.assign (entries, 0);
+    momenta_.assign (hasMomenta ? 4 * entries : 0, 0);
+    amplitude_ = 0;
+
+    numberOfLegs_ = numberOfLegs;
+    hasMomenta_ = hasMomenta;
+}
+
+//Number of legs
+unsigned int CurrentTable::numberOfLegs () const
+{
+    return numberOfLegs_;
+}
+
+//Number of entries
+unsigned int CurrentTable::size () const
+{
+    return currents_.size ();
+}
+
+//Bitmask of the first n - 1 legs
+unsigned int CurrentTable::rootSubset () const
+{
+    return currents_.empty () ? 0 : currents_.size () - 1;
+}
+
+//Momenta available
+bool CurrentTable::hasMomenta () const
+{
+    return hasMomenta_;
+}
+
+//Off-shell current of a subset
+complex_t CurrentTable::current (const unsigned int& subset) const
+{
+    return currents_.at (subset);
+}
+
+//Sum of the momenta in a subset
+FourVector <real_t> CurrentTable::momentum (const unsigned int& subset) const
+{
+    if (!hasMomenta_)
+    {
+        std::cout << "Error: current table holds no momenta\n";
+        return FourVector <real_t> ();
+    }
+
+    return FourVector <real_t> (momenta_.at (4 * subset),
+                                momenta_.at (4 * subset + 1),
+                                momenta_.at (4 * subset + 2),
+                                momenta_.at (4 * subset + 3));
+}
+
+//Square of the subset momentum
+real_t CurrentTable::invariant (const unsigned int& subset) const
+{
+    return invariants_.at (subset);
+}
+
+//Amplitude including couplings
+complex_t CurrentTable::amplitude () const
+{
+    return amplitude_;
+}
+
+//Contiguous storage
+const complex_t* CurrentTable::currents () const
+{
+    return currents_.data ();
+}
+
+const real_t* CurrentTable::invariants () const
+{
+    return invariants_.data ();
+}
+
+const real_t* CurrentTable::momenta () const
+{
+    return momenta_.data ();
+}
@@ -0,0 +1,66 @@
+/*
+    Read-only table of all off-shell currents of one event, together with
+    the subset momenta and invariants, stored contiguously and indexed by
+    the bitmask of the subset of the first n - 1 legs.
+*/
+
+#ifndef CURRENT_TABLE
+#define CURRENT_TABLE
+
+#include <complex>
+#include <vector>
+
+#include "definitions.h"
+#include "fourvector.h"
+
+class CurrentTable
+{
+public:
+    //Constructor: default
+    CurrentTable ();
+
+    //Number of legs of the amplitude
+    unsigned int numberOfLegs () const;
+    //Number of entries, all bitmasks of the first n - 1 legs
+    unsigned int size () const;
+    //Bitmask of the first n - 1 legs
+    unsigned int rootSubset () const;
+    //Momenta are only available for four-momentum input
+    bool hasMomenta () const;
+
+    //Off-shell current of a subset, couplings factored out
+    //Single legs give 1, the root gives the amputated current
+    complex_t current (const unsigned int& subset) const;
+    //Sum of the momenta in a subset
+    FourVector <real_t> momentum (const unsigned int& subset) const;
+    //Square of the subset momentum
+    real_t invariant (const unsigned int& subset) const;
+    //Amplitude including couplings
+    complex_t amplitude () const;
+
+    //Contiguous storage: currents[subset], invariants[subset],
+    //momenta[4 * subset + component]
+    const complex_t* currents () const;
+    const real_t* invariants () const;
+    const real_t* momenta () const;
+
+private:
+    friend class EvaluationTape;
+    friend class ScalarTreeAmplitude;
+
+    //Resize for a multiplicity, keeping storage if unchanged
+    void resize (const unsigned int& numberOfLegs, const bool& hasMomenta);
+
+    //Storage
+    std::vector <complex_t> currents_;
+    std::vector <real_t> invariants_;
+    std::vector <real_t> momenta_;
+    complex_t amplitude_;
+
+    //Parameters
+    unsigned int numberOfLegs_;
+    bool hasMomenta_;
+
+};
+
+#endif
@@ -0,0 +1,142 @@
+/*
+    Numeric kernels for the dipole momentum mappings of SoA momenta. This
+    file is compiled once per instruction set, with DIPOLE_KERNEL and
+    INITIAL_DIPOLE_KERNEL naming the variant and the matching -m flags
+    given in the makefile. It must not define or odr-use inline functions
+    shared with other translation units.
+*/
+#include <complex>
+
+#include "definitions.h"
+#include "evaluationtape.h"
+#include "kerneldispatch.h"
+
+#ifndef DIPOLE_KERNEL
+#define DIPOLE_KERNEL mapDipoleSse2
+#endif
+
+#ifndef INITIAL_DIPOLE_KERNEL
+#define INITIAL_DIPOLE_KERNEL mapInitialDipoleSse2
+#endif
+
+//Merge p_i and p_j, the spectator p_k absorbs the recoil:
+//P = p_i + p_j, lambda = P^2 / (2 P.p_k), P - lambda p_k, (1 + lambda) p_k
+void DIPOLE_KERNEL (const real_t* pi, const real_t* pj, const real_t* pk,
+                    const unsigned int& inputStride, real_t* merged,
+                    real_t* spectator, const unsigned int& outputStride,
+                    const unsigned int& size)
+{
+    const unsigned int s = inputStride;
+    const unsigned int t = outputStride;
+    const unsigned int n = size;
+
+    for (unsigned int i = 0; i < n; i++)
+    {
+        real_t ie = pi[i], ix = pi[s + i], iy = pi[2 * s + i];
+        real_t iz = pi[3 * s + i];
+        real_t je = pj[i], jx = pj[s + i], jy = pj[2 * s + i];
+        real_t jz = pj[3 * s + i];
+        real_t ke = pk[i], kx = pk[s + i], ky = pk[2 * s + i];
+        real_t kz = pk[3 * s + i];
+
+        real_t ij = ie * je - ix * jx - iy * jy - iz * jz;
+        real_t ik = ie * ke - ix * kx - iy * ky - iz * kz;
+        real_t jk = je * ke - jx * kx - jy * ky - jz * kz;
+        real_t lambda = ij / (ik + jk);
+
+        merged[i] = ie + je - lambda * ke;
+        merged[t + i] = ix + jx - lambda * kx;
+        merged[2 * t + i] = iy + jy - lambda * ky;
+        merged[3 * t + i] = iz + jz - lambda * kz;
+        spectator[i] = (1 + lambda) * ke;
+        spectator[t + i] = (1 + lambda) * kx;
+        spectator[2 * t + i] = (1 + lambda) * ky;
+        spectator[3 * t + i] = (1 + lambda) * kz;
+    }
+}
+
+//Both legs incoming: p_k is kept, p_i becomes x p_i with
+//x = (p_i.p_k + p_i.p_j + p_j.p_k) / p_i.p_k and every final leg p is
+//boosted from K = -(p_i + p_j + p_k) to K~ = -(x p_i + p_k), which has
+//the same mass: p - 2 p.(K + K~) / (K + K~)^2 (K + K~) + 2 p.K / K^2 K~
+void INITIAL_DIPOLE_KERNEL (const real_t* pi, const real_t* pj,
+                            const real_t* pk, const real_t* const* finals,
+                            const unsigned int& numberOfFinals,
+                            const unsigned int& inputStride,
+                            real_t* emitter, real_t* spectator,
+                            real_t* const* mappedFinals,
+                            const unsigned int& outputStride,
+                            const unsigned int& size)
+{
+    const unsigned int s = inputStride;
+    const unsigned int t = outputStride;
+    const unsigned int n = size;
+
+    for (unsigned int i = 0; i < n; i++)
+    {
+        real_t ie = pi[i], ix = pi[s + i], iy = pi[2 * s + i];
+        real_t iz = pi[3 * s + i];
+        real_t je = pj[i], jx = pj[s + i], jy = pj[2 * s + i];
+        real_t jz = pj[3 * s + i];
+        real_t ke = pk[i], kx = pk[s + i], ky = pk[2 * s + i];
+        real_t kz = pk[3 * s + i];
+
+        real_t ij = ie * je - ix * jx - iy * jy - iz * jz;
+        real_t ik = ie * ke - ix * kx - iy * ky - iz * kz;
+        real_t jk = je * ke - jx * kx - jy * ky - jz * kz;
+        real_t x = (ik + ij + jk) / ik;
+
+        emitter[i] = x * ie;
+        emitter[t + i] = x * ix;
+        emitter[2 * t + i] = x * iy;
+        emitter[3 * t + i] = x * iz;
+        spectator[i] = ke;
+        spectator[t + i] = kx;
+        spectator[2 * t + i] = ky;
+        spectator[3 * t + i] = kz;
+    }
+
+    //The boost is recomputed for every final leg, which keeps the events
+    //innermost without a workspace
+    for (unsigned int f = 0; f < numberOfFinals; f++)
+    {
+        const real_t* p = finals[f];
+        real_t* mapped = mappedFinals[f];
+
+        for (unsigned int i = 0; i < n; i++)
+        {
+            real_t ie = pi[i], ix = pi[s + i], iy = pi[2 * s + i];
+            real_t iz = pi[3 * s + i];
+            real_t je = pj[i], jx = pj[s + i], jy = pj[2 * s + i];
+            real_t jz = pj[3 * s + i];
+            real_t ke = pk[i], kx = pk[s + i], ky = pk[2 * s + i];
+            real_t kz = pk[3 * s + i];
+
+            real_t ij = ie * je - ix * jx - iy * jy - iz * jz;
+            real_t ik = ie * ke - ix * kx - iy * ky - iz * kz;
+            real_t jk = je * ke - jx * kx - jy * ky - jz * kz;
+            real_t x = (ik + ij + jk) / ik;
+
+            //K, K~ and K + K~
+            real_t re = -(ie + je + ke), rx = -(ix + jx + kx);
+            real_t ry = -(iy + jy + ky), rz = -(iz + jz + kz);
+            real_t me = -(x * ie + ke), mx = -(x * ix + kx);
+            real_t my = -(x * iy + ky), mz = -(x * iz + kz);
+            real_t se = re + me, sx = rx + mx, sy = ry + my, sz = rz + mz;
+            real_t recoil2 = re * re - rx * rx - ry * ry - rz * rz;
+            real_t sum2 = se * se - sx * sx - sy * sy - sz * sz;
+
+            real_t pe = p[i], px = p[s + i], py = p[2 * s + i];
+            real_t pz = p[3 * s + i];
+            real_t alongSum = 2 * (pe * se - px * sx - py * sy - pz * sz)
+                            / sum2;
+            real_t alongRecoil = 2 * (pe * re - px * rx - py * ry - pz * rz)
+                               / recoil2;
+
+            mapped[i] = pe - alongSum * se + alongRecoil * me;
+            mapped[t + i] = px - alongSum * sx + alongRecoil * mx;
+            mapped[2 * t + i] = py - alongSum * sy + alongRecoil * my;
+            mapped[3 * t + i] = pz - alongSum * sz + alongRecoil * mz;
+        }
+    }
+}
@@ -0,0 +1,672 @@
+/*
+    Evaluation tape for the Berends-Giele recursion of phi^3 theory.
+    The dependency graph of the off-shell currents is compiled once per
+    multiplicity into a linear list of primitive instructions acting on
+    slots, which is then executed over a batch of events. Compiled tapes
+    can be stored as plan files that are mapped into memory on startup.
+*/
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <complex>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "definitions.h"
+#include "currenttable.h"
+#include "evaluationtape.h"
+#include "fourvector.h"
+#include "instrumentation.h"
+#include "kerneldispatch.h"
+
+namespace
+{
+    //Format version of plan files, to be increased whenever the file
+    //layout or the instructions emitted by compile () change
+    const uint32_t planVersion = 1;
+    const char planMagic[8] = {'N', 'L', 'O', '4', 'D', 'T', 'A', 'P'};
+
+    //Header of a plan file, followed by the instructions, the slots of
+    //all subsets, the first instruction and the currents of each level
+    struct PlanHeader
+    {
+        char magic_[8];
+        uint32_t version_;
+        uint32_t instructionSize_;
+        uint32_t numberOfLegs_;
+        uint32_t input_;
+        uint32_t numberOfInstructions_;
+        uint32_t numberOfSlots_;
+        uint32_t rootSlot_;
+        uint32_t numberOfSubsets_;
+        uint32_t numberOfLevelStarts_;
+        uint32_t numberOfLevelCurrents_;
+        uint64_t checksum_;
+        char padding_[8];
+    };
+    static_assert (sizeof (PlanHeader) == 64, "plan header must be 64 bytes");
+
+    //Checksum of the plan payload, four independent lanes of 64-bit
+    //multiply-xor hashing to keep up with memory bandwidth
+    uint64_t planChecksum (const char* data, const size_t& size)
+    {
+        const uint64_t prime = 0x100000001b3ull;
+        uint64_t lanes[4] = {0xcbf29ce484222325ull, 0x84222325cbf29ce4ull,
+                             0x9e3779b97f4a7c15ull, 0xbf58476d1ce4e5b9ull};
+
+        size_t i = 0;
+        for (; i + 32 <= size; i += 32)
+        {
+            uint64_t words[4];
+            std::memcpy (words, data + i, 32);
+            for (unsigned int lane = 0; lane < 4; lane++)
+            {
+                lanes[lane] = (lanes[lane] ^ words[lane]) * prime;
+            }
+        }
+        for (; i < size; i++)
+        {
+            lanes[0] = (lanes[0] ^ (unsigned char) data[i]) * prime;
+        }
+
+        uint64_t checksum = size;
+        for (unsigned int lane = 0; lane < 4; lane++)
+        {
+            checksum = (checksum ^ lanes[lane]) * prime;
+            checksum ^= checksum >> 29;
+        }
+
+        return checksum;
+    }
+
+    //Append an array to a byte buffer
+    template <class T>
+    void appendArray (std::vector <char>& buffer, const T* data,
+                      const size_t& size)
+    {
+        const char* bytes = reinterpret_cast <const char*> (data);
+        buffer.insert (buffer.end (), bytes, bytes + size * sizeof (T));
+    }
+
+    //Plan directory, initialized from the environment
+    std::string& planDirectoryStorage ()
+    {
+        static std::string directory =
+            (std::getenv ("NLO4D_PLAN_DIRECTORY") != nullptr)
+            ? std::getenv ("NLO4D_PLAN_DIRECTORY") : "";
+        return directory;
+    }
+}
+
+//Set plan directory
+void setPlanDirectory (const std::string& directory)
+{
+    planDirectoryStorage () = directory;
+}
+
+//Plan directory
+const std::string& planDirectory ()
+{
+    return planDirectoryStorage ();
+}
+
+//Constructor: default
+EvaluationTape::EvaluationTape ()
+    : planInstructions_ (nullptr), numberOfInstructions_ (0),
+      numberOfSlots_ (0), rootSlot_ (0), workspaceBatchSize_ (0),
+      numberOfLegs_ (0), input_ (TapeInput::MOMENTA), width_ (0) {}
+
+//Constructor: map plan file or compile tape for given multiplicity and
+//input
+EvaluationTape::EvaluationTape (const unsigned int& numberOfLegs,
+                                const TapeInput& input)
+    : planInstructions_ (nullptr), numberOfInstructions_ (0),
+      numberOfSlots_ (0), rootSlot_ (0), workspaceBatchSize_ (0),
+      numberOfLegs_ (numberOfLegs), input_ (input), width_ (0)
+{
+    std::string fileName = planFile (numberOfLegs, input);
+
+    //A valid plan of another multiplicity is a stale file as well
+    if (!fileName.empty () && load (fileName)
+        && numberOfLegs_ == numberOfLegs && input_ == input)
+    {
+        return;
+    }
+
+    numberOfLegs_ = numberOfLegs;
+    input_ = input;
+    compile ();
+
+    if (!fileName.empty ())
+    {
+        save (fileName);
+    }
+}
+
+//Build instruction list
+void EvaluationTape::compile ()
+{
+    instructions_.clear ();
+    slotOfSubset_.clear ();
+    levelStart_.clear ();
+    levelCurrents_.clear ();
+    numberOfSlots_ = 0;
+    numberOfInstructions_ = 0;
+    plan_.reset ();
+    planInstructions_ = nullptr;
+
+    //Less than three legs: no currents to compute
+    if (numberOfLegs_ < 3)
+    {
+        return;
+    }
+
+    //Recursion runs over the first n - 1 legs
+    unsigned int n = numberOfLegs_ - 1;
+    unsigned int fullSet = (1u << n) - 1;
+
+    //Assign slots ordered by subset size, so every subset is placed
+    //after all of its proper subsets. Within a size, ascending bitmasks
+    //keep subsets sharing their high legs together, which are the
+    //operands of neighbouring targets.
+    slotOfSubset_.assign (fullSet + 1, 0);
+    levelCurrents_.assign (n + 1, 0);
+    for (unsigned int size = 1; size <= n; size++)
+    {
+        for (unsigned int subset = 1; subset <= fullSet; subset++)
+        {
+            if (__builtin_popcount (subset) == (int) size)
+            {
+                slotOfSubset_[subset] = numberOfSlots_++;
+                levelCurrents_[size]++;
+            }
+        }
+    }
+    rootSlot_ = slotOfSubset_[fullSet];
+
+    //External legs
+    levelStart_.assign (n + 2, 0);
+    for (unsigned int leg = 0; leg < n; leg++)
+    {
+        if (input_ == TapeInput::MOMENTA)
+        {
+            instructions_.push_back ({TapeOperation::LOAD_MOMENTUM,
+                                      slotOfSubset_[1u << leg], leg, 0});
+        }
+        else
+        {
+            instructions_.push_back ({TapeOperation::LOAD_LEG_INVARIANT,
+                                      slotOfSubset_[1u << leg],
+                                      leg * n + leg, 0});
+        }
+    }
+
+    //Currents in order of increasing subset size
+    for (unsigned int size = 2; size <= n; size++)
+    {
+        levelStart_[size] = instructions_.size ();
+
+        for (unsigned int subset = 1; subset <= fullSet; subset++)
+        {
+            if (__builtin_popcount (subset) != (int) size)
+            {
+                continue;
+            }
+
+            unsigned int target = slotOfSubset_[subset];
+
+            //Subset momentum from its highest leg and the remainder,
+            //the root one is kept for the current table only
+            if (input_ == TapeInput::INVARIANTS)
+            {
+                compileInvariant (subset);
+            }
+            else
+            {
+                unsigned int highest = 1u << (31 - __builtin_clz (subset));
+
+                instructions_.push_back ({TapeOperation::MOMENTUM_ADD, target,
+                                          slotOfSubset_[subset ^ highest],
+                                          slotOfSubset_[highest]});
+                instructions_.push_back ({TapeOperation::INVARIANT, target,
+                                          target, 0});
+            }
+
+            //Splittings: the first set always contains the lowest leg.
+            //They are grouped by the size of the first set, so both
+            //operands sweep through one level of slots in order instead
+            //of alternating between levels.
+            unsigned int lowest = subset & (~subset + 1);
+            unsigned int rest = subset ^ lowest;
+
+            instructions_.push_back ({TapeOperation::CLEAR_CURRENT, target,
+                                      0, 0});
+
+            for (unsigned int partSize = 0; partSize < size - 1; partSize++)
+            {
+                unsigned int part = 0;
+                do
+                {
+                    if (__builtin_popcount (part) == (int) partSize)
+                    {
+                        unsigned int subset1 = lowest | part;
+                        unsigned int subset2 = subset ^ subset1;
+
+                        instructions_.push_back
+                            ({TapeOperation::MULTIPLY_ACCUMULATE, target,
+                              slotOfSubset_[subset1],
+                              slotOfSubset_[subset2]});
+                    }
+
+                    part = (part - rest) & rest;
+                }
+                while (part != 0);
+            }
+
+            if (subset != fullSet)
+            {
+                instructions_.push_back ({TapeOperation::PROPAGATOR, target,
+                                          target, 0});
+            }
+        }
+    }
+    levelStart_[n + 1] = instructions_.size ();
+    numberOfInstructions_ = instructions_.size ();
+}
+
+//Subset invariant from smaller subsets: with S = R + {l, h}
+//S^2 = (S - h)^2 + (S - l)^2 + (l + h)^2 - R^2 - l^2 - h^2
+void EvaluationTape::compileInvariant (const unsigned int& subset)
+{
+    unsigned int n = numberOfLegs_ - 1;
+    unsigned int target = slotOfSubset_[subset];
+    unsigned int lowest = subset & (~subset + 1);
+    unsigned int highest = 1u << (31 - __builtin_clz (subset));
+
+    //Pairs are read from the input directly
+    if (subset == (lowest | highest))
+    {
+        instructions_.push_back ({TapeOperation::LOAD_INVARIANT, target,
+                                  __builtin_ctz (lowest) * n
+                                  + __builtin_ctz (highest), 0});
+        return;
+    }
+
+    instructions_.push_back ({TapeOperation::INVARIANT_ADD, target,
+                              slotOfSubset_[subset ^ highest],
+                              slotOfSubset_[subset ^ lowest]});
+    instructions_.push_back ({TapeOperation::INVARIANT_ACCUMULATE, target,
+                              slotOfSubset_[lowest | highest],
+                              slotOfSubset_[subset ^ lowest ^ highest]});
+    instructions_.push_back ({TapeOperation::INVARIANT_SUBTRACT, target,
+                              slotOfSubset_[lowest], slotOfSubset_[highest]});
+}
+
+//Resize workspace if batch size changed
+void EvaluationTape::prepareWorkspace (const unsigned int& batchSize)
+{
+    if (batchSize == workspaceBatchSize_)
+    {
+        return;
+    }
+
+    //Momenta are not needed with invariant input
+    unsigned int momentumSlots =
+        (input_ == TapeInput::MOMENTA) ? numberOfSlots_ : 0;
+
+    NLO4D_COUNT (allocations_, (currentWorkspace_.capacity ()
+                                < 2 * numberOfSlots_ * batchSize) ? 3 : 0);
+
+    momentumWorkspace_.assign (4 * momentumSlots * batchSize, 0);
+    invariantWorkspace_.assign (numberOfSlots_ * batchSize, 0);
+    currentWorkspace_.assign (2 * numberOfSlots_ * batchSize, 0);
+
+    workspaceBatchSize_ = batchSize;
+}
+
+//Resize imaginary workspace of complex kinematics
+void EvaluationTape::prepareComplexWorkspace (const unsigned int& batchSize)
+{
+    prepareWorkspace (batchSize);
+
+    //Complex invariant input needs no momenta either
+    unsigned int momentumSlots =
+        (input_ == TapeInput::MOMENTA) ? numberOfSlots_ : 0;
+
+    if (invariantImagWorkspace_.size () != numberOfSlots_ * batchSize)
+    {
+        momentumImagWorkspace_.assign (4 * momentumSlots * batchSize, 0);
+        invariantImagWorkspace_.assign (numberOfSlots_ * batchSize, 0);
+    }
+}
+
+//Execute tape over a batch of events in SoA layout
+void EvaluationTape::execute (const real_t* input,
+                              const unsigned int& batchSize,
+                              const real_t& mass, complex_t* results,
+                              const unsigned int& inputStride)
+{
+    TapeLayout layout = {(inputStride == 0) ? batchSize : inputStride, 1};
+    execute (input, batchSize, mass, results, layout);
+}
+
+//Execute tape over a batch of events with arbitrary strides
+void EvaluationTape::execute (const real_t* input,
+                              const unsigned int& batchSize,
+                              const real_t& mass, complex_t* results,
+                              const TapeLayout& layout)
+{
+    if (numberOfSlots_ == 0)
+    {
+        for (unsigned int event = 0; event < batchSize; event++)
+        {
+            results[event] = 0;
+        }
+        return;
+    }
+
+    prepareWorkspace (batchSize);
+
+    const unsigned int b = batchSize;
+    const real_t massSquared = mass * mass;
+    const real_t massWidth = mass * width_;
+
+    real_t* momentum = momentumWorkspace_.data ();
+    real_t* invariant = invariantWorkspace_.data ();
+    real_t* current = currentWorkspace_.data ();
+
+    const unsigned int stride = layout.entryStride_;
+    const unsigned int eventStride = layout.eventStride_;
+
+#ifdef NLO4D_INSTRUMENTATION
+    //Level by level, to attribute cycles to subset sizes
+    for (unsigned int level = 1; level + 1 < levelStart_.size (); level++)
+    {
+        NLO4D_TIMER_START (timer);
+        tapeKernel () (instructions () + levelStart_[level],
+                       levelStart_[level + 1] - levelStart_[level], input,
+                       stride, eventStride, b, massSquared, massWidth,
+                       momentum, invariant, current);
+        NLO4D_TIMER_LEVEL (timer, level,
+                           (unsigned long long) levelCurrents_[level] * b);
+    }
+    NLO4D_COUNT (amplitudes_, b);
+    NLO4D_COUNT (currentsComputed_,
+                 (unsigned long long) (numberOfSlots_ - levelCurrents_[1]) * b);
+#else
+    tapeKernel () (instructions (), numberOfInstructions_, input, stride,
+                   eventStride, b, massSquared, massWidth, momentum,
+                   invariant, current);
+#endif
+
+    //Vertex of the root current
+    for (unsigned int i = 0; i < b; i++)
+    {
+        results[i] = imaginaryUnit
+                   * complex_t (current[2 * rootSlot_ * b + i],
+                                current[(2 * rootSlot_ + 1) * b + i]);
+    }
+}
+
+//Execute tape with complex kinematics
+void EvaluationTape::execute (const real_t* inputReal,
+                              const real_t* inputImag,
+                              const unsigned int& batchSize,
+                              const real_t& mass, complex_t* results,
+                              const TapeLayout& layout)
+{
+    if (numberOfSlots_ == 0)
+    {
+        for (unsigned int event = 0; event < batchSize; event++)
+        {
+            results[event] = 0;
+        }
+        return;
+    }
+
+    prepareComplexWorkspace (batchSize);
+
+    const unsigned int b = batchSize;
+    real_t* current = currentWorkspace_.data ();
+
+    complexTapeKernel () (instructions (), numberOfInstructions_,
+                          inputReal, inputImag, layout.entryStride_,
+                          layout.eventStride_, b, mass * mass, mass * width_,
+                          momentumWorkspace_.data (),
+                          momentumImagWorkspace_.data (),
+                          invariantWorkspace_.data (),
+                          invariantImagWorkspace_.data (), current);
+    NLO4D_COUNT (amplitudes_, b);
+
+    //Vertex of the root current
+    for (unsigned int i = 0; i < b; i++)
+    {
+        results[i] = imaginaryUnit
+                   * complex_t (current[2 * rootSlot_ * b + i],
+                                current[(2 * rootSlot_ + 1) * b + i]);
+    }
+}
+
+//Copy currents, momenta and invariants of one event of the last
+//execution into a table indexed by subset bitmask
+void EvaluationTape::exportEvent (const unsigned int& event,
+                                  CurrentTable& table) const
+{
+    const unsigned int b = workspaceBatchSize_;
+    const unsigned int n = (numberOfLegs_ < 3) ? 0 : numberOfLegs_ - 1;
+    const unsigned int fullSet = (1u << n) - 1;
+    const bool momenta = (input_ == TapeInput::MOMENTA);
+
+    table.resize (numberOfLegs_, momenta);
+
+    if (numberOfSlots_ == 0 || event >= b)
+    {
+        return;
+    }
+
+    for (unsigned int subset = 1; subset <= fullSet; subset++)
+    {
+        unsigned int s = slotOfSubset_[subset];
+
+        complex_t current (currentWorkspace_[2 * s * b + event],
+                           currentWorkspace_[(2 * s + 1) * b + event]);
+        //Root holds the amputated current, i.e. including the vertex
+        table.currents_[subset] =
+            (subset == fullSet) ? imaginaryUnit * current : current;
+
+        if (momenta)
+        {
+            for (unsigned int j = 0; j < 4; j++)
+            {
+                table.momenta_[4 * subset + j] =
+                    momentumWorkspace_[(4 * s + j) * b + event];
+            }
+        }
+
+        //Single leg invariants are only loaded with invariant input
+        if (momenta && __builtin_popcount (subset) == 1)
+        {
+            table.invariants_[subset] = table.momentum (subset).square ();
+        }
+        else
+        {
+            table.invariants_[subset] = invariantWorkspace_[s * b + event];
+        }
+    }
+}
+
+//Width of the propagators
+void EvaluationTape::setWidth (const real_t& width)
+{
+    width_ = width;
+}
+
+//Store compiled tape in a plan file. It is written under a temporary
+//name and renamed, so concurrent processes never see a partial file.
+bool EvaluationTape::save (const std::string& fileName) const
+{
+    std::vector <char> payload;
+    appendArray (payload, instructions (), numberOfInstructions_);
+    appendArray (payload, slotOfSubset_.data (), slotOfSubset_.size ());
+    appendArray (payload, levelStart_.data (), levelStart_.size ());
+    appendArray (payload, levelCurrents_.data (), levelCurrents_.size ());
+
+    PlanHeader header;
+    std::memset (&header, 0, sizeof (PlanHeader));
+    std::memcpy (header.magic_, planMagic, sizeof (planMagic));
+    header.version_ = planVersion;
+    header.instructionSize_ = sizeof (TapeInstruction);
+    header.numberOfLegs_ = numberOfLegs_;
+    header.input_ = (uint32_t) input_;
+    header.numberOfInstructions_ = numberOfInstructions_;
+    header.numberOfSlots_ = numberOfSlots_;
+    header.rootSlot_ = rootSlot_;
+    header.numberOfSubsets_ = slotOfSubset_.size ();
+    header.numberOfLevelStarts_ = levelStart_.size ();
+    header.numberOfLevelCurrents_ = levelCurrents_.size ();
+    header.checksum_ = planChecksum (payload.data (), payload.size ());
+
+    std::string temporary = fileName + ".tmp" + std::to_string (getpid ());
+    std::ofstream out (temporary, std::ios::binary);
+    out.write (reinterpret_cast <const char*> (&header), sizeof (PlanHeader));
+    out.write (payload.data (), payload.size ());
+    out.close ();
+
+    if (!out || std::rename (temporary.c_str (), fileName.c_str ()) != 0)
+    {
+        std::cout << "Error: could not write plan file " << fileName << "\n";
+        std::remove (temporary.c_str ());
+        return false;
+    }
+
+    return true;
+}
+
+//Map a plan file, the instructions are used in place
+bool EvaluationTape::load (const std::string& fileName)
+{
+    int descriptor = open (fileName.c_str (), O_RDONLY);
+    if (descriptor < 0)
+    {
+        return false;
+    }
+
+    struct stat status;
+    if (fstat (descriptor, &status) != 0
+        || status.st_size < (off_t) sizeof (PlanHeader))
+    {
+        close (descriptor);
+        return false;
+    }
+
+    const size_t size = status.st_size;
+    void* address = mmap (nullptr, size, PROT_READ, MAP_PRIVATE,
+                          descriptor, 0);
+    close (descriptor);
+    if (address == MAP_FAILED)
+    {
+        return false;
+    }
+
+    std::shared_ptr <const char> plan
+        (static_cast <const char*> (address),
+         [size] (const char* data) { munmap ((void*) data, size); });
+
+    //Format, sizes and checksum have to match
+    PlanHeader header;
+    std::memcpy (&header, plan.get (), sizeof (PlanHeader));
+    const size_t payloadSize =
+        (size_t) header.numberOfInstructions_ * sizeof (TapeInstruction)
+        + ((size_t) header.numberOfSubsets_ + header.numberOfLevelStarts_
+           + header.numberOfLevelCurrents_) * sizeof (unsigned int);
+    const char* payload = plan.get () + sizeof (PlanHeader);
+
+    if (std::memcmp (header.magic_, planMagic, sizeof (planMagic)) != 0
+        || header.version_ != planVersion
+        || header.instructionSize_ != sizeof (TapeInstruction)
+        || size != sizeof (PlanHeader) + payloadSize
+        || header.checksum_ != planChecksum (payload, payloadSize))
+    {
+        return false;
+    }
+
+    const unsigned int* slots = reinterpret_cast <const unsigned int*>
+        (payload + header.numberOfInstructions_ * sizeof (TapeInstruction));
+    const unsigned int* levelStarts = slots + header.numberOfSubsets_;
+    const unsigned int* levelCurrents =
+        levelStarts + header.numberOfLevelStarts_;
+
+    instructions_.clear ();
+    plan_ = plan;
+    planInstructions_ = reinterpret_cast <const TapeInstruction*> (payload);
+    numberOfInstructions_ = header.numberOfInstructions_;
+    slotOfSubset_.assign (slots, slots + header.numberOfSubsets_);
+    levelStart_.assign (levelStarts,
+                        levelStarts + header.numberOfLevelStarts_);
+    levelCurrents_.assign (levelCurrents,
+                           levelCurrents + header.numberOfLevelCurrents_);
+    numberOfSlots_ = header.numberOfSlots_;
+    rootSlot_ = header.rootSlot_;
+    numberOfLegs_ = header.numberOfLegs_;
+    input_ = (TapeInput) header.input_;
+
+    //Workspace is sized for the previous tape
+    workspaceBatchSize_ = 0;
+
+    return true;
+}
+
+//Plan file of a multiplicity and input in the plan directory
+std::string EvaluationTape::planFile (const unsigned int& numberOfLegs,
+                                      const TapeInput& input)
+{
+    const std::string& directory = planDirectory ();
+    if (directory.empty () || numberOfLegs < 3)
+    {
+        return "";
+    }
+
+    return directory + "/tape_" + std::to_string (numberOfLegs)
+        + ((input == TapeInput::MOMENTA) ? "_momenta" : "_invariants")
+        + "_v" + std::to_string (planVersion) + ".plan";
+}
+
+//Getters
+const TapeInstruction* EvaluationTape::instructions () const
+{
+    return (plan_ != nullptr) ? planInstructions_ : instructions_.data ();
+}
+
+unsigned int EvaluationTape::numberOfInstructions () const
+{
+    return numberOfInstructions_;
+}
+
+bool EvaluationTape::mapped () const
+{
+    return plan_ != nullptr;
+}
+
+TapeInput EvaluationTape::input () const
+{
+    return input_;
+}
+
+unsigned int EvaluationTape::numberOfSlots () const
+{
+    return numberOfSlots_;
+}
+
+unsigned int EvaluationTape::slot (const unsigned int& subset) const
+{
+    return slotOfSubset_.at (subset);
+}
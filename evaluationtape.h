@@ -0,0 +1,183 @@
+/*
+    Evaluation tape for the Berends-Giele recursion of phi^3 theory.
+    The dependency graph of the off-shell currents is compiled once per
+    multiplicity into a linear list of primitive instructions acting on
+    slots, which is then executed over a batch of events. Compiled tapes
+    can be stored as plan files that are mapped into memory on startup.
+*/
+
+#ifndef EVALUATION_TAPE
+#define EVALUATION_TAPE
+
+#include <complex>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "definitions.h"
+#include "memoryplacement.h"
+
+class CurrentTable;
+
+//Primitive operations of the tape
+enum class TapeOperation : unsigned char
+{
+    //momentum[target] = external leg 'first', current[target] = 1
+    LOAD_MOMENTUM,
+    //momentum[target] = momentum[first] + momentum[second]
+    MOMENTUM_ADD,
+    //invariant[target] = momentum[first]^2
+    INVARIANT,
+    //current[target] = 0
+    CLEAR_CURRENT,
+    //current[target] += current[first] * current[second]
+    MULTIPLY_ACCUMULATE,
+    //current[target] *= vertex * propagator (invariant[first])
+    PROPAGATOR,
+    //invariant[target] = input invariant 'first', current[target] = 1
+    LOAD_LEG_INVARIANT,
+    //invariant[target] = input invariant 'first'
+    LOAD_INVARIANT,
+    //invariant[target] = invariant[first] + invariant[second]
+    INVARIANT_ADD,
+    //invariant[target] += invariant[first] - invariant[second]
+    INVARIANT_ACCUMULATE,
+    //invariant[target] -= invariant[first] + invariant[second]
+    INVARIANT_SUBTRACT
+};
+
+//Kinematic input of the tape
+enum class TapeInput : unsigned char
+{
+    //Four-momenta of the legs
+    MOMENTA,
+    //Matrix of invariants s_ij = (p_i + p_j)^2, s_ii = p_i^2
+    INVARIANTS
+};
+
+//Strides of the kinematic input, in units of real_t
+struct TapeLayout
+{
+    //Between consecutive entries: momentum components leg * 4 + component
+    //or invariants leg1 * (numberOfLegs - 1) + leg2
+    unsigned int entryStride_;
+    //Between consecutive events
+    unsigned int eventStride_;
+};
+
+struct TapeInstruction
+{
+    TapeOperation operation_;
+    unsigned int target_;
+    unsigned int first_;
+    unsigned int second_;
+};
+
+//Directory of plan files, taken from the environment variable
+//NLO4D_PLAN_DIRECTORY by default. Empty disables plan files.
+void setPlanDirectory (const std::string& directory);
+const std::string& planDirectory ();
+
+class EvaluationTape
+{
+public:
+    //Constructor: default
+    EvaluationTape ();
+    //Constructor: tape for given multiplicity and input, mapped from the
+    //plan directory if a valid plan exists there, otherwise compiled and
+    //stored for the next start
+    EvaluationTape (const unsigned int& numberOfLegs,
+                    const TapeInput& input = TapeInput::MOMENTA);
+
+    //Store compiled tape in a plan file, false on I/O errors
+    bool save (const std::string& fileName) const;
+    //Map a plan file, false and unchanged tape if the file is missing,
+    //from another format version or fails its checksum
+    bool load (const std::string& fileName);
+    //Plan file of a multiplicity and input in the plan directory, empty
+    //if plan files are disabled
+    static std::string planFile (const unsigned int& numberOfLegs,
+                                 const TapeInput& input);
+
+    //Execute tape over a batch of events
+    //input:   SoA layout holding the first numberOfLegs - 1 legs,
+    //         MOMENTA: input[(leg * 4 + component) * stride + event]
+    //         INVARIANTS: input[(leg1 * (numberOfLegs - 1) + leg2)
+    //                           * stride + event]
+    //         with stride = inputStride, or batchSize if zero
+    //results: vertex times root current for each event, coupling excluded
+    void execute (const real_t* input, const unsigned int& batchSize,
+                  const real_t& mass, complex_t* results,
+                  const unsigned int& inputStride = 0);
+    //Execute tape on input with arbitrary strides, e.g. one event after
+    //the other: {1, 4 * numberOfLegs} for momenta
+    void execute (const real_t* input, const unsigned int& batchSize,
+                  const real_t& mass, complex_t* results,
+                  const TapeLayout& layout);
+
+    //Execute tape with complex kinematics, real and imaginary parts of
+    //the input in separate arrays of the same layout
+    void execute (const real_t* inputReal, const real_t* inputImag,
+                  const unsigned int& batchSize, const real_t& mass,
+                  complex_t* results, const TapeLayout& layout);
+
+    //Export one event of the last execution, for complex kinematics
+    //momenta and invariants hold their real parts
+    void exportEvent (const unsigned int& event, CurrentTable& table) const;
+
+    //Width of the propagators in the fixed-width scheme, zero by default
+    void setWidth (const real_t& width);
+
+    //Getters
+    const TapeInstruction* instructions () const;
+    unsigned int numberOfInstructions () const;
+    //True if the instructions are mapped from a plan file
+    bool mapped () const;
+    TapeInput input () const;
+    unsigned int numberOfSlots () const;
+    //Slot of the subset given by its bitmask
+    unsigned int slot (const unsigned int& subset) const;
+
+private:
+    //Build instruction list
+    void compile ();
+    //Instructions of a subset invariant for invariant input
+    void compileInvariant (const unsigned int& subset);
+    //Resize workspace if batch size changed
+    void prepareWorkspace (const unsigned int& batchSize);
+    //Also resize the imaginary parts of momenta and invariants
+    void prepareComplexWorkspace (const unsigned int& batchSize);
+
+    //Instructions, either compiled or mapped from a plan file
+    std::vector <TapeInstruction> instructions_;
+    std::shared_ptr <const char> plan_;
+    const TapeInstruction* planInstructions_;
+    unsigned int numberOfInstructions_;
+    //Subset bitmask -> slot index
+    std::vector <unsigned int> slotOfSubset_;
+    unsigned int numberOfSlots_;
+    unsigned int rootSlot_;
+    //First instruction and number of currents of each subset size,
+    //used to attribute time to recursion levels
+    std::vector <unsigned int> levelStart_;
+    std::vector <unsigned int> levelCurrents_;
+
+    //Workspace, slot-major with events innermost, placed on the node of
+    //the thread preparing it
+    PlacedVector <real_t> momentumWorkspace_;
+    PlacedVector <real_t> invariantWorkspace_;
+    //Real and imaginary row of the current of a slot are adjacent
+    PlacedVector <real_t> currentWorkspace_;
+    //Imaginary parts, complex kinematics only
+    PlacedVector <real_t> momentumImagWorkspace_;
+    PlacedVector <real_t> invariantImagWorkspace_;
+    unsigned int workspaceBatchSize_;
+
+    //Parameters
+    unsigned int numberOfLegs_;
+    TapeInput input_;
+    real_t width_;
+
+};
+
+#endif
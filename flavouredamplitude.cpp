@@ -0,0 +1,496 @@
+/*
+    Tree amplitudes of several scalar species with cubic couplings
+    lambda_abc and masses m_a. Every off-shell current carries the flavour
+    of the line attaching it to the rest of the diagram. For given
+    flavours of the external legs only the (subset, flavour) currents and
+    flavour splittings with non-vanishing couplings that reach the root
+    are compiled, so the cost scales with the non-zero couplings instead
+    of the cube of the number of species.
+*/
+#include <complex>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+#include "definitions.h"
+#include "flavouredamplitude.h"
+#include "fourvector.h"
+#include "instrumentation.h"
+
+namespace
+{
+    //Flavour splitting found in the forward pass of the compilation
+    struct FlavourTerm
+    {
+        unsigned int subset_;
+        unsigned int flavour_;
+        unsigned int subset1_;
+        unsigned int flavour1_;
+        unsigned int subset2_;
+        unsigned int flavour2_;
+        real_t coupling_;
+    };
+}
+
+//---SCALAR THEORY---
+
+//Constructor
+ScalarTheory::ScalarTheory (const std::vector <real_t>& masses)
+    : couplings_ (masses.size () * masses.size () * masses.size (), 0),
+      masses_ (masses) {}
+
+//Set coupling with all permutations
+void ScalarTheory::setCoupling (const unsigned int& a, const unsigned int& b,
+                                const unsigned int& c,
+                                const real_t& coupling)
+{
+    const unsigned int n = masses_.size ();
+    if (a >= n || b >= n || c >= n)
+    {
+        std::cout << "Error: species of coupling exceeds "
+            << "number of species\n";
+        return;
+    }
+
+    couplings_[(a * n + b) * n + c] = coupling;
+    couplings_[(a * n + c) * n + b] = coupling;
+    couplings_[(b * n + a) * n + c] = coupling;
+    couplings_[(b * n + c) * n + a] = coupling;
+    couplings_[(c * n + a) * n + b] = coupling;
+    couplings_[(c * n + b) * n + a] = coupling;
+}
+
+//Number of species
+unsigned int ScalarTheory::numberOfSpecies () const
+{
+    return masses_.size ();
+}
+
+//Mass of a species
+real_t ScalarTheory::mass (const unsigned int& a) const
+{
+    return masses_[a];
+}
+
+//Coupling lambda_abc
+real_t ScalarTheory::coupling (const unsigned int& a, const unsigned int& b,
+                               const unsigned int& c) const
+{
+    const unsigned int n = masses_.size ();
+    return couplings_[(a * n + b) * n + c];
+}
+
+//---FLAVOURED TREE AMPLITUDE---
+
+//Constructor
+FlavouredTreeAmplitude::FlavouredTreeAmplitude
+    (const ScalarTheory& theory, const std::vector <unsigned int>& flavours)
+    : numberOfSlots_ (0), numberOfCurrents_ (0), numberOfTerms_ (0),
+      rootRow_ (0), workspaceBatchSize_ (0), flavours_ (flavours),
+      numberOfLegs_ (flavours.size ()),
+      numberOfSpecies_ (theory.numberOfSpecies ())
+{
+    compile (theory);
+}
+
+//Build instruction list
+void FlavouredTreeAmplitude::compile (const ScalarTheory& theory)
+{
+    const unsigned int species = numberOfSpecies_;
+
+    //Less than three legs: no currents to compute
+    if (numberOfLegs_ < 3)
+    {
+        return;
+    }
+    for (auto flavour : flavours_)
+    {
+        if (flavour >= species)
+        {
+            std::cout << "Error: flavour of external leg exceeds "
+                << "number of species\n";
+            return;
+        }
+    }
+
+    //Recursion runs over the first n - 1 legs, the last one closes it
+    unsigned int n = numberOfLegs_ - 1;
+    unsigned int fullSet = (1u << n) - 1;
+    unsigned int rootFlavour = flavours_[n];
+
+    //Non-vanishing couplings lambda_abc of each pair (b, c)
+    std::vector <std::vector <std::pair <unsigned int, real_t>>> vertices
+        (species * species);
+    for (unsigned int a = 0; a < species; a++)
+    {
+        for (unsigned int b = 0; b < species; b++)
+        {
+            for (unsigned int c = 0; c < species; c++)
+            {
+                if (theory.coupling (a, b, c) != 0)
+                {
+                    vertices[b * species + c].push_back
+                        ({a, theory.coupling (a, b, c)});
+                }
+            }
+        }
+    }
+
+    //Forward pass: flavours a subset can carry, from the flavours of its
+    //splittings, in order of increasing subset size
+    std::vector <unsigned char> allowed ((fullSet + 1) * species, 0);
+    for (unsigned int leg = 0; leg < n; leg++)
+    {
+        allowed[(1u << leg) * species + flavours_[leg]] = 1;
+    }
+
+    std::vector <FlavourTerm> terms;
+    for (unsigned int size = 2; size <= n; size++)
+    {
+        for (unsigned int subset = 1; subset <= fullSet; subset++)
+        {
+            if (__builtin_popcount (subset) != (int) size)
+            {
+                continue;
+            }
+
+            //Splittings: the first set always contains the lowest leg
+            unsigned int lowest = subset & (~subset + 1);
+            unsigned int rest = subset ^ lowest;
+            unsigned int part = 0;
+            do
+            {
+                unsigned int subset1 = lowest | part;
+                unsigned int subset2 = subset ^ subset1;
+                part = (part - rest) & rest;
+                if (subset2 == 0)
+                {
+                    continue;
+                }
+
+                for (unsigned int b = 0; b < species; b++)
+                {
+                    if (!allowed[subset1 * species + b])
+                    {
+                        continue;
+                    }
+                    for (unsigned int c = 0; c < species; c++)
+                    {
+                        if (!allowed[subset2 * species + c])
+                        {
+                            continue;
+                        }
+                        for (auto& vertex : vertices[b * species + c])
+                        {
+                            //The root only couples to the last leg
+                            if (subset == fullSet
+                                && vertex.first != rootFlavour)
+                            {
+                                continue;
+                            }
+                            allowed[subset * species + vertex.first] = 1;
+                            terms.push_back ({subset, vertex.first, subset1,
+                                              b, subset2, c, vertex.second});
+                        }
+                    }
+                }
+            }
+            while (part != 0);
+        }
+    }
+
+    //Backward pass: keep the currents reaching the root
+    std::vector <unsigned char> needed ((fullSet + 1) * species, 0);
+    needed[fullSet * species + rootFlavour] =
+        allowed[fullSet * species + rootFlavour];
+    for (unsigned int k = terms.size (); k-- > 0;)
+    {
+        const FlavourTerm& term = terms[k];
+        if (needed[term.subset_ * species + term.flavour_])
+        {
+            needed[term.subset1_ * species + term.flavour1_] = 1;
+            needed[term.subset2_ * species + term.flavour2_] = 1;
+        }
+    }
+
+    //Vanishing amplitude, e.g. a flavour not reaching the last leg
+    if (!needed[fullSet * species + rootFlavour])
+    {
+        return;
+    }
+
+    //Slots of the subsets with currents, ordered by subset size
+    slotOfSubset_.assign (fullSet + 1, 0);
+    for (unsigned int size = 1; size <= n; size++)
+    {
+        for (unsigned int subset = 1; subset <= fullSet; subset++)
+        {
+            if (__builtin_popcount (subset) != (int) size)
+            {
+                continue;
+            }
+
+            unsigned int currents = 0;
+            for (unsigned int a = 0; a < species; a++)
+            {
+                currents += needed[subset * species + a];
+            }
+            if (currents > 0)
+            {
+                slotOfSubset_[subset] = numberOfSlots_++;
+                subsetsWithCurrents_.push_back (subset);
+                numberOfCurrents_ += currents;
+            }
+        }
+    }
+    rootRow_ = slotOfSubset_[fullSet] * species + rootFlavour;
+
+    //Momentum of a slot from the slots of one of its splittings
+    slotSplittings_.assign (2 * numberOfSlots_, 0);
+    for (const auto& term : terms)
+    {
+        if (needed[term.subset_ * species + term.flavour_])
+        {
+            unsigned int slot = slotOfSubset_[term.subset_];
+            slotSplittings_[2 * slot] = slotOfSubset_[term.subset1_];
+            slotSplittings_[2 * slot + 1] = slotOfSubset_[term.subset2_];
+        }
+    }
+
+    //External legs
+    for (unsigned int leg = 0; leg < n; leg++)
+    {
+        unsigned int subset = 1u << leg;
+        if (needed[subset * species + flavours_[leg]])
+        {
+            instructions_.push_back ({FlavourOperation::LOAD_LEG,
+                                      slotOfSubset_[subset] * species
+                                      + flavours_[leg], 0, 0, 0});
+        }
+    }
+
+    //Propagators of the flavours of a subset, not for the root
+    auto appendPropagators = [&] (const unsigned int& subset)
+    {
+        if (subset == 0 || subset == fullSet)
+        {
+            return;
+        }
+        for (unsigned int a = 0; a < species; a++)
+        {
+            if (needed[subset * species + a])
+            {
+                real_t mass = theory.mass (a);
+                instructions_.push_back ({FlavourOperation::PROPAGATOR,
+                                          slotOfSubset_[subset] * species
+                                          + a, slotOfSubset_[subset], 0,
+                                          mass * mass});
+            }
+        }
+    };
+
+    //Splittings in order of subset size, the terms of a subset are
+    //followed by its propagators
+    unsigned int previous = 0;
+    for (const auto& term : terms)
+    {
+        if (!needed[term.subset_ * species + term.flavour_])
+        {
+            continue;
+        }
+        if (term.subset_ != previous)
+        {
+            appendPropagators (previous);
+            previous = term.subset_;
+        }
+
+        instructions_.push_back
+            ({FlavourOperation::ACCUMULATE,
+              slotOfSubset_[term.subset_] * species + term.flavour_,
+              slotOfSubset_[term.subset1_] * species + term.flavour1_,
+              slotOfSubset_[term.subset2_] * species + term.flavour2_,
+              term.coupling_});
+        numberOfTerms_++;
+    }
+    appendPropagators (previous);
+}
+
+//Resize workspace if batch size changed
+void FlavouredTreeAmplitude::prepareWorkspace (const unsigned int& batchSize)
+{
+    if (batchSize == workspaceBatchSize_)
+    {
+        return;
+    }
+
+    NLO4D_COUNT (allocations_, 3);
+    momentumWorkspace_.assign (4 * numberOfSlots_ * batchSize, 0);
+    invariantWorkspace_.assign (numberOfSlots_ * batchSize, 0);
+    currentWorkspace_.assign (numberOfSlots_ * numberOfSpecies_ * batchSize,
+                              0);
+
+    workspaceBatchSize_ = batchSize;
+}
+
+//Amplitude
+complex_t FlavouredTreeAmplitude::amplitude
+    (const std::vector <FourVector <real_t>>& momenta)
+{
+    if (momenta.size () != numberOfLegs_)
+    {
+        std::cout << "Error: number of legs and "
+            << "number of external momenta do not match\n";
+        return 0;
+    }
+
+    //All but the last leg, batch of one event
+    momentumBuffer_.resize (4 * numberOfLegs_);
+    for (unsigned int i = 0; i + 1 < numberOfLegs_; i++)
+    {
+        for (unsigned int j = 0; j < 4; j++)
+        {
+            momentumBuffer_[4 * i + j] = momenta[i](j);
+        }
+    }
+
+    complex_t result = 0;
+    amplitude (momentumBuffer_.data (), 1, 1, &result);
+
+    return result;
+}
+
+//Amplitudes for a batch of events in SoA layout
+void FlavouredTreeAmplitude::amplitude (const real_t* momenta,
+                                        const unsigned int& batchSize,
+                                        const unsigned int& stride,
+                                        complex_t* results)
+{
+    const unsigned int b = batchSize;
+
+    if (numberOfSlots_ == 0)
+    {
+        for (unsigned int i = 0; i < b; i++)
+        {
+            results[i] = 0;
+        }
+        return;
+    }
+
+    prepareWorkspace (b);
+
+    const unsigned int inputStride = (stride == 0) ? b : stride;
+    real_t* momentum = momentumWorkspace_.data ();
+    real_t* invariant = invariantWorkspace_.data ();
+    real_t* current = currentWorkspace_.data ();
+
+    //Momenta of the subsets with currents, legs from the input and every
+    //other subset from the two smaller ones of a splitting
+    for (unsigned int slot = 0; slot < numberOfSlots_; slot++)
+    {
+        unsigned int subset = subsetsWithCurrents_[slot];
+        real_t* target = momentum + 4 * slot * b;
+        if (__builtin_popcount (subset) == 1)
+        {
+            unsigned int leg = __builtin_ctz (subset);
+            for (unsigned int j = 0; j < 4; j++)
+            {
+                const real_t* source = momenta + (4 * leg + j) * inputStride;
+                for (unsigned int i = 0; i < b; i++)
+                {
+                    target[j * b + i] = source[i];
+                }
+            }
+            continue;
+        }
+
+        const real_t* first = momentum + 4 * slotSplittings_[2 * slot] * b;
+        const real_t* second =
+            momentum + 4 * slotSplittings_[2 * slot + 1] * b;
+        for (unsigned int i = 0; i < 4 * b; i++)
+        {
+            target[i] = first[i] + second[i];
+        }
+    }
+    for (unsigned int slot = 0; slot < numberOfSlots_; slot++)
+    {
+        const real_t* p = momentum + 4 * slot * b;
+        real_t* target = invariant + slot * b;
+        for (unsigned int i = 0; i < b; i++)
+        {
+            target[i] = p[i] * p[i] - p[b + i] * p[b + i]
+                      - p[2 * b + i] * p[2 * b + i]
+                      - p[3 * b + i] * p[3 * b + i];
+        }
+    }
+
+    //Currents of all flavours start from zero, they stay real without
+    //widths
+    for (auto& value : currentWorkspace_)
+    {
+        value = 0;
+    }
+
+    for (const auto& instruction : instructions_)
+    {
+        real_t* target = current + instruction.target_ * b;
+
+        switch (instruction.operation_)
+        {
+            case FlavourOperation::LOAD_LEG:
+            {
+                for (unsigned int i = 0; i < b; i++)
+                {
+                    target[i] = 1;
+                }
+                break;
+            }
+            case FlavourOperation::ACCUMULATE:
+            {
+                const real_t* first = current + instruction.first_ * b;
+                const real_t* second = current + instruction.second_ * b;
+                const real_t coupling = instruction.value_;
+                for (unsigned int i = 0; i < b; i++)
+                {
+                    target[i] += coupling * first[i] * second[i];
+                }
+                break;
+            }
+            case FlavourOperation::PROPAGATOR:
+            {
+                //vertex * propagator = i * i / (p^2 - m^2)
+                const real_t* p2 = invariant + instruction.first_ * b;
+                const real_t massSquared = instruction.value_;
+                for (unsigned int i = 0; i < b; i++)
+                {
+                    target[i] *= - 1 / (p2[i] - massSquared);
+                }
+                break;
+            }
+        }
+    }
+    NLO4D_COUNT (amplitudes_, b);
+
+    //Vertex of the root current
+    for (unsigned int i = 0; i < b; i++)
+    {
+        results[i] = imaginaryUnit * current[rootRow_ * b + i];
+    }
+}
+
+//Number of legs
+unsigned int FlavouredTreeAmplitude::numberOfLegs () const
+{
+    return numberOfLegs_;
+}
+
+//Number of compiled currents
+unsigned int FlavouredTreeAmplitude::numberOfCurrents () const
+{
+    return numberOfCurrents_;
+}
+
+//Number of compiled flavour splittings
+unsigned int FlavouredTreeAmplitude::numberOfTerms () const
+{
+    return numberOfTerms_;
+}
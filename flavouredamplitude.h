@@ -0,0 +1,123 @@
+/*
+    Tree amplitudes of several scalar species with cubic couplings
+    lambda_abc and masses m_a. Every off-shell current carries the flavour
+    of the line attaching it to the rest of the diagram. For given
+    flavours of the external legs only the (subset, flavour) currents and
+    flavour splittings with non-vanishing couplings that reach the root
+    are compiled, so the cost scales with the non-zero couplings instead
+    of the cube of the number of species.
+*/
+
+#ifndef FLAVOURED_AMPLITUDE
+#define FLAVOURED_AMPLITUDE
+
+#include <complex>
+#include <vector>
+
+#include "definitions.h"
+#include "fourvector.h"
+#include "memoryplacement.h"
+
+class ScalarTheory
+{
+public:
+    //Constructor: one species per mass, all couplings zero
+    ScalarTheory (const std::vector <real_t>& masses);
+
+    //Set lambda_abc together with all permutations of its indices
+    void setCoupling (const unsigned int& a, const unsigned int& b,
+                      const unsigned int& c, const real_t& coupling);
+
+    //Getters
+    unsigned int numberOfSpecies () const;
+    real_t mass (const unsigned int& a) const;
+    real_t coupling (const unsigned int& a, const unsigned int& b,
+                     const unsigned int& c) const;
+
+private:
+    //lambda_abc at (a * numberOfSpecies + b) * numberOfSpecies + c
+    std::vector <real_t> couplings_;
+
+    //Parameters
+    std::vector <real_t> masses_;
+
+};
+
+//Operations of the compiled flavour recursion
+enum class FlavourOperation : unsigned char
+{
+    //current[target] = 1, external leg
+    LOAD_LEG,
+    //current[target] += value * current[first] * current[second]
+    ACCUMULATE,
+    //current[target] *= vertex * propagator (invariant[first], value = m^2)
+    PROPAGATOR
+};
+
+//Operands are rows, slot * numberOfSpecies + flavour, of the currents
+//and slots of the invariants
+struct FlavourInstruction
+{
+    FlavourOperation operation_;
+    unsigned int target_;
+    unsigned int first_;
+    unsigned int second_;
+    real_t value_;
+};
+
+class FlavouredTreeAmplitude
+{
+public:
+    //Constructor: amplitude of 'theory' with the given flavours of the
+    //external legs, all momenta incoming
+    FlavouredTreeAmplitude (const ScalarTheory& theory,
+                            const std::vector <unsigned int>& flavours);
+
+    //Amplitude
+    complex_t amplitude (const std::vector <FourVector <real_t>>& momenta);
+    //Amplitudes for a batch of events in SoA layout holding the first
+    //n - 1 legs, momenta[(leg * 4 + component) * stride + event]
+    void amplitude (const real_t* momenta, const unsigned int& batchSize,
+                    const unsigned int& stride, complex_t* results);
+
+    //Getters
+    unsigned int numberOfLegs () const;
+    //Compiled (subset, flavour) currents and flavour splittings
+    unsigned int numberOfCurrents () const;
+    unsigned int numberOfTerms () const;
+
+private:
+    //Build instruction list
+    void compile (const ScalarTheory& theory);
+    //Resize workspace if batch size changed
+    void prepareWorkspace (const unsigned int& batchSize);
+
+    //Instructions in order of increasing subset size
+    std::vector <FlavourInstruction> instructions_;
+    //Slot of each subset bitmask with compiled currents, legs first
+    std::vector <unsigned int> slotOfSubset_;
+    std::vector <unsigned int> subsetsWithCurrents_;
+    //Slots of the two subsets of one splitting of every slot
+    std::vector <unsigned int> slotSplittings_;
+    unsigned int numberOfSlots_;
+    unsigned int numberOfCurrents_;
+    unsigned int numberOfTerms_;
+    unsigned int rootRow_;
+
+    //Workspace with events innermost: momenta and invariants of the
+    //subsets with currents and one real row per current, the flavour
+    //vector of a subset contiguous
+    PlacedVector <real_t> momentumWorkspace_;
+    PlacedVector <real_t> invariantWorkspace_;
+    PlacedVector <real_t> currentWorkspace_;
+    std::vector <real_t> momentumBuffer_;
+    unsigned int workspaceBatchSize_;
+
+    //Parameters
+    const std::vector <unsigned int> flavours_;
+    const unsigned int numberOfLegs_;
+    const unsigned int numberOfSpecies_;
+
+};
+
+#endif
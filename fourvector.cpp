@@ -3,11 +3,14 @@
     between real and complex types.
 */
 #include <array>
+#include <cmath>
 #include <complex>
 #include <iostream>
+#include <vector>
 
 #include "definitions.h"
 #include "fourvector.h"
+#include "kerneldispatch.h"
 
 //---NON-MEMBER DEFINITIONS AND OPERATOR OVERLOADS---
 
@@ -150,3 +153,120 @@ complex_t spatialProduct (const FourVector <complex_t>& fourvector1,
 
     return sum;
 }
+
+//Lorentz boost with velocity beta
+FourVector <real_t> boost (const FourVector <real_t>& fourvector,
+                           const std::array <real_t, 3>& beta)
+{
+    real_t betaSquared = beta[0] * beta[0] + beta[1] * beta[1]
+                       + beta[2] * beta[2];
+    real_t gamma = 1 / sqrt (1 - betaSquared);
+    real_t product = beta[0] * fourvector(1) + beta[1] * fourvector(2)
+                   + beta[2] * fourvector(3);
+
+    //(gamma - 1) / beta^2 = gamma^2 / (gamma + 1), regular at rest
+    real_t factor = gamma * gamma / (gamma + 1) * product
+                  + gamma * fourvector(0);
+
+    return FourVector <real_t> (gamma * (fourvector(0) + product),
+                                fourvector(1) + factor * beta[0],
+                                fourvector(2) + factor * beta[1],
+                                fourvector(3) + factor * beta[2]);
+}
+
+//Boost into the rest frame of 'frame'
+FourVector <real_t> boostToRestFrame (const FourVector <real_t>& fourvector,
+                                      const FourVector <real_t>& frame)
+{
+    std::array <real_t, 3> beta = {{- frame(1) / frame(0),
+                                    - frame(2) / frame(0),
+                                    - frame(3) / frame(0)}};
+    return boost (fourvector, beta);
+}
+
+//Boost out of the rest frame of 'frame'
+FourVector <real_t> boostFromRestFrame (const FourVector <real_t>& fourvector,
+                                        const FourVector <real_t>& frame)
+{
+    std::array <real_t, 3> beta = {{frame(1) / frame(0),
+                                    frame(2) / frame(0),
+                                    frame(3) / frame(0)}};
+    return boost (fourvector, beta);
+}
+
+//Row-major rotation matrix about 'axis' by 'angle' (Rodrigues)
+std::array <real_t, 9> rotationMatrix (const std::array <real_t, 3>& axis,
+                                       const real_t& angle)
+{
+    real_t norm = sqrt (axis[0] * axis[0] + axis[1] * axis[1]
+                        + axis[2] * axis[2]);
+    real_t x = axis[0] / norm, y = axis[1] / norm, z = axis[2] / norm;
+    real_t c = cos (angle), s = sin (angle), t = 1 - c;
+
+    return {{t * x * x + c,     t * x * y - s * z, t * x * z + s * y,
+             t * x * y + s * z, t * y * y + c,     t * y * z - s * x,
+             t * x * z - s * y, t * y * z + s * x, t * z * z + c}};
+}
+
+//Rotation of the spatial part with a row-major matrix
+FourVector <real_t> rotate (const FourVector <real_t>& fourvector,
+                            const std::array <real_t, 9>& rotation)
+{
+    FourVector <real_t> rotated (fourvector(0), 0, 0, 0);
+
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        rotated.setComponent(i + 1, rotation[3 * i] * fourvector(1)
+                                     + rotation[3 * i + 1] * fourvector(2)
+                                     + rotation[3 * i + 2] * fourvector(3));
+    }
+
+    return rotated;
+}
+
+//Rotation of the spatial part about 'axis' by 'angle'
+FourVector <real_t> rotate (const FourVector <real_t>& fourvector,
+                            const std::array <real_t, 3>& axis,
+                            const real_t& angle)
+{
+    return rotate (fourvector, rotationMatrix (axis, angle));
+}
+
+//Batched boosts, dispatched to the widest supported kernel
+void boostBatch (real_t* e, real_t* x, real_t* y, real_t* z,
+                 const real_t* frameE, const real_t* frameX,
+                 const real_t* frameY, const real_t* frameZ,
+                 const real_t& direction, const unsigned int& size)
+{
+    boostKernel () (e, x, y, z, frameE, frameX, frameY, frameZ, direction,
+                    size);
+}
+
+//Batched rotation, dispatched to the widest supported kernel
+void rotateBatch (real_t* x, real_t* y, real_t* z,
+                  const std::array <real_t, 9>& rotation,
+                  const unsigned int& size)
+{
+    rotateKernel () (x, y, z, rotation.data (), size);
+}
+
+//Matrix of invariants s_ij = (p_i + p_j)^2 with s_ii = p_i^2
+std::vector <std::vector <real_t>> invariantMatrix
+    (const std::vector <FourVector <real_t>>& momenta)
+{
+    unsigned int n = momenta.size ();
+    std::vector <std::vector <real_t>> invariants
+        (n, std::vector <real_t> (n, 0));
+
+    for (unsigned int i = 0; i < n; i++)
+    {
+        for (unsigned int j = i; j < n; j++)
+        {
+            invariants[i][j] = (i == j) ? momenta[i].square ()
+                             : (momenta[i] + momenta[j]).square ();
+            invariants[j][i] = invariants[i][j];
+        }
+    }
+
+    return invariants;
+}
@@ -375,6 +375,48 @@ complex_t spatialProduct (const FourVector <complex_t>& fourvector1,
 complex_t spatialProduct (const FourVector <complex_t>& fourvector1,
                           const FourVector <complex_t>& fourvector2);
 
+//Lorentz boost with velocity beta: a vector at rest ends up moving
+//with velocity beta
+FourVector <real_t> boost (const FourVector <real_t>& fourvector,
+                           const std::array <real_t, 3>& beta);
+
+//Boost into the rest frame of 'frame'
+FourVector <real_t> boostToRestFrame (const FourVector <real_t>& fourvector,
+                                      const FourVector <real_t>& frame);
+
+//Boost out of the rest frame of 'frame'
+FourVector <real_t> boostFromRestFrame (const FourVector <real_t>& fourvector,
+                                        const FourVector <real_t>& frame);
+
+//Row-major rotation matrix about 'axis' by 'angle'
+std::array <real_t, 9> rotationMatrix (const std::array <real_t, 3>& axis,
+                                       const real_t& angle);
+
+//Rotation of the spatial part with a row-major matrix
+FourVector <real_t> rotate (const FourVector <real_t>& fourvector,
+                            const std::array <real_t, 9>& rotation);
+
+//Rotation of the spatial part about 'axis' by 'angle'
+FourVector <real_t> rotate (const FourVector <real_t>& fourvector,
+                            const std::array <real_t, 3>& axis,
+                            const real_t& angle);
+
+//Batched boosts of SoA components in place, each event into (direction
+//-1) or out of (direction +1) the rest frame of its own frame momentum
+void boostBatch (real_t* e, real_t* x, real_t* y, real_t* z,
+                 const real_t* frameE, const real_t* frameX,
+                 const real_t* frameY, const real_t* frameZ,
+                 const real_t& direction, const unsigned int& size);
+
+//Batched rotation of SoA spatial components in place
+void rotateBatch (real_t* x, real_t* y, real_t* z,
+                  const std::array <real_t, 9>& rotation,
+                  const unsigned int& size);
+
+//Matrix of invariants s_ij = (p_i + p_j)^2 with s_ii = p_i^2
+std::vector <std::vector <real_t>> invariantMatrix
+    (const std::vector <FourVector <real_t>>& momenta);
+
 //Sum of all fourvectors in a list
 template <class T>
 FourVector <T> sum (const std::vector <FourVector <T>>& momenta)
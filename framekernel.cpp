@@ -0,0 +1,69 @@
+/*
+    Numeric kernels for Lorentz boosts and rotations of SoA momenta. This
+    file is compiled once per instruction set, with BOOST_KERNEL and
+    ROTATE_KERNEL naming the variant and the matching -m flags given in
+    the makefile. It must not define or odr-use inline functions shared
+    with other translation units.
+*/
+#include <cmath>
+#include <complex>
+
+#include "definitions.h"
+#include "evaluationtape.h"
+#include "kerneldispatch.h"
+
+#ifndef BOOST_KERNEL
+#define BOOST_KERNEL boostBatchSse2
+#endif
+
+#ifndef ROTATE_KERNEL
+#define ROTATE_KERNEL rotateBatchSse2
+#endif
+
+//Boost every event with velocity direction * (fx, fy, fz) / fe
+void BOOST_KERNEL (real_t* e, real_t* x, real_t* y, real_t* z,
+                   const real_t* fe, const real_t* fx, const real_t* fy,
+                   const real_t* fz, const real_t& direction,
+                   const unsigned int& size)
+{
+    const real_t sign = direction;
+    const unsigned int n = size;
+
+    for (unsigned int i = 0; i < n; i++)
+    {
+        real_t inverseEnergy = sign / fe[i];
+        real_t bx = fx[i] * inverseEnergy;
+        real_t by = fy[i] * inverseEnergy;
+        real_t bz = fz[i] * inverseEnergy;
+
+        //(gamma - 1) / beta^2 = gamma^2 / (gamma + 1), regular at rest
+        real_t gamma = 1 / sqrt (1 - bx * bx - by * by - bz * bz);
+        real_t product = bx * x[i] + by * y[i] + bz * z[i];
+        real_t factor = gamma * gamma / (gamma + 1) * product
+                      + gamma * e[i];
+
+        e[i] = gamma * (e[i] + product);
+        x[i] += factor * bx;
+        y[i] += factor * by;
+        z[i] += factor * bz;
+    }
+}
+
+//Rotate the spatial part of every event with a row-major 3x3 matrix
+void ROTATE_KERNEL (real_t* x, real_t* y, real_t* z, const real_t* rotation,
+                    const unsigned int& size)
+{
+    const real_t r00 = rotation[0], r01 = rotation[1], r02 = rotation[2];
+    const real_t r10 = rotation[3], r11 = rotation[4], r12 = rotation[5];
+    const real_t r20 = rotation[6], r21 = rotation[7], r22 = rotation[8];
+    const unsigned int n = size;
+
+    for (unsigned int i = 0; i < n; i++)
+    {
+        real_t xi = x[i], yi = y[i], zi = z[i];
+
+        x[i] = r00 * xi + r01 * yi + r02 * zi;
+        y[i] = r10 * xi + r11 * yi + r12 * zi;
+        z[i] = r20 * xi + r21 * yi + r22 * zi;
+    }
+}
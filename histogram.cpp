@@ -0,0 +1,546 @@
+/*
+    Weighted histograms of observables. Each thread fills its own copy of
+    every histogram, the copies are merged in thread order at the end.
+    Histograms are stored in a binary format that can be merged across
+    processes.
+*/
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "definitions.h"
+#include "histogram.h"
+#include "pipeline.h"
+
+namespace
+{
+    //File identifiers and format version
+    const uint32_t HISTOGRAM_MAGIC = 0x4844344e;
+    const uint32_t FORMAT_VERSION = 1;
+
+    //Values binned per pass of a batched fill
+    const unsigned int FILL_CHUNK = 256;
+
+    //Largest binning and name length accepted from a file
+    const uint32_t MAXIMUM_BINS = 1 << 24;
+    const uint32_t MAXIMUM_NAME_LENGTH = 1 << 16;
+
+    template <class T>
+    void writeValue (std::ostream& out, const T& value)
+    {
+        out.write (reinterpret_cast <const char*> (&value), sizeof (T));
+    }
+
+    template <class T>
+    void readValue (std::istream& in, T& value)
+    {
+        in.read (reinterpret_cast <char*> (&value), sizeof (T));
+    }
+}
+
+//---HISTOGRAM---
+
+//Constructor: default
+Histogram::Histogram ()
+    : lower_ (0), upper_ (0), inverseWidth_ (0), numberOfBins_ (0),
+      uniform_ (true), sums_ (2, 0), squares_ (2, 0), entries_ (0) {}
+
+//Constructor: uniform bins
+Histogram::Histogram (const unsigned int& numberOfBins, const real_t& lower,
+                      const real_t& upper)
+    : lower_ (lower), upper_ (upper), inverseWidth_ (0),
+      numberOfBins_ (numberOfBins), uniform_ (true),
+      sums_ (numberOfBins + 2, 0), squares_ (numberOfBins + 2, 0),
+      entries_ (0)
+{
+    //An empty range fills the overflow only
+    if (!(upper > lower))
+    {
+        std::cout << "Error: histogram range is empty\n";
+        return;
+    }
+
+    inverseWidth_ = numberOfBins / (upper - lower);
+}
+
+//Constructor: bins given by edges
+Histogram::Histogram (const std::vector <real_t>& edges)
+    : lower_ (0), upper_ (0), inverseWidth_ (0), numberOfBins_ (0),
+      uniform_ (false), sums_ (2, 0), squares_ (2, 0), entries_ (0)
+{
+    //Without a bin everything is underflow
+    if (edges.size () < 2 || !(edges.back () > edges.front ()))
+    {
+        std::cout << "Error: histogram needs at least two increasing "
+            << "edges\n";
+        return;
+    }
+    if (!std::is_sorted (edges.begin (), edges.end ()))
+    {
+        std::cout << "Error: histogram edges are not increasing\n";
+    }
+
+    edges_ = edges;
+    lower_ = edges.front ();
+    upper_ = edges.back ();
+    numberOfBins_ = edges.size () - 1;
+    sums_.assign (edges.size () + 1, 0);
+    squares_.assign (edges.size () + 1, 0);
+}
+
+//Bin of a value for non-uniform binning
+unsigned int Histogram::findBin (const real_t& value) const
+{
+    if (!(value >= lower_))
+    {
+        return 0;
+    }
+
+    return std::upper_bound (edges_.begin (), edges_.end (), value)
+         - edges_.begin ();
+}
+
+//Fill single value
+void Histogram::fill (const real_t& value, const real_t& weight)
+{
+    fill (&value, &weight, 1);
+}
+
+//Fill a batch of values: bin indices are computed in a branch-free
+//pass for uniform binning, then the weights are scattered
+void Histogram::fill (const real_t* values, const real_t* weights,
+                      const unsigned int& size)
+{
+    binBuffer_.resize (FILL_CHUNK);
+    unsigned int* bins = binBuffer_.data ();
+    const real_t overflow = numberOfBins_ + 1;
+
+    for (unsigned int start = 0; start < size; start += FILL_CHUNK)
+    {
+        unsigned int chunk = std::min (FILL_CHUNK, size - start);
+        const real_t* x = values + start;
+        const real_t* w = weights + start;
+
+        if (uniform_)
+        {
+            for (unsigned int i = 0; i < chunk; i++)
+            {
+                //NaN fails the first comparison and lands in underflow
+                real_t position = (x[i] - lower_) * inverseWidth_ + 1;
+                position = (position >= 1) ? position : 0;
+                position = (position < overflow) ? position : overflow;
+                bins[i] = (unsigned int) position;
+            }
+        }
+        else
+        {
+            for (unsigned int i = 0; i < chunk; i++)
+            {
+                bins[i] = findBin (x[i]);
+            }
+        }
+
+        for (unsigned int i = 0; i < chunk; i++)
+        {
+            sums_[bins[i]] += w[i];
+            squares_[bins[i]] += w[i] * w[i];
+        }
+    }
+
+    entries_ += size;
+}
+
+//Add contents of a histogram with the same binning
+bool Histogram::add (const Histogram& histogram)
+{
+    if (histogram.numberOfBins_ != numberOfBins_
+        || histogram.uniform_ != uniform_
+        || histogram.lower_ != lower_ || histogram.upper_ != upper_
+        || histogram.edges_ != edges_)
+    {
+        std::cout << "Error: cannot add histograms with different binning\n";
+        return false;
+    }
+
+    for (unsigned int i = 0; i < sums_.size (); i++)
+    {
+        sums_[i] += histogram.sums_[i];
+        squares_[i] += histogram.squares_[i];
+    }
+    entries_ += histogram.entries_;
+
+    return true;
+}
+
+//Reset contents
+void Histogram::clear ()
+{
+    std::fill (sums_.begin (), sums_.end (), 0);
+    std::fill (squares_.begin (), squares_.end (), 0);
+    entries_ = 0;
+}
+
+//Getters
+unsigned int Histogram::numberOfBins () const
+{
+    return numberOfBins_;
+}
+
+bool Histogram::uniform () const
+{
+    return uniform_;
+}
+
+std::vector <real_t> Histogram::edges () const
+{
+    if (!uniform_)
+    {
+        return edges_;
+    }
+
+    std::vector <real_t> edges (numberOfBins_ + 1);
+    for (unsigned int i = 0; i <= numberOfBins_; i++)
+    {
+        edges[i] = lower_ + i * (upper_ - lower_) / numberOfBins_;
+    }
+    return edges;
+}
+
+real_t Histogram::sum (const unsigned int& bin) const
+{
+    return sums_.at (bin);
+}
+
+real_t Histogram::sumOfSquares (const unsigned int& bin) const
+{
+    return squares_.at (bin);
+}
+
+unsigned long long Histogram::entries () const
+{
+    return entries_;
+}
+
+//Write binning and contents
+void Histogram::write (std::ostream& out) const
+{
+    writeValue (out, (uint32_t) numberOfBins_);
+    writeValue (out, (uint8_t) uniform_);
+    writeValue (out, lower_);
+    writeValue (out, upper_);
+    if (!uniform_)
+    {
+        out.write (reinterpret_cast <const char*> (edges_.data ()),
+                   edges_.size () * sizeof (real_t));
+    }
+    writeValue (out, (uint64_t) entries_);
+    out.write (reinterpret_cast <const char*> (sums_.data ()),
+               sums_.size () * sizeof (real_t));
+    out.write (reinterpret_cast <const char*> (squares_.data ()),
+               squares_.size () * sizeof (real_t));
+}
+
+//Read binning and contents
+bool Histogram::read (std::istream& in)
+{
+    uint32_t numberOfBins = 0;
+    uint8_t uniform = 1;
+    uint64_t entries = 0;
+    real_t lower = 0, upper = 0;
+
+    readValue (in, numberOfBins);
+    readValue (in, uniform);
+    readValue (in, lower);
+    readValue (in, upper);
+    if (!in)
+    {
+        return false;
+    }
+
+    //Checked before anything is allocated
+    if (numberOfBins == 0 || numberOfBins > MAXIMUM_BINS || !(upper > lower))
+    {
+        std::cout << "Error: invalid binning of " << numberOfBins
+            << " bins on [" << lower << ", " << upper << "]\n";
+        return false;
+    }
+
+    if (uniform)
+    {
+        *this = Histogram (numberOfBins, lower, upper);
+    }
+    else
+    {
+        std::vector <real_t> edges (numberOfBins + 1);
+        in.read (reinterpret_cast <char*> (edges.data ()),
+                 edges.size () * sizeof (real_t));
+        if (!in || edges.front () != lower || edges.back () != upper
+            || !std::is_sorted (edges.begin (), edges.end ()))
+        {
+            std::cout << "Error: invalid histogram edges\n";
+            return false;
+        }
+        *this = Histogram (edges);
+    }
+
+    readValue (in, entries);
+    in.read (reinterpret_cast <char*> (sums_.data ()),
+             sums_.size () * sizeof (real_t));
+    in.read (reinterpret_cast <char*> (squares_.data ()),
+             squares_.size () * sizeof (real_t));
+    entries_ = entries;
+
+    return (bool) in;
+}
+
+//---HISTOGRAM COLLECTION---
+
+//Constructor
+HistogramCollection::HistogramCollection (const unsigned int& numberOfThreads)
+    : histograms_ (std::max (numberOfThreads, 1u)) {}
+
+//Book a histogram for all threads
+unsigned int HistogramCollection::book (const std::string& name,
+                                        const Histogram& histogram)
+{
+    names_.push_back (name);
+    for (auto& thread : histograms_)
+    {
+        thread.push_back (histogram);
+        thread.back ().clear ();
+    }
+
+    return names_.size () - 1;
+}
+
+//Copy of a thread
+Histogram& HistogramCollection::local (const unsigned int& thread,
+                                       const unsigned int& id)
+{
+    return histograms_[thread][id];
+}
+
+//Sum of all thread copies in thread order
+Histogram HistogramCollection::merged (const unsigned int& id) const
+{
+    Histogram result = histograms_[0].at (id);
+    for (unsigned int thread = 1; thread < histograms_.size (); thread++)
+    {
+        result.add (histograms_[thread][id]);
+    }
+
+    return result;
+}
+
+//Merge all thread copies into thread 0
+void HistogramCollection::mergeThreads ()
+{
+    for (unsigned int id = 0; id < names_.size (); id++)
+    {
+        for (unsigned int thread = 1; thread < histograms_.size (); thread++)
+        {
+            histograms_[0][id].add (histograms_[thread][id]);
+            histograms_[thread][id].clear ();
+        }
+    }
+}
+
+//Getters
+unsigned int HistogramCollection::numberOfHistograms () const
+{
+    return names_.size ();
+}
+
+unsigned int HistogramCollection::numberOfThreads () const
+{
+    return histograms_.size ();
+}
+
+const std::string& HistogramCollection::name (const unsigned int& id) const
+{
+    return names_.at (id);
+}
+
+//Write merged histograms
+bool HistogramCollection::write (const std::string& fileName) const
+{
+    std::ofstream out (fileName, std::ios::binary);
+    if (!out)
+    {
+        std::cout << "Error: cannot write histogram file " << fileName << "\n";
+        return false;
+    }
+
+    writeValue (out, HISTOGRAM_MAGIC);
+    writeValue (out, FORMAT_VERSION);
+    writeValue (out, (uint32_t) names_.size ());
+
+    for (unsigned int id = 0; id < names_.size (); id++)
+    {
+        writeValue (out, (uint32_t) names_[id].size ());
+        out.write (names_[id].data (), names_[id].size ());
+        merged (id).write (out);
+    }
+
+    return (bool) out;
+}
+
+//Read histograms, replacing the booked ones
+bool HistogramCollection::read (const std::string& fileName)
+{
+    std::ifstream in (fileName, std::ios::binary);
+    uint32_t magic = 0, version = 0, numberOfHistograms = 0;
+    readValue (in, magic);
+    readValue (in, version);
+    readValue (in, numberOfHistograms);
+
+    if (!in || magic != HISTOGRAM_MAGIC || version != FORMAT_VERSION)
+    {
+        std::cout << "Error: " << fileName
+            << " is not a valid histogram file\n";
+        return false;
+    }
+
+    std::vector <std::string> names;
+    std::vector <Histogram> histograms;
+    for (unsigned int id = 0; id < numberOfHistograms; id++)
+    {
+        uint32_t length = 0;
+        readValue (in, length);
+        if (length > MAXIMUM_NAME_LENGTH)
+        {
+            std::cout << "Error: histogram file " << fileName
+                << " is corrupted\n";
+            return false;
+        }
+        std::string name (length, ' ');
+        in.read (&name[0], length);
+
+        Histogram histogram;
+        if (!in || !histogram.read (in))
+        {
+            std::cout << "Error: histogram file " << fileName
+                << " is truncated or invalid\n";
+            return false;
+        }
+
+        names.push_back (name);
+        histograms.push_back (histogram);
+    }
+
+    names_ = names;
+    histograms_.assign (histograms_.size (), histograms);
+    for (unsigned int thread = 1; thread < histograms_.size (); thread++)
+    {
+        for (auto& histogram : histograms_[thread])
+        {
+            histogram.clear ();
+        }
+    }
+
+    return true;
+}
+
+//Add histograms of a file written by another process
+bool HistogramCollection::addFile (const std::string& fileName)
+{
+    HistogramCollection other;
+    if (!other.read (fileName))
+    {
+        return false;
+    }
+
+    if (other.names_ != names_)
+    {
+        std::cout << "Error: histograms in " << fileName
+            << " do not match the booked ones\n";
+        return false;
+    }
+
+    bool success = true;
+    for (unsigned int id = 0; id < names_.size (); id++)
+    {
+        success = histograms_[0][id].add (other.histograms_[0][id])
+               && success;
+    }
+
+    return success;
+}
+
+//---BATCHED OBSERVABLES---
+
+//Invariant mass of the legs in a subset
+void blockInvariantMass (EventBlock& block, const unsigned int& subset,
+                         real_t* values)
+{
+    real_t component[FILL_CHUNK];
+
+    for (unsigned int start = 0; start < block.size_; start += FILL_CHUNK)
+    {
+        unsigned int chunk = std::min (FILL_CHUNK, block.size_ - start);
+        real_t* square = values + start;
+        std::fill (square, square + chunk, 0);
+
+        //Sum each component over the subset, then add its square
+        for (unsigned int j = 0; j < 4; j++)
+        {
+            const real_t sign = (j == 0) ? 1 : -1;
+            std::fill (component, component + chunk, 0);
+
+            for (unsigned int leg = 0; leg < block.numberOfLegs_; leg++)
+            {
+                if (subset & (1u << leg))
+                {
+                    const real_t* p = block.momentum (leg, j) + start;
+                    for (unsigned int i = 0; i < chunk; i++)
+                    {
+                        component[i] += p[i];
+                    }
+                }
+            }
+
+            for (unsigned int i = 0; i < chunk; i++)
+            {
+                square[i] += sign * component[i] * component[i];
+            }
+        }
+
+        for (unsigned int i = 0; i < chunk; i++)
+        {
+            square[i] = sqrt (std::max (square[i], (real_t) 0));
+        }
+    }
+}
+
+//Energy of a leg
+void blockEnergy (EventBlock& block, const unsigned int& leg,
+                  real_t* values)
+{
+    const real_t* energy = block.momentum (leg, 0);
+    std::copy (energy, energy + block.size_, values);
+}
+
+//Cosine of the angle between the spatial momenta of two legs
+void blockCosAngle (EventBlock& block, const unsigned int& leg1,
+                    const unsigned int& leg2, real_t* values)
+{
+    const real_t* x1 = block.momentum (leg1, 1);
+    const real_t* y1 = block.momentum (leg1, 2);
+    const real_t* z1 = block.momentum (leg1, 3);
+    const real_t* x2 = block.momentum (leg2, 1);
+    const real_t* y2 = block.momentum (leg2, 2);
+    const real_t* z2 = block.momentum (leg2, 3);
+
+    for (unsigned int i = 0; i < block.size_; i++)
+    {
+        real_t product = x1[i] * x2[i] + y1[i] * y2[i] + z1[i] * z2[i];
+        real_t norm1 = x1[i] * x1[i] + y1[i] * y1[i] + z1[i] * z1[i];
+        real_t norm2 = x2[i] * x2[i] + y2[i] * y2[i] + z2[i] * z2[i];
+        values[i] = product / sqrt (norm1 * norm2);
+    }
+}
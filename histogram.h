@@ -0,0 +1,126 @@
+/*
+    Weighted histograms of observables. Each thread fills its own copy of
+    every histogram, the copies are merged in thread order at the end.
+    Histograms are stored in a binary format that can be merged across
+    processes.
+*/
+
+#ifndef HISTOGRAM
+#define HISTOGRAM
+
+#include <complex>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "definitions.h"
+#include "pipeline.h"
+
+//Histogram of weights and squared weights, bin 0 is the underflow and
+//bin numberOfBins + 1 the overflow
+class Histogram
+{
+public:
+    //Constructor: default
+    Histogram ();
+    //Constructor: uniform bins
+    Histogram (const unsigned int& numberOfBins, const real_t& lower,
+               const real_t& upper);
+    //Constructor: bins given by increasing edges
+    Histogram (const std::vector <real_t>& edges);
+
+    //Fill single value
+    void fill (const real_t& value, const real_t& weight);
+    //Fill a batch of values
+    void fill (const real_t* values, const real_t* weights,
+               const unsigned int& size);
+
+    //Add contents of a histogram with the same binning
+    bool add (const Histogram& histogram);
+    //Reset contents
+    void clear ();
+
+    //Getters
+    unsigned int numberOfBins () const;
+    bool uniform () const;
+    //Edges of the regular bins, numberOfBins + 1 entries
+    std::vector <real_t> edges () const;
+    //Contents, 1 <= bin <= numberOfBins for regular bins
+    real_t sum (const unsigned int& bin) const;
+    real_t sumOfSquares (const unsigned int& bin) const;
+    unsigned long long entries () const;
+
+    //Binary I/O
+    void write (std::ostream& out) const;
+    bool read (std::istream& in);
+
+private:
+    //Bin of a value for non-uniform binning
+    unsigned int findBin (const real_t& value) const;
+
+    //Binning
+    std::vector <real_t> edges_;
+    real_t lower_;
+    real_t upper_;
+    real_t inverseWidth_;
+    unsigned int numberOfBins_;
+    bool uniform_;
+
+    //Contents, including under- and overflow
+    std::vector <real_t> sums_;
+    std::vector <real_t> squares_;
+    unsigned long long entries_;
+
+    //Bin index buffer of batched fills
+    std::vector <unsigned int> binBuffer_;
+
+};
+
+//Named histograms with one copy per thread
+class HistogramCollection
+{
+public:
+    //Constructor
+    HistogramCollection (const unsigned int& numberOfThreads = 1);
+
+    //Book a histogram for all threads, returns its identifier
+    unsigned int book (const std::string& name, const Histogram& histogram);
+
+    //Copy of a thread, to be filled by that thread only
+    Histogram& local (const unsigned int& thread, const unsigned int& id);
+
+    //Sum of all thread copies, added in thread order
+    Histogram merged (const unsigned int& id) const;
+    //Merge all thread copies into thread 0 and clear the others
+    void mergeThreads ();
+
+    //Getters
+    unsigned int numberOfHistograms () const;
+    unsigned int numberOfThreads () const;
+    const std::string& name (const unsigned int& id) const;
+
+    //Binary I/O of the merged histograms
+    bool write (const std::string& fileName) const;
+    bool read (const std::string& fileName);
+    //Add histograms of a file written by another process
+    bool addFile (const std::string& fileName);
+
+private:
+    std::vector <std::string> names_;
+    //histograms_[thread][id]
+    std::vector <std::vector <Histogram>> histograms_;
+
+};
+
+//Batched observables of an event block, one value per event
+//Invariant mass of the legs in 'subset' (bitmask)
+void blockInvariantMass (EventBlock& block, const unsigned int& subset,
+                         real_t* values);
+//Energy of a leg
+void blockEnergy (EventBlock& block, const unsigned int& leg,
+                  real_t* values);
+//Cosine of the angle between the spatial momenta of two legs
+void blockCosAngle (EventBlock& block, const unsigned int& leg1,
+                    const unsigned int& leg2, real_t* values);
+
+#endif
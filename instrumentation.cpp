@@ -0,0 +1,209 @@
+/*
+    Optional hot-path instrumentation of the amplitude evaluation. Each
+    thread keeps its own counters and cycle timers per recursion level
+    and per phase. Everything is compiled out unless the code is built
+    with -DNLO4D_INSTRUMENTATION (make INSTRUMENTATION=1).
+*/
+#include <complex>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+#include "definitions.h"
+#include "instrumentation.h"
+
+namespace
+{
+    //Statistics of all live threads, and the sum of finished threads
+    std::mutex registryMutex_;
+    std::vector <AmplitudeStatistics*> registry_;
+    AmplitudeStatistics retired_;
+
+    void clear (AmplitudeStatistics& statistics)
+    {
+        std::memset (&statistics, 0, sizeof (AmplitudeStatistics));
+    }
+
+    void add (AmplitudeStatistics& sum, const AmplitudeStatistics& term)
+    {
+        sum.amplitudes_ += term.amplitudes_;
+        sum.currentsComputed_ += term.currentsComputed_;
+        sum.currentsReused_ += term.currentsReused_;
+        sum.allocations_ += term.allocations_;
+
+        for (unsigned int level = 0; level < MAX_LEVELS; level++)
+        {
+            sum.levelCurrents_[level] += term.levelCurrents_[level];
+            sum.levelCycles_[level] += term.levelCycles_[level];
+        }
+        for (unsigned int phase = 0; phase < NUMBER_OF_PHASES; phase++)
+        {
+            sum.phaseCycles_[phase] += term.phaseCycles_[phase];
+            sum.phaseCalls_[phase] += term.phaseCalls_[phase];
+        }
+    }
+
+    //Per thread statistics, registered for the lifetime of the thread
+    struct ThreadStatistics
+    {
+        ThreadStatistics ()
+        {
+            clear (statistics_);
+            std::lock_guard <std::mutex> lock (registryMutex_);
+            registry_.push_back (&statistics_);
+        }
+
+        ~ThreadStatistics ()
+        {
+            std::lock_guard <std::mutex> lock (registryMutex_);
+            add (retired_, statistics_);
+            for (auto& entry : registry_)
+            {
+                if (entry == &statistics_)
+                {
+                    entry = registry_.back ();
+                    registry_.pop_back ();
+                    break;
+                }
+            }
+        }
+
+        AmplitudeStatistics statistics_;
+    };
+
+    const char* phaseName (const unsigned int& phase)
+    {
+        switch (static_cast <AmplitudePhase> (phase))
+        {
+            case AmplitudePhase::MOMENTUM_SUM:
+                return "momentum sums";
+            case AmplitudePhase::PROPAGATOR:
+                return "propagators";
+            case AmplitudePhase::SPLITTING:
+                return "splitting";
+            case AmplitudePhase::ACCUMULATION:
+                return "accumulation";
+        }
+
+        return "unknown";
+    }
+}
+
+//True if built with NLO4D_INSTRUMENTATION
+bool instrumentationEnabled ()
+{
+#ifdef NLO4D_INSTRUMENTATION
+    return true;
+#else
+    return false;
+#endif
+}
+
+//Statistics of the calling thread
+AmplitudeStatistics& threadStatistics ()
+{
+    thread_local ThreadStatistics statistics;
+    return statistics.statistics_;
+}
+
+//Record a timed section of the calling thread
+void recordPhase (const AmplitudePhase& phase,
+                  const unsigned long long& cycles)
+{
+    AmplitudeStatistics& statistics = threadStatistics ();
+    statistics.phaseCycles_[static_cast <unsigned int> (phase)] += cycles;
+    statistics.phaseCalls_[static_cast <unsigned int> (phase)]++;
+}
+
+void recordLevel (const unsigned int& level, const unsigned long long& cycles,
+                  const unsigned long long& currents)
+{
+    if (level >= MAX_LEVELS)
+    {
+        return;
+    }
+
+    AmplitudeStatistics& statistics = threadStatistics ();
+    statistics.levelCycles_[level] += cycles;
+    statistics.levelCurrents_[level] += currents;
+}
+
+//Sum over all threads, exact once the other threads are idle
+AmplitudeStatistics collectStatistics ()
+{
+    threadStatistics ();
+
+    std::lock_guard <std::mutex> lock (registryMutex_);
+
+    AmplitudeStatistics sum = retired_;
+    for (auto statistics : registry_)
+    {
+        add (sum, *statistics);
+    }
+
+    return sum;
+}
+
+//Reset the statistics of all threads, the other threads must be idle
+void resetStatistics ()
+{
+    threadStatistics ();
+
+    std::lock_guard <std::mutex> lock (registryMutex_);
+
+    clear (retired_);
+    for (auto statistics : registry_)
+    {
+        clear (*statistics);
+    }
+}
+
+//Print a summary
+void printStatistics (std::ostream& out,
+                      const AmplitudeStatistics& statistics)
+{
+    if (!instrumentationEnabled ())
+    {
+        out << "Instrumentation disabled, build with make INSTRUMENTATION=1\n";
+        return;
+    }
+
+    real_t perAmplitude = (statistics.amplitudes_ > 0)
+                        ? 1. / statistics.amplitudes_ : 0;
+
+    out << "Amplitudes: " << statistics.amplitudes_
+        << ", currents computed: " << statistics.currentsComputed_
+        << ", reused: " << statistics.currentsReused_
+        << ", allocations: " << statistics.allocations_ << "\n";
+
+    for (unsigned int level = 1; level < MAX_LEVELS; level++)
+    {
+        if (statistics.levelCurrents_[level] == 0)
+        {
+            continue;
+        }
+        out << "  level " << level << ": "
+            << statistics.levelCurrents_[level] * perAmplitude
+            << " currents";
+        //Only the tape times its levels, the recursion counts currents
+        if (statistics.levelCycles_[level] > 0)
+        {
+            out << ", " << statistics.levelCycles_[level] * perAmplitude
+                << " cycles";
+        }
+        out << " per amplitude\n";
+    }
+
+    for (unsigned int phase = 0; phase < NUMBER_OF_PHASES; phase++)
+    {
+        if (statistics.phaseCalls_[phase] == 0)
+        {
+            continue;
+        }
+        out << "  " << phaseName (phase) << ": "
+            << statistics.phaseCycles_[phase] * perAmplitude
+            << " cycles per amplitude in "
+            << statistics.phaseCalls_[phase] << " sections\n";
+    }
+}
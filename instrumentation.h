@@ -0,0 +1,91 @@
+/*
+    Optional hot-path instrumentation of the amplitude evaluation. Each
+    thread keeps its own counters and cycle timers per recursion level
+    and per phase. Everything is compiled out unless the code is built
+    with -DNLO4D_INSTRUMENTATION (make INSTRUMENTATION=1).
+*/
+
+#ifndef INSTRUMENTATION
+#define INSTRUMENTATION
+
+#include <iostream>
+
+//Phases of the current evaluation
+enum class AmplitudePhase : unsigned char
+{
+    //Subset momenta and invariants
+    MOMENTUM_SUM,
+    //Vertex times propagator
+    PROPAGATOR,
+    //Enumeration of the splittings of a subset (recursion only)
+    SPLITTING,
+    //Products of subcurrents summed into a current
+    ACCUMULATION
+};
+
+const unsigned int NUMBER_OF_PHASES = 4;
+//Recursion levels are subset sizes, 1 <= level < MAX_LEVELS
+const unsigned int MAX_LEVELS = 32;
+
+struct AmplitudeStatistics
+{
+    //Amplitude evaluations, events for batches
+    unsigned long long amplitudes_;
+    //Currents computed and served from the current storage
+    unsigned long long currentsComputed_;
+    unsigned long long currentsReused_;
+    //Heap allocations on the evaluation path
+    unsigned long long allocations_;
+
+    //Per level: currents computed and cycles spent (tape only)
+    unsigned long long levelCurrents_[MAX_LEVELS];
+    unsigned long long levelCycles_[MAX_LEVELS];
+
+    //Per phase: cycles spent and number of timed sections
+    unsigned long long phaseCycles_[NUMBER_OF_PHASES];
+    unsigned long long phaseCalls_[NUMBER_OF_PHASES];
+};
+
+//True if built with NLO4D_INSTRUMENTATION
+bool instrumentationEnabled ();
+
+//Statistics of the calling thread
+AmplitudeStatistics& threadStatistics ();
+//Record a timed section of the calling thread
+void recordPhase (const AmplitudePhase& phase,
+                  const unsigned long long& cycles);
+void recordLevel (const unsigned int& level, const unsigned long long& cycles,
+                  const unsigned long long& currents);
+
+//Sum over all threads, including threads that have finished
+AmplitudeStatistics collectStatistics ();
+//Reset the statistics of all threads
+void resetStatistics ();
+
+//Print a summary, per amplitude where it applies. Cycles of a level are
+//only printed when the level was timed
+void printStatistics (std::ostream& out,
+                      const AmplitudeStatistics& statistics);
+
+//Hot-path hooks, empty unless instrumentation is enabled
+#ifdef NLO4D_INSTRUMENTATION
+    #define NLO4D_COUNT(counter, value) \
+        (threadStatistics ().counter += (value))
+    #define NLO4D_COUNT_GROWTH(container) \
+        (threadStatistics ().allocations_ += \
+            ((container).size () == (container).capacity ()))
+    #define NLO4D_TIMER_START(timer) \
+        unsigned long long timer = __builtin_ia32_rdtsc ()
+    #define NLO4D_TIMER_PHASE(timer, phase) \
+        recordPhase ((phase), __builtin_ia32_rdtsc () - (timer))
+    #define NLO4D_TIMER_LEVEL(timer, level, currents) \
+        recordLevel ((level), __builtin_ia32_rdtsc () - (timer), (currents))
+#else
+    #define NLO4D_COUNT(counter, value)
+    #define NLO4D_COUNT_GROWTH(container)
+    #define NLO4D_TIMER_START(timer)
+    #define NLO4D_TIMER_PHASE(timer, phase)
+    #define NLO4D_TIMER_LEVEL(timer, level, currents)
+#endif
+
+#endif
@@ -0,0 +1,692 @@
+/*
+    Sharded VEGAS Monte Carlo integration over the unit hypercube.
+    An iteration is split into shards identified by index, each with its
+    own reproducible random stream, so shards can run in separate
+    processes. Partial results are written to compact binary files and
+    merged in shard order, which reproduces a single-process run exactly.
+*/
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "definitions.h"
+#include "integration.h"
+
+namespace
+{
+    //File identifiers and format version
+    const uint32_t SHARD_MAGIC = 0x5344344e;
+    const uint32_t GRID_MAGIC = 0x4744344e;
+    const uint32_t FORMAT_VERSION = 1;
+
+    //Seed of a shard stream, splitmix64 finalizer over all indices
+    uint64_t shardSeed (const uint64_t& seed, const uint64_t& iteration,
+                        const uint64_t& shardIndex)
+    {
+        uint64_t z = seed;
+        for (uint64_t value : {iteration, shardIndex})
+        {
+            z += 0x9e3779b97f4a7c15ull + value;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            z = z ^ (z >> 31);
+        }
+        return z;
+    }
+
+    //Uniform number in [0,1) from the upper 53 bits
+    real_t toUnit (const uint64_t& bits)
+    {
+        return (bits >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    //Raw binary I/O helpers
+    template <class T>
+    void writeValue (std::ostream& out, const T& value)
+    {
+        out.write (reinterpret_cast <const char*> (&value), sizeof (T));
+    }
+
+    template <class T>
+    void readValue (std::istream& in, T& value)
+    {
+        in.read (reinterpret_cast <char*> (&value), sizeof (T));
+    }
+
+    void writeArray (std::ostream& out, const std::vector <real_t>& values)
+    {
+        writeValue (out, (uint32_t) values.size ());
+        out.write (reinterpret_cast <const char*> (values.data ()),
+                   values.size () * sizeof (real_t));
+    }
+
+    //Values left in a file stream, bounds sizes read from it
+    uint64_t remainingValues (std::istream& in)
+    {
+        std::streampos position = in.tellg ();
+        in.seekg (0, std::ios::end);
+        std::streampos end = in.tellg ();
+        in.seekg (position);
+        return (position < 0 || end < position)
+               ? 0 : (uint64_t) (end - position) / sizeof (real_t);
+    }
+
+    //Fails the stream instead of allocating more than 'maximumSize'
+    void readArray (std::istream& in, std::vector <real_t>& values,
+                    const uint64_t& maximumSize)
+    {
+        uint32_t size = 0;
+        readValue (in, size);
+        if (!in)
+        {
+            return;
+        }
+        if (size > maximumSize)
+        {
+            in.setstate (std::ios::failbit);
+            return;
+        }
+        values.resize (size);
+        in.read (reinterpret_cast <char*> (values.data ()),
+                 size * sizeof (real_t));
+    }
+
+    //Elementwise addition of arrays
+    void addArray (std::vector <real_t>& target,
+                   const std::vector <real_t>& source)
+    {
+        for (unsigned int i = 0; i < target.size (); i++)
+        {
+            target[i] += source[i];
+        }
+    }
+}
+
+//---VEGAS GRID---
+
+//Constructor: default
+VegasGrid::VegasGrid ()
+    : dimension_ (0), numberOfBins_ (0) {}
+
+//Constructor: uniform grid
+VegasGrid::VegasGrid (const unsigned int& dimension,
+                      const unsigned int& numberOfBins)
+    : edges_ (dimension * (numberOfBins + 1)), dimension_ (dimension),
+      numberOfBins_ (numberOfBins)
+{
+    for (unsigned int j = 0; j < dimension_; j++)
+    {
+        for (unsigned int i = 0; i <= numberOfBins_; i++)
+        {
+            edges_[j * (numberOfBins_ + 1) + i] = (real_t) i / numberOfBins_;
+        }
+    }
+}
+
+//Map uniform random numbers to a point
+real_t VegasGrid::map (const real_t* uniform, real_t* point,
+                       unsigned int* bins) const
+{
+    real_t jacobian = 1;
+
+    for (unsigned int j = 0; j < dimension_; j++)
+    {
+        real_t position = uniform[j] * numberOfBins_;
+        unsigned int bin = std::min ((unsigned int) position,
+                                     numberOfBins_ - 1);
+        const real_t* edge = &edges_[j * (numberOfBins_ + 1) + bin];
+        real_t width = edge[1] - edge[0];
+
+        point[j] = edge[0] + (position - bin) * width;
+        bins[j] = bin;
+        jacobian *= numberOfBins_ * width;
+    }
+
+    return jacobian;
+}
+
+//Refine from squared weights accumulated per dimension and bin
+void VegasGrid::refine (const std::vector <real_t>& accumulator,
+                        const real_t& damping)
+{
+    if (accumulator.size () != dimension_ * numberOfBins_)
+    {
+        std::cout << "Error: grid accumulator does not match grid size\n";
+        return;
+    }
+
+    const unsigned int nb = numberOfBins_;
+    std::vector <real_t> smoothed (nb);
+    std::vector <real_t> importance (nb);
+    std::vector <real_t> newEdges (nb + 1);
+
+    for (unsigned int j = 0; j < dimension_; j++)
+    {
+        const real_t* d = &accumulator[j * nb];
+        real_t* edges = &edges_[j * (nb + 1)];
+
+        //Smooth with neighbours
+        real_t total = 0;
+        for (unsigned int i = 0; i < nb; i++)
+        {
+            real_t neighbours = d[i];
+            unsigned int count = 1;
+            if (i > 0)
+            {
+                neighbours += d[i - 1];
+                count++;
+            }
+            if (i + 1 < nb)
+            {
+                neighbours += d[i + 1];
+                count++;
+            }
+            smoothed[i] = neighbours / count;
+            total += smoothed[i];
+        }
+        if (total <= 0)
+        {
+            continue;
+        }
+
+        //Damped importance of each bin
+        real_t importanceTotal = 0;
+        for (unsigned int i = 0; i < nb; i++)
+        {
+            real_t x = smoothed[i] / total;
+            importance[i] = (x <= 0) ? 0
+                          : (x >= 1) ? 1
+                          : pow ((x - 1) / log (x), damping);
+            importanceTotal += importance[i];
+        }
+        if (importanceTotal <= 0)
+        {
+            continue;
+        }
+
+        //New edges with equal importance per bin
+        real_t step = importanceTotal / nb;
+        real_t accumulated = 0;
+        unsigned int bin = 0;
+        newEdges[0] = 0;
+        newEdges[nb] = 1;
+        for (unsigned int k = 1; k < nb; k++)
+        {
+            real_t target = k * step;
+            while (bin + 1 < nb && accumulated + importance[bin] < target)
+            {
+                accumulated += importance[bin];
+                bin++;
+            }
+            real_t fraction = (importance[bin] > 0)
+                            ? (target - accumulated) / importance[bin] : 0;
+            fraction = std::min (std::max (fraction, (real_t) 0), (real_t) 1);
+            newEdges[k] = edges[bin] + fraction * (edges[bin + 1] - edges[bin]);
+        }
+
+        std::copy (newEdges.begin (), newEdges.end (), edges);
+    }
+}
+
+//Getters
+unsigned int VegasGrid::dimension () const
+{
+    return dimension_;
+}
+
+unsigned int VegasGrid::numberOfBins () const
+{
+    return numberOfBins_;
+}
+
+const std::vector <real_t>& VegasGrid::edges () const
+{
+    return edges_;
+}
+
+//Write grid
+bool VegasGrid::write (const std::string& fileName) const
+{
+    std::ofstream out (fileName, std::ios::binary);
+    if (!out)
+    {
+        std::cout << "Error: cannot write grid file " << fileName << "\n";
+        return false;
+    }
+
+    writeValue (out, GRID_MAGIC);
+    writeValue (out, FORMAT_VERSION);
+    writeValue (out, (uint32_t) dimension_);
+    writeValue (out, (uint32_t) numberOfBins_);
+    writeArray (out, edges_);
+
+    return (bool) out;
+}
+
+//Read grid
+bool VegasGrid::read (const std::string& fileName)
+{
+    std::ifstream in (fileName, std::ios::binary);
+    uint32_t magic = 0, version = 0, dimension = 0, numberOfBins = 0;
+    readValue (in, magic);
+    readValue (in, version);
+
+    if (!in || magic != GRID_MAGIC || version != FORMAT_VERSION)
+    {
+        std::cout << "Error: " << fileName << " is not a valid grid file\n";
+        return false;
+    }
+
+    std::vector <real_t> edges;
+    readValue (in, dimension);
+    readValue (in, numberOfBins);
+    const uint64_t numberOfEdges = (uint64_t) dimension
+                                 * ((uint64_t) numberOfBins + 1);
+    readArray (in, edges, numberOfEdges);
+
+    if (!in || edges.size () != numberOfEdges)
+    {
+        std::cout << "Error: grid file " << fileName << " is truncated\n";
+        return false;
+    }
+
+    edges_ = edges;
+    dimension_ = dimension;
+    numberOfBins_ = numberOfBins;
+
+    return true;
+}
+
+//---SHARD RESULTS---
+
+//Write shard result
+bool writeShardResult (const std::string& fileName, const ShardResult& result)
+{
+    std::ofstream out (fileName, std::ios::binary);
+    if (!out)
+    {
+        std::cout << "Error: cannot write shard file " << fileName << "\n";
+        return false;
+    }
+
+    writeValue (out, SHARD_MAGIC);
+    writeValue (out, FORMAT_VERSION);
+    writeValue (out, (uint32_t) result.shardIndex_);
+    writeValue (out, (uint32_t) result.iteration_);
+    writeValue (out, (uint64_t) result.numberOfPoints_);
+    writeValue (out, result.sum_);
+    writeValue (out, result.sumOfSquares_);
+    writeArray (out, result.histogramSums_);
+    writeArray (out, result.histogramSquares_);
+    writeArray (out, result.gridAccumulator_);
+
+    return (bool) out;
+}
+
+//Read shard result
+bool readShardResult (const std::string& fileName, ShardResult& result)
+{
+    std::ifstream in (fileName, std::ios::binary);
+    uint32_t magic = 0, version = 0, shardIndex = 0, iteration = 0;
+    uint64_t numberOfPoints = 0;
+    readValue (in, magic);
+    readValue (in, version);
+
+    if (!in || magic != SHARD_MAGIC || version != FORMAT_VERSION)
+    {
+        std::cout << "Error: " << fileName << " is not a valid shard file\n";
+        return false;
+    }
+
+    readValue (in, shardIndex);
+    readValue (in, iteration);
+    readValue (in, numberOfPoints);
+    readValue (in, result.sum_);
+    readValue (in, result.sumOfSquares_);
+    readArray (in, result.histogramSums_, remainingValues (in));
+    readArray (in, result.histogramSquares_, remainingValues (in));
+    readArray (in, result.gridAccumulator_, remainingValues (in));
+
+    if (!in)
+    {
+        std::cout << "Error: shard file " << fileName << " is truncated\n";
+        return false;
+    }
+
+    result.shardIndex_ = shardIndex;
+    result.iteration_ = iteration;
+    result.numberOfPoints_ = numberOfPoints;
+
+    return true;
+}
+
+//Merge partial results in order of shard index
+ShardResult mergeShardResults (std::vector <ShardResult> results,
+                               unsigned int* numberOfMerged)
+{
+    ShardResult merged = {0, 0, 0, 0, 0, {}, {}, {}};
+    unsigned int accepted = 0;
+    if (numberOfMerged != nullptr)
+    {
+        *numberOfMerged = 0;
+    }
+
+    if (results.empty ())
+    {
+        return merged;
+    }
+
+    std::sort (results.begin (), results.end (),
+               [] (const ShardResult& a, const ShardResult& b)
+               { return a.shardIndex_ < b.shardIndex_; });
+
+    merged = results[0];
+    accepted = 1;
+    for (unsigned int i = 1; i < results.size (); i++)
+    {
+        const ShardResult& result = results[i];
+
+        if (result.shardIndex_ == results[i - 1].shardIndex_)
+        {
+            std::cout << "Error: shard " << result.shardIndex_
+                << " given more than once, skipped\n";
+            continue;
+        }
+        if (result.iteration_ != merged.iteration_
+            || result.histogramSums_.size () != merged.histogramSums_.size ()
+            || result.histogramSquares_.size ()
+               != merged.histogramSquares_.size ()
+            || result.gridAccumulator_.size ()
+               != merged.gridAccumulator_.size ())
+        {
+            std::cout << "Error: shard " << result.shardIndex_
+                << " does not match the other shards, skipped\n";
+            continue;
+        }
+
+        merged.numberOfPoints_ += result.numberOfPoints_;
+        merged.sum_ += result.sum_;
+        merged.sumOfSquares_ += result.sumOfSquares_;
+        addArray (merged.histogramSums_, result.histogramSums_);
+        addArray (merged.histogramSquares_, result.histogramSquares_);
+        addArray (merged.gridAccumulator_, result.gridAccumulator_);
+        accepted++;
+    }
+
+    if (numberOfMerged != nullptr)
+    {
+        *numberOfMerged = accepted;
+    }
+    return merged;
+}
+
+//---INTEGRATOR---
+
+//Constructor
+ShardedIntegrator::ShardedIntegrator
+    (const Integrand& integrand, const unsigned int& dimension,
+     const unsigned int& numberOfShards,
+     const unsigned long long& pointsPerShard,
+     const unsigned long long& seed, const unsigned int& numberOfGridBins)
+    : integrand_ (integrand), grid_ (dimension, numberOfGridBins),
+      histogramBins_ (0), histogramLower_ (0), histogramUpper_ (0),
+      weightedSum_ (0), inverseVarianceSum_ (0), dimension_ (dimension),
+      numberOfShards_ (numberOfShards), pointsPerShard_ (pointsPerShard),
+      seed_ (seed) {}
+
+//Histogram of an observable with uniform bins
+void ShardedIntegrator::setHistogram (const Integrand& observable,
+                                      const unsigned int& numberOfBins,
+                                      const real_t& lower,
+                                      const real_t& upper)
+{
+    observable_ = observable;
+    histogramBins_ = numberOfBins;
+    histogramLower_ = lower;
+    histogramUpper_ = upper;
+}
+
+//Run one shard of an iteration
+ShardResult ShardedIntegrator::runShard (const unsigned int& shardIndex,
+                                         const unsigned int& iteration) const
+{
+    ShardResult result = {shardIndex, iteration, pointsPerShard_, 0, 0,
+                          std::vector <real_t> (histogramBins_, 0),
+                          std::vector <real_t> (histogramBins_, 0),
+                          std::vector <real_t>
+                              (dimension_ * grid_.numberOfBins (), 0)};
+
+    std::mt19937_64 generator (shardSeed (seed_, iteration, shardIndex));
+
+    std::vector <real_t> uniform (dimension_);
+    std::vector <real_t> point (dimension_);
+    std::vector <unsigned int> bins (dimension_);
+    const unsigned int nb = grid_.numberOfBins ();
+    const real_t binWidth = (histogramUpper_ - histogramLower_)
+                          / std::max (histogramBins_, 1u);
+
+    for (unsigned long long k = 0; k < pointsPerShard_; k++)
+    {
+        for (unsigned int j = 0; j < dimension_; j++)
+        {
+            uniform[j] = toUnit (generator ());
+        }
+
+        real_t jacobian = grid_.map (uniform.data (), point.data (),
+                                     bins.data ());
+        real_t weight = integrand_ (point) * jacobian;
+        real_t squared = weight * weight;
+
+        result.sum_ += weight;
+        result.sumOfSquares_ += squared;
+
+        for (unsigned int j = 0; j < dimension_; j++)
+        {
+            result.gridAccumulator_[j * nb + bins[j]] += squared;
+        }
+
+        if (histogramBins_ > 0)
+        {
+            real_t value = observable_ (point);
+            if (value >= histogramLower_ && value < histogramUpper_)
+            {
+                unsigned int bin = std::min
+                    ((unsigned int) ((value - histogramLower_) / binWidth),
+                     histogramBins_ - 1);
+                result.histogramSums_[bin] += weight;
+                result.histogramSquares_[bin] += squared;
+            }
+        }
+    }
+
+    return result;
+}
+
+//Run all shards of an iteration in this process
+ShardResult ShardedIntegrator::runIteration (const unsigned int& iteration)
+    const
+{
+    std::vector <ShardResult> results;
+
+    for (unsigned int shard = 0; shard < numberOfShards_; shard++)
+    {
+        results.push_back (runShard (shard, iteration));
+    }
+
+    return mergeShardResults (results);
+}
+
+//Run all shards of an iteration in forked worker processes
+ShardResult ShardedIntegrator::runIterationForked
+    (const unsigned int& iteration, const unsigned int& numberOfWorkers,
+     const std::string& directory) const
+{
+    //Shard files of an earlier run must not be taken for this one
+    for (unsigned int shard = 0; shard < numberOfShards_; shard++)
+    {
+        std::remove (shardFileName (directory, iteration, shard).c_str ());
+    }
+
+    //Buffered output would be duplicated in the children
+    std::cout.flush ();
+
+    std::vector <pid_t> workers;
+    bool failed = false;
+
+    for (unsigned int worker = 0; worker < numberOfWorkers; worker++)
+    {
+        pid_t pid = fork ();
+
+        //Worker or fallback in this process if fork failed
+        if (pid <= 0)
+        {
+            bool success = true;
+            for (unsigned int shard = worker; shard < numberOfShards_;
+                 shard += numberOfWorkers)
+            {
+                success = writeShardResult
+                    (shardFileName (directory, iteration, shard),
+                     runShard (shard, iteration)) && success;
+            }
+
+            if (pid == 0)
+            {
+                std::cout.flush ();
+                _exit (success ? 0 : 1);
+            }
+            std::cout << "Error: fork failed, worker " << worker
+                << " ran in the parent process\n";
+            failed = failed || !success;
+        }
+        else
+        {
+            workers.push_back (pid);
+        }
+    }
+
+    for (pid_t pid : workers)
+    {
+        int status = 0;
+        if (waitpid (pid, &status, 0) != pid
+            || !WIFEXITED (status) || WEXITSTATUS (status) != 0)
+        {
+            std::cout << "Error: worker process " << pid << " failed\n";
+            failed = true;
+        }
+    }
+
+    //Collect shard files, every shard exactly once
+    std::vector <ShardResult> results;
+    for (unsigned int shard = 0; shard < numberOfShards_ && !failed; shard++)
+    {
+        ShardResult result;
+        if (!readShardResult (shardFileName (directory, iteration, shard),
+                              result)
+            || result.shardIndex_ != shard || result.iteration_ != iteration)
+        {
+            std::cout << "Error: shard " << shard << " of iteration "
+                << iteration << " is missing\n";
+            failed = true;
+        }
+        results.push_back (result);
+    }
+
+    //A partial merge would be biased, return an empty result instead
+    if (failed)
+    {
+        std::cout << "Error: iteration " << iteration << " failed\n";
+        ShardResult empty = {0, iteration, 0, 0, 0, {}, {}, {}};
+        return empty;
+    }
+
+    return mergeShardResults (results);
+}
+
+//Add a merged iteration to the estimate and refine the grid
+void ShardedIntegrator::update (const ShardResult& merged)
+{
+    if (merged.numberOfPoints_ < 2)
+    {
+        std::cout << "Error: not enough points to update the estimate\n";
+        return;
+    }
+
+    real_t n = merged.numberOfPoints_;
+    real_t mean = merged.sum_ / n;
+    real_t variance = (merged.sumOfSquares_ / n - mean * mean) / (n - 1);
+
+    //Exact estimates still need a finite weight
+    variance = std::max (variance, std::numeric_limits <real_t>::epsilon ()
+                                   * mean * mean);
+    if (variance <= 0)
+    {
+        variance = 1;
+    }
+
+    weightedSum_ += mean / variance;
+    inverseVarianceSum_ += 1 / variance;
+
+    histogram_ = merged.histogramSums_;
+    for (auto& bin : histogram_)
+    {
+        bin /= n;
+    }
+
+    grid_.refine (merged.gridAccumulator_);
+}
+
+//Estimates combined over iterations
+real_t ShardedIntegrator::integral () const
+{
+    return (inverseVarianceSum_ > 0) ? weightedSum_ / inverseVarianceSum_ : 0;
+}
+
+real_t ShardedIntegrator::error () const
+{
+    return (inverseVarianceSum_ > 0) ? 1 / sqrt (inverseVarianceSum_) : 0;
+}
+
+//Histogram of the last iteration
+std::vector <real_t> ShardedIntegrator::histogram () const
+{
+    return histogram_;
+}
+
+//Grid
+const VegasGrid& ShardedIntegrator::grid () const
+{
+    return grid_;
+}
+
+void ShardedIntegrator::setGrid (const VegasGrid& grid)
+{
+    if (grid.dimension () != dimension_)
+    {
+        std::cout << "Error: grid dimension does not match integrand\n";
+        return;
+    }
+
+    grid_ = grid;
+}
+
+//Name of the file of a shard
+std::string ShardedIntegrator::shardFileName (const std::string& directory,
+                                              const unsigned int& iteration,
+                                              const unsigned int& shardIndex)
+{
+    std::ostringstream name;
+    name << directory << "/shard_" << iteration << "_" << shardIndex << ".bin";
+    return name.str ();
+}
@@ -0,0 +1,157 @@
+/*
+    Sharded VEGAS Monte Carlo integration over the unit hypercube.
+    An iteration is split into shards identified by index, each with its
+    own reproducible random stream, so shards can run in separate
+    processes. Partial results are written to compact binary files and
+    merged in shard order, which reproduces a single-process run exactly.
+*/
+
+#ifndef INTEGRATION
+#define INTEGRATION
+
+#include <complex>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "definitions.h"
+
+//Integrand and observables on the unit hypercube
+typedef std::function <real_t (const std::vector <real_t>&)> Integrand;
+
+//Adaptive VEGAS grid, piecewise linear map of [0,1]^d onto itself
+class VegasGrid
+{
+public:
+    //Constructor: default
+    VegasGrid ();
+    //Constructor: uniform grid
+    VegasGrid (const unsigned int& dimension, const unsigned int& numberOfBins);
+
+    //Map uniform random numbers to a point, fill bin indices
+    //and return the jacobian
+    real_t map (const real_t* uniform, real_t* point,
+                unsigned int* bins) const;
+    //Refine from squared weights accumulated per dimension and bin
+    void refine (const std::vector <real_t>& accumulator,
+                 const real_t& damping = 1.5);
+
+    //Getters
+    unsigned int dimension () const;
+    unsigned int numberOfBins () const;
+    const std::vector <real_t>& edges () const;
+
+    //I/O operations, binary
+    bool write (const std::string& fileName) const;
+    bool read (const std::string& fileName);
+
+private:
+    //Bin edges, dimension * (numberOfBins + 1)
+    std::vector <real_t> edges_;
+
+    //Parameters
+    unsigned int dimension_;
+    unsigned int numberOfBins_;
+
+};
+
+//Partial result of one shard or the merge of several
+struct ShardResult
+{
+    unsigned int shardIndex_;
+    unsigned int iteration_;
+    unsigned long long numberOfPoints_;
+    real_t sum_;
+    real_t sumOfSquares_;
+    //Histogram of weights and squared weights
+    std::vector <real_t> histogramSums_;
+    std::vector <real_t> histogramSquares_;
+    //Squared weights per grid dimension and bin
+    std::vector <real_t> gridAccumulator_;
+};
+
+//Binary I/O of shard results
+bool writeShardResult (const std::string& fileName,
+                       const ShardResult& result);
+bool readShardResult (const std::string& fileName, ShardResult& result);
+
+//Merge partial results in order of shard index, shards given more than
+//once are counted once. 'numberOfMerged' receives the number of shards
+//that were merged.
+ShardResult mergeShardResults (std::vector <ShardResult> results,
+                               unsigned int* numberOfMerged = nullptr);
+
+class ShardedIntegrator
+{
+public:
+    //Constructor
+    ShardedIntegrator (const Integrand& integrand,
+                       const unsigned int& dimension,
+                       const unsigned int& numberOfShards,
+                       const unsigned long long& pointsPerShard,
+                       const unsigned long long& seed,
+                       const unsigned int& numberOfGridBins = 50);
+
+    //Histogram of an observable with uniform bins
+    void setHistogram (const Integrand& observable,
+                       const unsigned int& numberOfBins,
+                       const real_t& lower, const real_t& upper);
+
+    //Run one shard of an iteration with the current grid
+    ShardResult runShard (const unsigned int& shardIndex,
+                          const unsigned int& iteration) const;
+    //Run all shards of an iteration in this process
+    ShardResult runIteration (const unsigned int& iteration) const;
+    //Run all shards of an iteration in forked worker processes, shard
+    //files are written to and read back from 'directory'. If a worker
+    //fails or a shard is missing, the result has no points and is
+    //rejected by update.
+    ShardResult runIterationForked (const unsigned int& iteration,
+                                    const unsigned int& numberOfWorkers,
+                                    const std::string& directory) const;
+
+    //Add a merged iteration to the estimate and refine the grid
+    void update (const ShardResult& merged);
+
+    //Estimates combined over iterations
+    real_t integral () const;
+    real_t error () const;
+    //Histogram of the last iteration, normalized to the integral
+    std::vector <real_t> histogram () const;
+
+    //Grid
+    const VegasGrid& grid () const;
+    void setGrid (const VegasGrid& grid);
+
+    //Name of the file of a shard
+    static std::string shardFileName (const std::string& directory,
+                                      const unsigned int& iteration,
+                                      const unsigned int& shardIndex);
+
+private:
+    //Integrand
+    Integrand integrand_;
+    Integrand observable_;
+
+    //Grid
+    VegasGrid grid_;
+
+    //Histogram binning
+    unsigned int histogramBins_;
+    real_t histogramLower_;
+    real_t histogramUpper_;
+    std::vector <real_t> histogram_;
+
+    //Accumulated estimate, weighted by inverse variance
+    real_t weightedSum_;
+    real_t inverseVarianceSum_;
+
+    //Parameters
+    const unsigned int dimension_;
+    const unsigned int numberOfShards_;
+    const unsigned long long pointsPerShard_;
+    const unsigned long long seed_;
+
+};
+
+#endif
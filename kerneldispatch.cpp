@@ -0,0 +1,218 @@
+/*
+    Runtime selection of instruction set variants of the numeric kernels.
+    The variant is chosen at startup from CPUID and can be forced via
+    setKernelVariant or the environment variable NLO4D_KERNEL
+    (sse2, avx2, avx512).
+*/
+#include <complex>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "definitions.h"
+#include "evaluationtape.h"
+#include "kerneldispatch.h"
+
+namespace
+{
+    KernelVariant activeVariant_ = KernelVariant::SSE2;
+    TapeKernel activeTapeKernel_ = executeTapeSse2;
+    ComplexTapeKernel activeComplexTapeKernel_ = executeComplexTapeSse2;
+    BoostKernel activeBoostKernel_ = boostBatchSse2;
+    RotateKernel activeRotateKernel_ = rotateBatchSse2;
+    DipoleKernel activeDipoleKernel_ = mapDipoleSse2;
+    InitialDipoleKernel activeInitialDipoleKernel_ = mapInitialDipoleSse2;
+
+    //Widest variant the CPU supports
+    KernelVariant bestVariant ()
+    {
+        if (kernelVariantSupported (KernelVariant::AVX512))
+        {
+            return KernelVariant::AVX512;
+        }
+        if (kernelVariantSupported (KernelVariant::AVX2))
+        {
+            return KernelVariant::AVX2;
+        }
+        return KernelVariant::SSE2;
+    }
+
+    //Install kernels of a variant
+    bool selectVariant (const KernelVariant& variant)
+    {
+        KernelVariant selected =
+            (variant == KernelVariant::AUTO) ? bestVariant () : variant;
+
+        if (!kernelVariantSupported (selected))
+        {
+            std::cout << "Error: kernel variant "
+                << kernelVariantName (selected)
+                << " is not supported by this CPU\n";
+            return false;
+        }
+
+        switch (selected)
+        {
+            case KernelVariant::AVX512:
+                activeTapeKernel_ = executeTapeAvx512;
+                activeComplexTapeKernel_ = executeComplexTapeAvx512;
+                activeBoostKernel_ = boostBatchAvx512;
+                activeRotateKernel_ = rotateBatchAvx512;
+                activeDipoleKernel_ = mapDipoleAvx512;
+                activeInitialDipoleKernel_ = mapInitialDipoleAvx512;
+                break;
+            case KernelVariant::AVX2:
+                activeTapeKernel_ = executeTapeAvx2;
+                activeComplexTapeKernel_ = executeComplexTapeAvx2;
+                activeBoostKernel_ = boostBatchAvx2;
+                activeRotateKernel_ = rotateBatchAvx2;
+                activeDipoleKernel_ = mapDipoleAvx2;
+                activeInitialDipoleKernel_ = mapInitialDipoleAvx2;
+                break;
+            default:
+                activeTapeKernel_ = executeTapeSse2;
+                activeComplexTapeKernel_ = executeComplexTapeSse2;
+                activeBoostKernel_ = boostBatchSse2;
+                activeRotateKernel_ = rotateBatchSse2;
+                activeDipoleKernel_ = mapDipoleSse2;
+                activeInitialDipoleKernel_ = mapInitialDipoleSse2;
+                break;
+        }
+        activeVariant_ = selected;
+
+        return true;
+    }
+
+    //Startup selection, honouring NLO4D_KERNEL
+    bool initializeKernelVariant ()
+    {
+        KernelVariant variant = KernelVariant::AUTO;
+
+        const char* requested = std::getenv ("NLO4D_KERNEL");
+        if (requested != nullptr)
+        {
+            if (std::strcmp (requested, "sse2") == 0)
+            {
+                variant = KernelVariant::SSE2;
+            }
+            else if (std::strcmp (requested, "avx2") == 0)
+            {
+                variant = KernelVariant::AVX2;
+            }
+            else if (std::strcmp (requested, "avx512") == 0)
+            {
+                variant = KernelVariant::AVX512;
+            }
+            else if (std::strcmp (requested, "auto") != 0)
+            {
+                std::cout << "Error: unknown kernel variant "
+                    << requested << ", using auto\n";
+            }
+        }
+
+        if (!selectVariant (variant))
+        {
+            selectVariant (KernelVariant::AUTO);
+        }
+
+        return true;
+    }
+
+    //Selected once before first use
+    void ensureInitialized ()
+    {
+        static bool initialized = initializeKernelVariant ();
+        (void) initialized;
+    }
+}
+
+//Check if the CPU can run a variant
+bool kernelVariantSupported (const KernelVariant& variant)
+{
+    __builtin_cpu_init ();
+
+    switch (variant)
+    {
+        case KernelVariant::AUTO:
+        case KernelVariant::SSE2:
+            return true;
+        case KernelVariant::AVX2:
+            return __builtin_cpu_supports ("avx2")
+                && __builtin_cpu_supports ("fma");
+        case KernelVariant::AVX512:
+            return __builtin_cpu_supports ("avx512f")
+                && __builtin_cpu_supports ("avx512dq")
+                && __builtin_cpu_supports ("fma");
+    }
+
+    return false;
+}
+
+//Select variant
+bool setKernelVariant (const KernelVariant& variant)
+{
+    ensureInitialized ();
+    return selectVariant (variant);
+}
+
+//Currently active variant
+KernelVariant kernelVariant ()
+{
+    ensureInitialized ();
+    return activeVariant_;
+}
+
+//Name of a variant
+const char* kernelVariantName (const KernelVariant& variant)
+{
+    switch (variant)
+    {
+        case KernelVariant::AUTO:
+            return "auto";
+        case KernelVariant::SSE2:
+            return "sse2";
+        case KernelVariant::AVX2:
+            return "avx2";
+        case KernelVariant::AVX512:
+            return "avx512";
+    }
+
+    return "unknown";
+}
+
+//Active kernels
+TapeKernel tapeKernel ()
+{
+    ensureInitialized ();
+    return activeTapeKernel_;
+}
+
+ComplexTapeKernel complexTapeKernel ()
+{
+    ensureInitialized ();
+    return activeComplexTapeKernel_;
+}
+
+BoostKernel boostKernel ()
+{
+    ensureInitialized ();
+    return activeBoostKernel_;
+}
+
+RotateKernel rotateKernel ()
+{
+    ensureInitialized ();
+    return activeRotateKernel_;
+}
+
+DipoleKernel dipoleKernel ()
+{
+    ensureInitialized ();
+    return activeDipoleKernel_;
+}
+
+InitialDipoleKernel initialDipoleKernel ()
+{
+    ensureInitialized ();
+    return activeInitialDipoleKernel_;
+}
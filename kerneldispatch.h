@@ -0,0 +1,226 @@
+/*
+    Runtime selection of instruction set variants of the numeric kernels.
+    The variant is chosen at startup from CPUID and can be forced via
+    setKernelVariant or the environment variable NLO4D_KERNEL
+    (sse2, avx2, avx512).
+*/
+
+#ifndef KERNEL_DISPATCH
+#define KERNEL_DISPATCH
+
+#include "definitions.h"
+#include "evaluationtape.h"
+
+//Instruction set variants, AUTO selects the widest supported one
+enum class KernelVariant : unsigned char
+{
+    AUTO,
+    SSE2,
+    AVX2,
+    AVX512
+};
+
+//Tape execution kernel, the real and imaginary row of the current of a
+//slot are adjacent: current[(2 * slot + part) * batchSize + event]
+typedef void (*TapeKernel) (const TapeInstruction* instructions,
+                            const unsigned int& numberOfInstructions,
+                            const real_t* input,
+                            const unsigned int& inputStride,
+                            const unsigned int& eventStride,
+                            const unsigned int& batchSize,
+                            const real_t& massSquared, const real_t& massWidth,
+                            real_t* momentum,
+                            real_t* invariant, real_t* current);
+
+//Variants, all compiled from tapekernel.cpp
+void executeTapeSse2 (const TapeInstruction* instructions,
+                      const unsigned int& numberOfInstructions,
+                      const real_t* input, const unsigned int& inputStride,
+                      const unsigned int& eventStride,
+                      const unsigned int& batchSize,
+                      const real_t& massSquared, const real_t& massWidth,
+                      real_t* momentum,
+                      real_t* invariant, real_t* current);
+void executeTapeAvx2 (const TapeInstruction* instructions,
+                      const unsigned int& numberOfInstructions,
+                      const real_t* input, const unsigned int& inputStride,
+                      const unsigned int& eventStride,
+                      const unsigned int& batchSize,
+                      const real_t& massSquared, const real_t& massWidth,
+                      real_t* momentum,
+                      real_t* invariant, real_t* current);
+void executeTapeAvx512 (const TapeInstruction* instructions,
+                        const unsigned int& numberOfInstructions,
+                        const real_t* input,
+                        const unsigned int& inputStride,
+                        const unsigned int& eventStride,
+                        const unsigned int& batchSize,
+                        const real_t& massSquared, const real_t& massWidth,
+                        real_t* momentum,
+                        real_t* invariant, real_t* current);
+
+//Tape execution kernel for complex kinematics, split real and imaginary
+//parts of input and workspace
+typedef void (*ComplexTapeKernel) (const TapeInstruction* instructions,
+                                   const unsigned int& numberOfInstructions,
+                                   const real_t* inputReal,
+                                   const real_t* inputImag,
+                                   const unsigned int& inputStride,
+                                   const unsigned int& eventStride,
+                                   const unsigned int& batchSize,
+                                   const real_t& massSquared,
+                                   const real_t& massWidth,
+                                   real_t* momentumReal, real_t* momentumImag,
+                                   real_t* invariantReal,
+                                   real_t* invariantImag,
+                                   real_t* current);
+
+//Variants, all compiled from tapekernel.cpp
+void executeComplexTapeSse2 (const TapeInstruction* instructions,
+                             const unsigned int& numberOfInstructions,
+                             const real_t* inputReal, const real_t* inputImag,
+                             const unsigned int& inputStride,
+                             const unsigned int& eventStride,
+                             const unsigned int& batchSize,
+                             const real_t& massSquared,
+                             const real_t& massWidth,
+                             real_t* momentumReal, real_t* momentumImag,
+                             real_t* invariantReal, real_t* invariantImag,
+                             real_t* current);
+void executeComplexTapeAvx2 (const TapeInstruction* instructions,
+                             const unsigned int& numberOfInstructions,
+                             const real_t* inputReal, const real_t* inputImag,
+                             const unsigned int& inputStride,
+                             const unsigned int& eventStride,
+                             const unsigned int& batchSize,
+                             const real_t& massSquared,
+                             const real_t& massWidth,
+                             real_t* momentumReal, real_t* momentumImag,
+                             real_t* invariantReal, real_t* invariantImag,
+                             real_t* current);
+void executeComplexTapeAvx512 (const TapeInstruction* instructions,
+                               const unsigned int& numberOfInstructions,
+                               const real_t* inputReal,
+                               const real_t* inputImag,
+                               const unsigned int& inputStride,
+                               const unsigned int& eventStride,
+                               const unsigned int& batchSize,
+                               const real_t& massSquared,
+                               const real_t& massWidth,
+                               real_t* momentumReal, real_t* momentumImag,
+                               real_t* invariantReal, real_t* invariantImag,
+                               real_t* current);
+
+//Lorentz boost kernel, velocity direction * (fx, fy, fz) / fe per event
+typedef void (*BoostKernel) (real_t* e, real_t* x, real_t* y, real_t* z,
+                             const real_t* fe, const real_t* fx,
+                             const real_t* fy, const real_t* fz,
+                             const real_t& direction,
+                             const unsigned int& size);
+
+//Rotation kernel, row-major 3x3 matrix applied to every event
+typedef void (*RotateKernel) (real_t* x, real_t* y, real_t* z,
+                              const real_t* rotation,
+                              const unsigned int& size);
+
+//Variants, all compiled from framekernel.cpp
+void boostBatchSse2 (real_t* e, real_t* x, real_t* y, real_t* z,
+                     const real_t* fe, const real_t* fx, const real_t* fy,
+                     const real_t* fz, const real_t& direction,
+                     const unsigned int& size);
+void boostBatchAvx2 (real_t* e, real_t* x, real_t* y, real_t* z,
+                     const real_t* fe, const real_t* fx, const real_t* fy,
+                     const real_t* fz, const real_t& direction,
+                     const unsigned int& size);
+void boostBatchAvx512 (real_t* e, real_t* x, real_t* y, real_t* z,
+                       const real_t* fe, const real_t* fx, const real_t* fy,
+                       const real_t* fz, const real_t& direction,
+                       const unsigned int& size);
+void rotateBatchSse2 (real_t* x, real_t* y, real_t* z, const real_t* rotation,
+                      const unsigned int& size);
+void rotateBatchAvx2 (real_t* x, real_t* y, real_t* z, const real_t* rotation,
+                      const unsigned int& size);
+void rotateBatchAvx512 (real_t* x, real_t* y, real_t* z,
+                        const real_t* rotation, const unsigned int& size);
+
+//Dipole mapping kernel, merges p_i and p_j into an on-shell momentum with
+//the recoil on p_k. Components of a momentum are rows inputStride or
+//outputStride apart.
+typedef void (*DipoleKernel) (const real_t* pi, const real_t* pj,
+                              const real_t* pk,
+                              const unsigned int& inputStride,
+                              real_t* merged, real_t* spectator,
+                              const unsigned int& outputStride,
+                              const unsigned int& size);
+
+//Variants, all compiled from dipolekernel.cpp
+void mapDipoleSse2 (const real_t* pi, const real_t* pj, const real_t* pk,
+                    const unsigned int& inputStride, real_t* merged,
+                    real_t* spectator, const unsigned int& outputStride,
+                    const unsigned int& size);
+void mapDipoleAvx2 (const real_t* pi, const real_t* pj, const real_t* pk,
+                    const unsigned int& inputStride, real_t* merged,
+                    real_t* spectator, const unsigned int& outputStride,
+                    const unsigned int& size);
+void mapDipoleAvx512 (const real_t* pi, const real_t* pj, const real_t* pk,
+                      const unsigned int& inputStride, real_t* merged,
+                      real_t* spectator, const unsigned int& outputStride,
+                      const unsigned int& size);
+
+//Initial-initial dipole mapping kernel, keeps the incoming spectator p_k,
+//rescales the incoming emitter p_i along its beam and boosts the final
+//legs other than p_j, finals[f] to mappedFinals[f]
+typedef void (*InitialDipoleKernel) (const real_t* pi, const real_t* pj,
+                                     const real_t* pk,
+                                     const real_t* const* finals,
+                                     const unsigned int& numberOfFinals,
+                                     const unsigned int& inputStride,
+                                     real_t* emitter, real_t* spectator,
+                                     real_t* const* mappedFinals,
+                                     const unsigned int& outputStride,
+                                     const unsigned int& size);
+
+//Variants, all compiled from dipolekernel.cpp
+void mapInitialDipoleSse2 (const real_t* pi, const real_t* pj,
+                           const real_t* pk, const real_t* const* finals,
+                           const unsigned int& numberOfFinals,
+                           const unsigned int& inputStride,
+                           real_t* emitter, real_t* spectator,
+                           real_t* const* mappedFinals,
+                           const unsigned int& outputStride,
+                           const unsigned int& size);
+void mapInitialDipoleAvx2 (const real_t* pi, const real_t* pj,
+                           const real_t* pk, const real_t* const* finals,
+                           const unsigned int& numberOfFinals,
+                           const unsigned int& inputStride,
+                           real_t* emitter, real_t* spectator,
+                           real_t* const* mappedFinals,
+                           const unsigned int& outputStride,
+                           const unsigned int& size);
+void mapInitialDipoleAvx512 (const real_t* pi, const real_t* pj,
+                             const real_t* pk, const real_t* const* finals,
+                             const unsigned int& numberOfFinals,
+                             const unsigned int& inputStride,
+                             real_t* emitter, real_t* spectator,
+                             real_t* const* mappedFinals,
+                             const unsigned int& outputStride,
+                             const unsigned int& size);
+
+//Check if the CPU can run a variant
+bool kernelVariantSupported (const KernelVariant& variant);
+//Select variant, returns false and keeps the current one if unsupported
+bool setKernelVariant (const KernelVariant& variant);
+//Currently active variant
+KernelVariant kernelVariant ();
+//Name of a variant
+const char* kernelVariantName (const KernelVariant& variant);
+
+//Active kernels
+TapeKernel tapeKernel ();
+ComplexTapeKernel complexTapeKernel ();
+BoostKernel boostKernel ();
+RotateKernel rotateKernel ();
+DipoleKernel dipoleKernel ();
+InitialDipoleKernel initialDipoleKernel ();
+
+#endif
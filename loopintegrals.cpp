@@ -0,0 +1,1300 @@
+/*
+    Scalar one-loop integrals of phi^3 theory. In Feynman parameters the
+    triangle is a projective integral over a conic, the box reduces to
+    four such triangles with a linear factor. The conic is integrated in
+    a chart centred on a real null direction, which leaves integrals of
+    logarithms of quadratic polynomials along the edges, solved in terms
+    of logarithms and dilogarithms of their roots.
+*/
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "definitions.h"
+#include "fourvector.h"
+#include "loopintegrals.h"
+
+namespace
+{
+    const real_t pi = std::acos (-1.0);
+    //Feynman prescription relative to the largest invariant or mass
+    const real_t infinitesimal = 1e-20;
+    //Relative size below which polynomial coefficients vanish
+    const real_t tolerance = 1e-13;
+    //Relative size below which invariants count as on-shell
+    const real_t onShell = 1e-10;
+
+    //Integral types of the cache
+    const unsigned int bubbleType = 0;
+    const unsigned int triangleType = 1;
+    const unsigned int boxType = 2;
+
+    //Polynomial c2 t^2 + c1 t + c0
+    struct Quadratic
+    {
+        complex_t c2_;
+        complex_t c1_;
+        complex_t c0_;
+    };
+
+    complex_t evaluate (const Quadratic& q, const complex_t& t)
+    {
+        return (q.c2_ * t + q.c1_) * t + q.c0_;
+    }
+
+    //Principal logarithm, i pi on the negative real axis also for a
+    //negative zero imaginary part
+    complex_t logarithm (const complex_t& z)
+    {
+        real_t imaginary = (z.imag () == 0) ? 0 : z.imag ();
+        return std::log (complex_t (z.real (), imaginary));
+    }
+
+    //Dilogarithm, Bernoulli series in -ln (1 - z) after mapping z into
+    //|z| <= 1, Re z <= 1/2. On the cut z > 1 the value below the cut.
+    complex_t dilog (const complex_t& z)
+    {
+        static const real_t coefficients[11] = {
+            2.77777777777777762e-02, -2.77777777777777778e-04,
+            4.72411186696900978e-06, -9.18577307466196408e-08,
+            1.89788699889710005e-09, -4.06476164514422560e-11,
+            8.92169102045645230e-13, -1.99392958607210744e-14,
+            4.51898002961991825e-16, -1.03565176121812472e-17,
+            2.39521862102618698e-19};
+        const real_t zeta2 = pi * pi / 6;
+
+        if (z == complex_t (0))
+        {
+            return 0;
+        }
+        if (z == complex_t (1))
+        {
+            return zeta2;
+        }
+        if (std::abs (z) > 1)
+        {
+            complex_t log = logarithm (- z);
+            return - dilog (1. / z) - zeta2 - 0.5 * log * log;
+        }
+        if (z.real () > 0.5)
+        {
+            return - dilog (1. - z) + zeta2
+                   - logarithm (z) * logarithm (1. - z);
+        }
+
+        complex_t u = - logarithm (1. - z);
+        complex_t u2 = u * u;
+        complex_t sum = coefficients[10];
+        for (int k = 9; k >= 0; k--)
+        {
+            sum = sum * u2 + coefficients[k];
+        }
+
+        return u - 0.25 * u2 + u * u2 * sum;
+    }
+
+    //Roots of a polynomial of degree two or less, returns their number.
+    //'leading' is the highest non-vanishing coefficient.
+    unsigned int roots (const Quadratic& q, complex_t* root,
+                        complex_t& leading)
+    {
+        real_t size = std::max (std::abs (q.c2_),
+                                std::max (std::abs (q.c1_), std::abs (q.c0_)));
+        if (std::abs (q.c2_) > tolerance * size)
+        {
+            complex_t s = std::sqrt (q.c1_ * q.c1_ - 4. * q.c2_ * q.c0_);
+            complex_t large = (std::abs (- q.c1_ + s) >= std::abs (- q.c1_ - s))
+                              ? - q.c1_ + s : - q.c1_ - s;
+            root[0] = large / (2. * q.c2_);
+            root[1] = (root[0] != complex_t (0))
+                      ? q.c0_ / (q.c2_ * root[0]) : root[0];
+            leading = q.c2_;
+            return 2;
+        }
+        if (std::abs (q.c1_) > tolerance * size)
+        {
+            root[0] = - q.c0_ / q.c1_;
+            leading = q.c1_;
+            return 1;
+        }
+        leading = q.c0_;
+        return 0;
+    }
+
+    //Distance of z from the integration path [0, 1]
+    real_t pathDistance (const complex_t& z)
+    {
+        return std::abs (z - std::min (std::max (z.real (), 0.), 1.));
+    }
+
+    //True if u lies on the real axis up to rounding
+    bool onRealAxis (const complex_t& u)
+    {
+        return std::abs (u.imag ()) <= tolerance * std::abs (u);
+    }
+
+    //Dilogarithm at an end of a path, on the cut z > 1 the value on the
+    //side of 'direction' into which the path continues. Only for paths
+    //crossing the real axis, otherwise the sign of z.imag () is kept.
+    complex_t pathDilog (const complex_t& z, const complex_t& direction)
+    {
+        if (z.real () <= 1 || !onRealAxis (z) || onRealAxis (direction))
+        {
+            return dilog (z);
+        }
+
+        real_t side = (direction.imag () > 0) ? 1 : -1;
+        return complex_t (dilog (z.real ()).real (),
+                          side * pi * std::log (z.real ()));
+    }
+
+    //int_0^1 [ln (t - z) - ln (t0 - z)] / (t - t0) dt
+    complex_t logDifferenceIntegral (const complex_t& t0, const complex_t& z)
+    {
+        //Li2 (u) along u = 1 - (t - z) / w
+        complex_t w = t0 - z;
+        complex_t lower = t0 / w;
+        complex_t upper = (t0 - 1.) / w;
+        complex_t value = pathDilog (lower, - 1. / w)
+                          - pathDilog (upper, 1. / w);
+        if (t0.imag () == 0)
+        {
+            return value;
+        }
+
+        //The dilogarithms follow ln ((t - z) / w), which can cross its cut
+        //once on the path, restore ln (t - z) - ln (w) on each segment.
+        //The path is split there even without a crossing, for z on the
+        //path the sign of the crossing is lost in rounding. If an end
+        //lies on the real axis, the crossing is there and already taken
+        //into account by the side of its dilogarithm.
+        real_t cuts[3] = {0, 1, 1};
+        unsigned int numberOfCuts = 2;
+        bool crossingAtEnd = !onRealAxis (w)
+                             && (onRealAxis (lower) || onRealAxis (upper));
+        if (w.imag () != 0 && !crossingAtEnd)
+        {
+            real_t crossing = - (z * std::conj (w)).imag () / w.imag ();
+            if (crossing > 0 && crossing < 1)
+            {
+                if (((crossing - z) / w).real () < 0)
+                {
+                    //Li2 (x + i0) - Li2 (x - i0) = 2 pi i ln x
+                    real_t x = (1. - (crossing - z) / w).real ();
+                    real_t before = (1. - (0.5 * crossing - z) / w).imag ();
+                    real_t after = (1. - (0.5 * (crossing + 1) - z) / w)
+                                   .imag ();
+                    real_t jump = ((after > 0) ? 1 : -1)
+                                  - ((before > 0) ? 1 : -1);
+                    value += jump * pi * imaginaryUnit * std::log (x);
+                }
+                cuts[1] = crossing;
+                numberOfCuts = 3;
+            }
+        }
+        for (unsigned int i = 0; i + 1 < numberOfCuts; i++)
+        {
+            real_t middle = 0.5 * (cuts[i] + cuts[i + 1]);
+            real_t winding = std::round ((logarithm (middle - z)
+                                          - logarithm (w)
+                                          - logarithm ((middle - z) / w))
+                                         .imag () / (2 * pi));
+            if (winding != 0)
+            {
+                value += 2 * pi * imaginaryUnit * winding
+                         * (logarithm (cuts[i + 1] - t0)
+                            - logarithm (cuts[i] - t0));
+            }
+        }
+
+        return value;
+    }
+
+    //int_0^1 ln (t - z) / (t - t0) dt for t0 away from [0, 1]
+    complex_t logIntegral (const complex_t& t0, const complex_t& z)
+    {
+        complex_t difference = t0 - z;
+        if (std::abs (difference) >= 0.1 * pathDistance (z))
+        {
+            return logDifferenceIntegral (t0, z)
+                   + logarithm (difference) * logarithm ((t0 - 1.) / t0);
+        }
+
+        //Pole close to the root, e.g. on a tangent edge: expand in the
+        //difference, int ln u / u^(n + 1) = - (ln u / n + 1 / n^2) / u^n
+        complex_t logUpper = logarithm (1. - z);
+        complex_t logLower = logarithm (- z);
+        complex_t value = 0.5 * (logUpper * logUpper - logLower * logLower);
+        complex_t powerUpper = 1;
+        complex_t powerLower = 1;
+        for (unsigned int n = 1; n < 40; n++)
+        {
+            powerUpper *= difference / (1. - z);
+            powerLower *= difference / (- z);
+            real_t factor = 1. / n;
+            complex_t term = powerLower * (logLower + factor) * factor
+                             - powerUpper * (logUpper + factor) * factor;
+            value += term;
+            if (std::abs (term) <= 1e-17 * std::abs (value))
+            {
+                break;
+            }
+        }
+
+        return value;
+    }
+
+    //int_0^1 [Log (qa / qb) (t) - Log (qa / qb) (t0)] / (t - t0) dt. The
+    //subtracted constant cancels between the quadratic and the linear
+    //factors of a region, for poles away from [0, 1] it is dropped.
+    complex_t logRatioIntegral (const Quadratic& qa, const Quadratic& qb,
+                                const complex_t& t0)
+    {
+        complex_t rootsA[2], rootsB[2], leading;
+        unsigned int numberOfRootsA = roots (qa, rootsA, leading);
+        unsigned int numberOfRootsB = roots (qb, rootsB, leading);
+
+        //Log (qa / qb) - sum ln (t - root) is piecewise constant, its jumps
+        //are fixed at a point of the path next to the pole. A root on top
+        //of a pole off the path leaves its phase to rounding, there the
+        //subtraction is skipped.
+        real_t point = std::min (std::max (t0.real (), 0.), 1.);
+        real_t distance = std::abs (t0 - point);
+        bool subtract = distance < 0.25;
+        if (t0.real () < 0 || t0.real () > 1)
+        {
+            for (unsigned int i = 0; i < numberOfRootsA; i++)
+            {
+                subtract = subtract
+                           && std::abs (t0 - rootsA[i]) > 1e-6 * distance;
+            }
+            for (unsigned int i = 0; i < numberOfRootsB; i++)
+            {
+                subtract = subtract
+                           && std::abs (t0 - rootsB[i]) > 1e-6 * distance;
+            }
+        }
+        if (distance >= 0.25)
+        {
+            point = 0.5;
+        }
+        //At a root on the path, e.g. one shared by qa and qb, the constant
+        //is taken just inside the path
+        bool atRoot = false;
+        for (unsigned int i = 0; i < numberOfRootsA; i++)
+        {
+            atRoot = atRoot || std::abs (point - rootsA[i]) < 1e-8;
+        }
+        for (unsigned int i = 0; i < numberOfRootsB; i++)
+        {
+            atRoot = atRoot || std::abs (point - rootsB[i]) < 1e-8;
+        }
+        if (atRoot)
+        {
+            point += (point < 0.5) ? 1e-6 : - 1e-6;
+        }
+
+        complex_t value = 0;
+        complex_t constant = logarithm (evaluate (qa, point)
+                                        / evaluate (qb, point));
+        if (subtract)
+        {
+            constant -= logarithm (evaluate (qa, t0) / evaluate (qb, t0));
+        }
+        for (unsigned int i = 0; i < numberOfRootsA; i++)
+        {
+            complex_t root = rootsA[i];
+            value += subtract ? logDifferenceIntegral (t0, root)
+                              : logIntegral (t0, root);
+            constant -= logarithm (point - root);
+            if (subtract)
+            {
+                constant += logarithm (t0 - root);
+            }
+        }
+        for (unsigned int i = 0; i < numberOfRootsB; i++)
+        {
+            complex_t root = rootsB[i];
+            value -= subtract ? logDifferenceIntegral (t0, root)
+                              : logIntegral (t0, root);
+            constant += logarithm (point - root);
+            if (subtract)
+            {
+                constant -= logarithm (t0 - root);
+            }
+        }
+        if (!subtract || std::abs (constant) > 1e-6)
+        {
+            value += constant * logarithm ((t0 - 1.) / t0);
+        }
+
+        return value;
+    }
+
+    //Quadratic form along the edge from vertex i to j, at parameter p + q t
+    Quadratic quadraticEdge (const complex_t y[3][3], const unsigned int& i,
+                             const unsigned int& j, const complex_t& p,
+                             const complex_t& q)
+    {
+        complex_t a2 = y[i][i] + y[j][j] - 2. * y[i][j];
+        complex_t a1 = 2. * (y[i][j] - y[i][i]);
+        complex_t a0 = y[i][i];
+        return {a2 * q * q, (2. * a2 * p + a1) * q, (a2 * p + a1) * p + a0};
+    }
+
+    //Linear factor along the edge from vertex i to j
+    Quadratic linearEdge (const complex_t l[3], const unsigned int& i,
+                          const unsigned int& j, const complex_t& p,
+                          const complex_t& q)
+    {
+        return {0, (l[j] - l[i]) * q, l[i] + (l[j] - l[i]) * p};
+    }
+
+    //Region of the chart between two edges, the integrand has the poles
+    //of 'denominator' and the logarithms of the edge polynomials
+    complex_t region (const complex_t& scale, const Quadratic& denominator,
+                      const Quadratic& qa, const Quadratic& qb,
+                      const Quadratic& la, const Quadratic& lb)
+    {
+        complex_t pole[2], leading;
+        unsigned int numberOfPoles = roots (denominator, pole, leading);
+        complex_t residue[2];
+        if (numberOfPoles == 2)
+        {
+            residue[0] = 1. / (leading * (pole[0] - pole[1]));
+            residue[1] = - residue[0];
+        }
+        else
+        {
+            residue[0] = 1. / leading;
+        }
+
+        complex_t value = 0;
+        for (unsigned int i = 0; i < numberOfPoles; i++)
+        {
+            value += residue[i] * (logRatioIntegral (qa, qb, pole[i])
+                                   - logRatioIntegral (la, lb, pole[i]));
+        }
+
+        return scale * value;
+    }
+
+    //Integral over the triangle in the chart x = (1 - u, u - v, v) whose
+    //lines through vertex 0 end at alpha on the edge from vertex 1 to 2
+    complex_t simplexCore (const complex_t l[3], const complex_t y[3][3],
+                           const complex_t& alpha)
+    {
+        complex_t b = y[1][1] + y[2][2] - 2. * y[1][2];
+        complex_t c = 2. * (y[0][1] - y[1][1] - y[0][2] + y[1][2]);
+        complex_t d = 2. * (y[0][1] - y[0][0]);
+        complex_t e = 2. * (y[0][2] - y[0][1]);
+        complex_t f = y[0][0];
+        complex_t lx = l[1] - l[0];
+        complex_t ly = l[2] - l[1];
+        complex_t cAlpha = c + 2. * b * alpha;
+        complex_t dAlpha = d + e * alpha;
+        complex_t g = lx + ly * alpha;
+        complex_t p2 = ly * cAlpha - g * b;
+        complex_t p1 = l[0] * cAlpha + ly * dAlpha - g * e;
+        complex_t p0 = l[0] * dAlpha - g * f;
+
+        complex_t value = 0;
+        if (alpha != complex_t (1))
+        {
+            complex_t w = 1. - alpha;
+            value += region (w, {p2 * w * w, p1 * w, p0},
+                             quadraticEdge (y, 1, 2, alpha, w),
+                             quadraticEdge (y, 0, 2, 0, 1),
+                             linearEdge (l, 1, 2, alpha, w),
+                             linearEdge (l, 0, 2, 0, 1));
+        }
+        if (alpha != complex_t (0))
+        {
+            value += region (alpha, {p2 * alpha * alpha, - p1 * alpha, p0},
+                             quadraticEdge (y, 1, 2, alpha, - alpha),
+                             quadraticEdge (y, 0, 1, 0, 1),
+                             linearEdge (l, 1, 2, alpha, - alpha),
+                             linearEdge (l, 0, 1, 0, 1));
+        }
+
+        return value;
+    }
+
+    //Real null vector -e_i + n_j e_j + n_k e_k with n_j, n_k >= 0, the
+    //one furthest from a double root is chosen, false if there is none
+    bool nullDirection (const real_t y[3][3], unsigned int& vertex,
+                        unsigned int& first, unsigned int& second,
+                        real_t& firstWeight, real_t& secondWeight)
+    {
+        bool found = false;
+        real_t bestScore = 0;
+        for (unsigned int i = 0; i < 3; i++)
+        {
+            for (unsigned int j = 0; j < 3; j++)
+            {
+                if (j == i)
+                {
+                    continue;
+                }
+                unsigned int k = 3 - i - j;
+                //Directions (1 - s) e_j + s e_k, s in [0, 1] over both orders
+                unsigned int numberOfSteps = (j < k) ? 9 : 8;
+                for (unsigned int step = 0; step < numberOfSteps; step++)
+                {
+                    real_t s = step / 16.;
+                    real_t linear = y[i][j] * (1 - s) + y[i][k] * s;
+                    real_t quadratic = y[j][j] * (1 - s) * (1 - s)
+                                     + 2 * y[j][k] * (1 - s) * s
+                                     + y[k][k] * s * s;
+                    real_t size = std::max (std::abs (y[i][i]),
+                                  std::max (std::abs (quadratic),
+                                            std::abs (linear)));
+
+                    //y_ii - 2 rho linear + rho^2 quadratic = 0
+                    real_t rho[2] = {0, 0};
+                    real_t score = 1;
+                    if (std::abs (quadratic) <= tolerance * size)
+                    {
+                        if (std::abs (linear) <= tolerance * size)
+                        {
+                            continue;
+                        }
+                        rho[0] = y[i][i] / (2 * linear);
+                    }
+                    else
+                    {
+                        real_t discriminant = linear * linear
+                                            - y[i][i] * quadratic;
+                        if (discriminant < 0)
+                        {
+                            continue;
+                        }
+                        real_t root = std::sqrt (discriminant);
+                        rho[0] = (linear + ((linear < 0) ? - root : root))
+                                 / quadratic;
+                        rho[1] = (rho[0] != 0)
+                                 ? y[i][i] / (quadratic * rho[0]) : 0;
+                        score = discriminant / (size * size);
+                    }
+                    for (unsigned int r = 0; r < 2; r++)
+                    {
+                        if (rho[r] <= 0 || (found && score <= bestScore))
+                        {
+                            continue;
+                        }
+                        found = true;
+                        bestScore = score;
+                        vertex = i;
+                        first = j;
+                        second = k;
+                        firstWeight = rho[r] * (1 - s);
+                        secondWeight = rho[r] * s;
+                    }
+                }
+            }
+        }
+
+        return found;
+    }
+
+    //Divided difference f[a, b, c] of f (x) = x ln x for a, b, c within
+    //an angle below pi, the cut of the logarithm is turned away from them
+    complex_t logDividedDifference (const complex_t& a, const complex_t& b,
+                                    const complex_t& c)
+    {
+        complex_t direction = a / std::abs (a) + b / std::abs (b)
+                              + c / std::abs (c);
+        complex_t rotation = std::conj (direction) / std::abs (direction);
+
+        //f[u, v] = ln v + (1 + d) ln (1 + d) / d with d = (u - v) / v
+        auto first = [&rotation] (const complex_t& u, const complex_t& v)
+        {
+            complex_t d = (u - v) / v;
+            complex_t ratio = (std::abs (d) > 1e-3)
+                ? std::log (1. + d) / d
+                : 1. + d * (- 0.5 + d * (1. / 3 + d * (- 0.25 + d * 0.2)));
+            return logarithm (v * rotation) + (1. + d) * ratio;
+        };
+
+        //Outer points a and c the furthest apart
+        complex_t points[3] = {a, b, c};
+        real_t ab = std::abs (a - b);
+        real_t bc = std::abs (b - c);
+        real_t ac = std::abs (a - c);
+        if (ab > ac && ab >= bc)
+        {
+            std::swap (points[1], points[2]);
+        }
+        else if (bc > ac)
+        {
+            std::swap (points[0], points[1]);
+        }
+        complex_t outer = points[0] - points[2];
+        complex_t middle = points[1];
+        if (std::abs (outer) > 1e-4 * std::abs (middle))
+        {
+            return (first (points[0], middle) - first (middle, points[2]))
+                   / outer;
+        }
+
+        //Confluent points: f'' / 2 + f''' / 6 h1 + f'''' / 24 h2 around b
+        complex_t u = points[0] - middle;
+        complex_t v = points[2] - middle;
+        return 0.5 / middle - (u + v) / (6. * middle * middle)
+               + (u * u + u * v + v * v) / (12. * middle * middle * middle);
+    }
+
+    //int over the simplex of 1 / ((l.x) (x^T y x - i eps)), y real
+    complex_t simplexIntegral (const complex_t l[3], const real_t y[3][3])
+    {
+        real_t size = 0;
+        for (unsigned int i = 0; i < 3; i++)
+        {
+            for (unsigned int j = 0; j < 3; j++)
+            {
+                size = std::max (size, std::abs (y[i][j]));
+            }
+        }
+
+        //y = m m^T with m > 0, e.g. massless legs between equal masses:
+        //the conic degenerates, with x_a = z_a / m_a the integral is the
+        //divided difference of x ln x at l_a / m_a
+        bool rankOne = true;
+        real_t m[3];
+        for (unsigned int a = 0; a < 3; a++)
+        {
+            rankOne = rankOne && y[a][a] > onShell * size;
+            m[a] = rankOne ? std::sqrt (y[a][a]) : 0;
+        }
+        for (unsigned int a = 0; a < 3 && rankOne; a++)
+        {
+            for (unsigned int b = 0; b < a; b++)
+            {
+                rankOne = rankOne
+                          && std::abs (y[a][b] - m[a] * m[b]) <= onShell * size;
+            }
+        }
+        if (rankOne)
+        {
+            return logDividedDifference (l[0] / m[0], l[1] / m[1],
+                                         l[2] / m[2]) / (m[0] * m[1] * m[2]);
+        }
+
+        unsigned int i, j, k;
+        real_t firstWeight = 0;
+        real_t secondWeight = 0;
+        complex_t yChart[3][3];
+        complex_t lChart[3];
+        if (!nullDirection (y, i, j, k, firstWeight, secondWeight))
+        {
+            //No real null vector, complex chart of the standard simplex
+            complex_t epsilon = infinitesimal * size * imaginaryUnit;
+            for (unsigned int a = 0; a < 3; a++)
+            {
+                for (unsigned int b = 0; b < 3; b++)
+                {
+                    yChart[a][b] = y[a][b] - epsilon;
+                }
+            }
+            complex_t a = yChart[0][0] + yChart[1][1] - 2. * yChart[0][1];
+            complex_t b = yChart[1][1] + yChart[2][2] - 2. * yChart[1][2];
+            complex_t c = 2. * (yChart[0][1] - yChart[1][1]
+                                - yChart[0][2] + yChart[1][2]);
+            complex_t alpha = (- c + std::sqrt (c * c - 4. * a * b))
+                              / (2. * b);
+            return simplexCore (l, yChart, alpha);
+        }
+
+        //Vertex i on the null direction, weights keep it a simplex
+        unsigned int permutation[3] = {i, j, k};
+        real_t weight[3] = {firstWeight + secondWeight, 1, 1};
+        real_t weightedSize = 0;
+        for (unsigned int a = 0; a < 3; a++)
+        {
+            for (unsigned int b = 0; b < 3; b++)
+            {
+                weightedSize = std::max (weightedSize,
+                    std::abs (y[permutation[a]][permutation[b]])
+                    / (weight[a] * weight[b]));
+            }
+        }
+        complex_t epsilon = infinitesimal * weightedSize * imaginaryUnit;
+        for (unsigned int a = 0; a < 3; a++)
+        {
+            lChart[a] = l[permutation[a]] / weight[a];
+            for (unsigned int b = 0; b < 3; b++)
+            {
+                yChart[a][b] = y[permutation[a]][permutation[b]]
+                               / (weight[a] * weight[b]) - epsilon;
+            }
+        }
+        complex_t alpha = secondWeight / (firstWeight + secondWeight);
+
+        return simplexCore (lChart, yChart, alpha) / weight[0];
+    }
+
+    //Divided difference f[a_0, ..., a_n] of f (x) = x ln x, points sorted
+    real_t dividedDifference (const real_t* a, const unsigned int& n)
+    {
+        real_t table[4];
+        for (unsigned int i = 0; i <= n; i++)
+        {
+            table[i] = (a[i] > 0) ? a[i] * std::log (a[i]) : 0;
+        }
+        for (unsigned int order = 1; order <= n; order++)
+        {
+            for (unsigned int i = n; i >= order; i--)
+            {
+                real_t width = a[i] - a[i - order];
+                if (width > tolerance * a[n])
+                {
+                    table[i] = (table[i] - table[i - 1]) / width;
+                }
+                else
+                {
+                    //Confluent points, derivative over factorial
+                    real_t x = a[i];
+                    real_t derivative = (order == 1) ? std::log (x) + 1
+                                      : (order == 2) ? 1 / x : - 1 / (x * x);
+                    table[i] = derivative / ((order == 3) ? 6 : order);
+                }
+            }
+        }
+
+        return table[n];
+    }
+
+    //Cayley matrix y_ij = (m_i^2 + m_j^2 - p_ij^2) / 2
+    void cayley (const real_t* masses, const real_t invariants[4][4],
+                 const unsigned int& n, real_t y[4][4])
+    {
+        for (unsigned int i = 0; i < n; i++)
+        {
+            for (unsigned int j = 0; j < n; j++)
+            {
+                y[i][j] = 0.5 * (masses[i] * masses[i]
+                                 + masses[j] * masses[j] - invariants[i][j]);
+            }
+        }
+    }
+
+    //Soft or collinear divergence: a massless line between two on-shell
+    //legs or two massless lines with a vanishing invariant between them
+    bool infrared (const real_t y[4][4], const unsigned int& n)
+    {
+        real_t size = 0;
+        for (unsigned int i = 0; i < n; i++)
+        {
+            for (unsigned int j = 0; j < n; j++)
+            {
+                size = std::max (size, std::abs (y[i][j]));
+            }
+        }
+        real_t threshold = onShell * size;
+
+        for (unsigned int i = 0; i < n; i++)
+        {
+            if (std::abs (y[i][i]) > threshold)
+            {
+                continue;
+            }
+            unsigned int next = (i + 1) % n;
+            unsigned int previous = (i + n - 1) % n;
+            bool nextOnShell = std::abs (y[i][next]) <= threshold;
+            bool previousOnShell = std::abs (y[i][previous]) <= threshold;
+            if (nextOnShell && previousOnShell)
+            {
+                return true;
+            }
+            //Adjacent lines through a massless leg, opposite ones of the
+            //box through s or t = 0
+            for (unsigned int j = i + 1; j < n; j++)
+            {
+                if (std::abs (y[j][j]) <= threshold
+                    && std::abs (y[i][j]) <= threshold)
+                {
+                    return true;
+                }
+            }
+        }
+
+        return size == 0;
+    }
+
+    //Margin of the values l_a against zero: their largest angular gap
+    //minus pi. If positive, l.x has no zero on the simplex.
+    real_t halfPlaneMargin (const complex_t l[3])
+    {
+        real_t angle[3] = {std::arg (l[0]), std::arg (l[1]), std::arg (l[2])};
+        std::sort (angle, angle + 3);
+        real_t gap = std::max (angle[1] - angle[0], angle[2] - angle[1]);
+        return std::max (gap, angle[0] + 2 * pi - angle[2]) - pi;
+    }
+
+    //Normalize the null vector 'candidate' to sum v = 1 and keep it in v,
+    //yv = ye v if the linear factors of all its faces have a larger
+    //margin than 'margin'
+    void nullVectorMargin (const complex_t ye[4][4],
+                           const complex_t candidate[4], complex_t v[4],
+                           complex_t yv[4], real_t& margin)
+    {
+        complex_t sum = 0;
+        real_t largest = 0;
+        for (unsigned int i = 0; i < 4; i++)
+        {
+            sum += candidate[i];
+            largest = std::max (largest, std::abs (candidate[i]));
+        }
+        if (std::abs (sum) <= 0.1 * largest)
+        {
+            return;
+        }
+
+        complex_t product[4];
+        for (unsigned int i = 0; i < 4; i++)
+        {
+            product[i] = 0;
+            for (unsigned int j = 0; j < 4; j++)
+            {
+                product[i] += ye[i][j] * candidate[j] / sum;
+            }
+        }
+        real_t candidateMargin = 2 * pi;
+        for (unsigned int k = 0; k < 4; k++)
+        {
+            if (candidate[k] == complex_t (0))
+            {
+                continue;
+            }
+            complex_t l[3];
+            for (unsigned int i = 0, a = 0; i < 4; i++)
+            {
+                if (i != k)
+                {
+                    l[a++] = product[i];
+                }
+            }
+            candidateMargin = std::min (candidateMargin, halfPlaneMargin (l));
+        }
+        if (candidateMargin <= margin)
+        {
+            return;
+        }
+
+        margin = candidateMargin;
+        for (unsigned int i = 0; i < 4; i++)
+        {
+            v[i] = candidate[i] / sum;
+            yv[i] = product[i];
+        }
+    }
+
+    //Triangle or box from the Cayley matrix of n = 3, 4 lines
+    complex_t loopIntegral (const real_t* masses, const real_t invariants[4][4],
+                            const unsigned int& n)
+    {
+        real_t y[4][4];
+        cayley (masses, invariants, n, y);
+        if (infrared (y, n))
+        {
+            std::cout << "Error: infrared divergent loop integral\n";
+            return 0;
+        }
+
+        //All invariants zero: C0 = - f[m_i^2], D0 = - f[m_i^2]
+        bool zeroMomenta = true;
+        for (unsigned int i = 0; i < n; i++)
+        {
+            for (unsigned int j = 0; j < n; j++)
+            {
+                zeroMomenta = zeroMomenta && invariants[i][j] == 0;
+            }
+        }
+        if (zeroMomenta)
+        {
+            real_t squares[4];
+            for (unsigned int i = 0; i < n; i++)
+            {
+                squares[i] = masses[i] * masses[i];
+            }
+            std::sort (squares, squares + n);
+            return - dividedDifference (squares, n - 1);
+        }
+
+        real_t size = 0;
+        for (unsigned int i = 0; i < n; i++)
+        {
+            for (unsigned int j = 0; j < n; j++)
+            {
+                size = std::max (size, std::abs (y[i][j]));
+            }
+        }
+
+        if (n == 3)
+        {
+            const complex_t l[3] = {1, 1, 1};
+            real_t triangle[3][3];
+            for (unsigned int i = 0; i < 3; i++)
+            {
+                for (unsigned int j = 0; j < 3; j++)
+                {
+                    triangle[i][j] = y[i][j];
+                }
+            }
+            return - simplexIntegral (l, triangle);
+        }
+
+        //Box: v null vector of y - i eps, then D0 is a sum of triangles
+        //with linear factor 2 (y v) without line k, weighted with v_k
+        complex_t ye[4][4];
+        for (unsigned int i = 0; i < 4; i++)
+        {
+            for (unsigned int j = 0; j < 4; j++)
+            {
+                ye[i][j] = y[i][j] - infinitesimal * size * imaginaryUnit;
+            }
+        }
+
+        //Candidates e_i for massless lines and e_i + beta e_j + shift e_k,
+        //the first one keeping the linear factors at least one radian away
+        //from zero is taken, otherwise the one with the largest margin
+        static const complex_t shifts[4] = {complex_t (0, 0),
+            complex_t (0, 0.37), complex_t (0, -0.37), complex_t (0.8, 0.5)};
+        complex_t v[4], yv[4];
+        real_t bestMargin = - 2 * pi;
+        for (unsigned int i = 0; i < 4; i++)
+        {
+            if (std::abs (y[i][i]) > tolerance * size)
+            {
+                continue;
+            }
+            complex_t candidate[4] = {0, 0, 0, 0};
+            candidate[i] = 1;
+            nullVectorMargin (ye, candidate, v, yv, bestMargin);
+        }
+        const real_t sufficientMargin = 1;
+        for (unsigned int i = 0; i < 4 && bestMargin < sufficientMargin; i++)
+        {
+            for (unsigned int j = 0; j < 4 && bestMargin < sufficientMargin;
+                 j++)
+            {
+                for (unsigned int k = 0; k < 4 && bestMargin < sufficientMargin;
+                     k++)
+                {
+                    if (j == i || k == i || k == j)
+                    {
+                        continue;
+                    }
+                    //Without shift k is irrelevant, take the first one
+                    unsigned int first = 0;
+                    while (first == i || first == j)
+                    {
+                        first++;
+                    }
+                    for (unsigned int s = (k == first) ? 0 : 1;
+                         s < 4 && bestMargin < sufficientMargin; s++)
+                    {
+                        const complex_t& shift = shifts[s];
+                        complex_t a = ye[j][j];
+                        complex_t b = 2. * (ye[i][j] + shift * ye[j][k]);
+                        complex_t c = ye[i][i] + 2. * shift * ye[i][k]
+                                      + shift * shift * ye[k][k];
+                        complex_t beta[2], leading;
+                        unsigned int numberOfRoots = roots ({a, b, c}, beta,
+                                                            leading);
+                        for (unsigned int r = 0; r < numberOfRoots; r++)
+                        {
+                            complex_t candidate[4] = {0, 0, 0, 0};
+                            candidate[i] = 1;
+                            candidate[j] = beta[r];
+                            candidate[k] = shift;
+                            nullVectorMargin (ye, candidate, v, yv,
+                                              bestMargin);
+                        }
+                    }
+                }
+            }
+        }
+
+        if (bestMargin == - 2 * pi)
+        {
+            std::cout << "Error: no null vector for the box\n";
+            return 0;
+        }
+
+        complex_t value = 0;
+        for (unsigned int k = 0; k < 4; k++)
+        {
+            if (v[k] == complex_t (0))
+            {
+                continue;
+            }
+            complex_t l[3];
+            real_t triangle[3][3];
+            for (unsigned int i = 0, a = 0; i < 4; i++)
+            {
+                if (i == k)
+                {
+                    continue;
+                }
+                l[a] = 2. * yv[i];
+                for (unsigned int j = 0, b = 0; j < 4; j++)
+                {
+                    if (j != k)
+                    {
+                        triangle[a][b++] = y[i][j];
+                    }
+                }
+                a++;
+            }
+            value += v[k] * simplexIntegral (l, triangle);
+        }
+
+        return value;
+    }
+
+    //Finite part of B0, - int_0^1 ln (Q (x) / mu^2) dx with
+    //Q = x m1^2 + (1 - x) m0^2 - x (1 - x) p^2 - i eps
+    complex_t bubbleIntegral (const real_t& p, const real_t& m0,
+                              const real_t& m1, const real_t& scale)
+    {
+        real_t a0 = m0 * m0;
+        real_t a1 = m1 * m1;
+        real_t size = std::max (std::abs (p), std::max (a0, a1));
+        if (size == 0)
+        {
+            return 0;
+        }
+
+        Quadratic q = {p, a1 - a0 - p,
+                       complex_t (a0, - infinitesimal * size)};
+        complex_t root[2], leading;
+        unsigned int numberOfRoots = roots (q, root, leading);
+
+        //int_0^1 ln (x - r) dx = (1 - r) ln (1 - r) + r ln (- r) - 1
+        complex_t constant = logarithm (evaluate (q, 0.5));
+        complex_t integral = 0;
+        for (unsigned int i = 0; i < numberOfRoots; i++)
+        {
+            constant -= logarithm (0.5 - root[i]);
+            integral += (1. - root[i]) * logarithm (1. - root[i]) - 1.;
+            if (root[i] != complex_t (0))
+            {
+                integral += root[i] * logarithm (- root[i]);
+            }
+        }
+
+        return - constant - integral + 2 * std::log (scale);
+    }
+
+    //Report non-finite results, which are set to zero
+    complex_t checked (const complex_t& value)
+    {
+        if (std::isfinite (value.real ()) && std::isfinite (value.imag ()))
+        {
+            return value;
+        }
+        std::cout << "Error: loop integral is not finite\n";
+        return 0;
+    }
+
+    //Hash of a cache key
+    std::size_t cacheIndex (const std::array <real_t, 6>& key,
+                            const unsigned int& type, const std::size_t& mask)
+    {
+        std::uint64_t hash = 1469598103934665603ull ^ type;
+        for (unsigned int i = 0; i < 6; i++)
+        {
+            std::uint64_t bits;
+            std::memcpy (&bits, &key[i], sizeof (bits));
+            hash = (hash ^ bits) * 1099511628211ull;
+            hash ^= hash >> 29;
+        }
+        return static_cast <std::size_t> (hash) & mask;
+    }
+}
+
+ScalarLoopIntegrals::ScalarLoopIntegrals (const real_t& mass,
+                                          const real_t& scale)
+    : cache_ (64), cacheEntries_ (0), event_ (1), cacheHits_ (0),
+      mass_ (mass), scale_ (scale) {}
+
+complex_t ScalarLoopIntegrals::bubble (const real_t& p1)
+{
+    return cached (bubbleType, &p1);
+}
+
+complex_t ScalarLoopIntegrals::triangle (const real_t& p1, const real_t& p2,
+                                         const real_t& p12)
+{
+    const real_t invariants[3] = {p1, p2, p12};
+    return cached (triangleType, invariants);
+}
+
+complex_t ScalarLoopIntegrals::box (const real_t& p1, const real_t& p2,
+                                    const real_t& p3, const real_t& p4,
+                                    const real_t& p12, const real_t& p23)
+{
+    const real_t invariants[6] = {p1, p2, p3, p4, p12, p23};
+    return cached (boxType, invariants);
+}
+
+complex_t ScalarLoopIntegrals::bubble (const FourVector <real_t>& momentum)
+{
+    return bubble (momentum.square ());
+}
+
+complex_t ScalarLoopIntegrals::triangle
+    (const std::vector <FourVector <real_t>>& momenta)
+{
+    if (momenta.size () != 3)
+    {
+        std::cout << "Error: triangle needs three external momenta\n";
+        return 0;
+    }
+
+    return triangle (momenta[0].square (), momenta[1].square (),
+                     (momenta[0] + momenta[1]).square ());
+}
+
+complex_t ScalarLoopIntegrals::box
+    (const std::vector <FourVector <real_t>>& momenta)
+{
+    if (momenta.size () != 4)
+    {
+        std::cout << "Error: box needs four external momenta\n";
+        return 0;
+    }
+
+    return box (momenta[0].square (), momenta[1].square (),
+                momenta[2].square (), momenta[3].square (),
+                (momenta[0] + momenta[1]).square (),
+                (momenta[1] + momenta[2]).square ());
+}
+
+complex_t ScalarLoopIntegrals::bubble (const real_t& p1,
+                                       const std::array <real_t, 2>& masses)
+                                       const
+{
+    return checked (bubbleIntegral (p1, masses[0], masses[1], scale_));
+}
+
+complex_t ScalarLoopIntegrals::triangle (const real_t& p1, const real_t& p2,
+                                         const real_t& p12,
+                                         const std::array <real_t, 3>& masses)
+                                         const
+{
+    real_t invariants[4][4];
+    invariants[0][0] = invariants[1][1] = invariants[2][2] = 0;
+    invariants[0][1] = invariants[1][0] = p1;
+    invariants[1][2] = invariants[2][1] = p2;
+    invariants[0][2] = invariants[2][0] = p12;
+
+    return checked (loopIntegral (masses.data (), invariants, 3));
+}
+
+complex_t ScalarLoopIntegrals::box (const real_t& p1, const real_t& p2,
+                                    const real_t& p3, const real_t& p4,
+                                    const real_t& p12, const real_t& p23,
+                                    const std::array <real_t, 4>& masses)
+                                    const
+{
+    real_t invariants[4][4];
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        invariants[i][i] = 0;
+    }
+    invariants[0][1] = invariants[1][0] = p1;
+    invariants[1][2] = invariants[2][1] = p2;
+    invariants[2][3] = invariants[3][2] = p3;
+    invariants[0][3] = invariants[3][0] = p4;
+    invariants[0][2] = invariants[2][0] = p12;
+    invariants[1][3] = invariants[3][1] = p23;
+
+    return checked (loopIntegral (masses.data (), invariants, 4));
+}
+
+void ScalarLoopIntegrals::bubbles (const real_t* invariants,
+                                   const unsigned int& numberOfIntegrals,
+                                   const unsigned int& batchSize,
+                                   const unsigned int& stride,
+                                   complex_t* results)
+{
+    evaluateBatch (bubbleType, 1, invariants, numberOfIntegrals, batchSize,
+                   stride, results);
+}
+
+void ScalarLoopIntegrals::triangles (const real_t* invariants,
+                                     const unsigned int& numberOfIntegrals,
+                                     const unsigned int& batchSize,
+                                     const unsigned int& stride,
+                                     complex_t* results)
+{
+    evaluateBatch (triangleType, 3, invariants, numberOfIntegrals, batchSize,
+                   stride, results);
+}
+
+void ScalarLoopIntegrals::boxes (const real_t* invariants,
+                                 const unsigned int& numberOfIntegrals,
+                                 const unsigned int& batchSize,
+                                 const unsigned int& stride,
+                                 complex_t* results)
+{
+    evaluateBatch (boxType, 6, invariants, numberOfIntegrals, batchSize,
+                   stride, results);
+}
+
+void ScalarLoopIntegrals::newEvent ()
+{
+    //Entries are tagged with their event, stale tags are cleared on wrap
+    if (++event_ == 0)
+    {
+        for (LoopCacheEntry& entry : cache_)
+        {
+            entry.event_ = 0;
+        }
+        event_ = 1;
+    }
+    cacheEntries_ = 0;
+}
+
+unsigned long ScalarLoopIntegrals::cacheHits () const
+{
+    return cacheHits_;
+}
+
+complex_t ScalarLoopIntegrals::cached (const unsigned int& type,
+                                       const real_t* invariants)
+{
+    //Integrals with equal internal masses are symmetric under permutations
+    //of the legs: all of them for the triangle, the dihedral group for the
+    //box. The smallest image is the key, -0 is mapped to +0.
+    std::array <real_t, 6> key = {{0, 0, 0, 0, 0, 0}};
+    if (type == bubbleType)
+    {
+        key[0] = invariants[0] + 0.0;
+    }
+    else if (type == triangleType)
+    {
+        for (unsigned int i = 0; i < 3; i++)
+        {
+            key[i] = invariants[i] + 0.0;
+        }
+        std::sort (key.begin (), key.begin () + 3);
+    }
+    else
+    {
+        std::array <real_t, 6> image;
+        for (unsigned int i = 0; i < 6; i++)
+        {
+            image[i] = invariants[i] + 0.0;
+        }
+        key = image;
+        for (unsigned int reflection = 0; reflection < 2; reflection++)
+        {
+            for (unsigned int rotation = 0; rotation < 4; rotation++)
+            {
+                //(p1, p2, p3, p4, s, t) -> (p2, p3, p4, p1, t, s)
+                image = {{image[1], image[2], image[3], image[0],
+                          image[5], image[4]}};
+                if (image < key)
+                {
+                    key = image;
+                }
+            }
+            //(p1, p2, p3, p4, s, t) -> (p4, p3, p2, p1, s, t)
+            image = {{image[3], image[2], image[1], image[0],
+                      image[4], image[5]}};
+        }
+    }
+
+    std::size_t mask = cache_.size () - 1;
+    std::size_t index = cacheIndex (key, type, mask);
+    while (cache_[index].event_ == event_)
+    {
+        if (cache_[index].type_ == type && cache_[index].key_ == key)
+        {
+            cacheHits_++;
+            return cache_[index].value_;
+        }
+        index = (index + 1) & mask;
+    }
+
+    complex_t value;
+    if (type == bubbleType)
+    {
+        value = bubble (key[0], {{mass_, mass_}});
+    }
+    else if (type == triangleType)
+    {
+        value = triangle (key[0], key[1], key[2], {{mass_, mass_, mass_}});
+    }
+    else
+    {
+        value = box (key[0], key[1], key[2], key[3], key[4], key[5],
+                     {{mass_, mass_, mass_, mass_}});
+    }
+
+    //Keep the table at most half full, only entries of this event move
+    if (2 * (cacheEntries_ + 1) > cache_.size ())
+    {
+        std::vector <LoopCacheEntry> entries (2 * cache_.size ());
+        mask = entries.size () - 1;
+        for (const LoopCacheEntry& entry : cache_)
+        {
+            if (entry.event_ != event_)
+            {
+                continue;
+            }
+            std::size_t slot = cacheIndex (entry.key_, entry.type_, mask);
+            while (entries[slot].event_ == event_)
+            {
+                slot = (slot + 1) & mask;
+            }
+            entries[slot] = entry;
+        }
+        cache_.swap (entries);
+        index = cacheIndex (key, type, mask);
+        while (cache_[index].event_ == event_)
+        {
+            index = (index + 1) & mask;
+        }
+    }
+
+    cache_[index] = {key, type, event_, value};
+    cacheEntries_++;
+
+    return value;
+}
+
+//Batch over events, event by event with the cache of each event
+void ScalarLoopIntegrals::evaluateBatch (const unsigned int& type,
+                                         const unsigned int& size,
+                                         const real_t* invariants,
+                                         const unsigned int& numberOfIntegrals,
+                                         const unsigned int& batchSize,
+                                         const unsigned int& stride,
+                                         complex_t* results)
+{
+    real_t eventInvariants[6];
+    for (unsigned int event = 0; event < batchSize; event++)
+    {
+        newEvent ();
+        for (unsigned int integral = 0; integral < numberOfIntegrals;
+             integral++)
+        {
+            for (unsigned int i = 0; i < size; i++)
+            {
+                eventInvariants[i] = invariants[(integral * size + i) * stride
+                                                + event];
+            }
+            results[integral * batchSize + event]
+                = cached (type, eventInvariants);
+        }
+    }
+}
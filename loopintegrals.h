@@ -0,0 +1,107 @@
+/*
+    Scalar one-loop integrals of phi^3 theory: bubble B0, triangle C0 and
+    box D0 with massless or massive internal lines, evaluated analytically
+    in terms of logarithms and dilogarithms ('t Hooft-Veltman).
+    Normalization is 1 / (i pi^2) int d^4q over the propagators
+    1 / ((q + r_k)^2 - m_k^2 + i eps), B0 is the finite part in the MS-bar
+    scheme. Invariants follow the LoopTools order, e.g. the box takes
+    p1^2, p2^2, p3^2, p4^2, (p1 + p2)^2, (p2 + p3)^2.
+*/
+
+#ifndef LOOP_INTEGRALS
+#define LOOP_INTEGRALS
+
+#include <array>
+#include <complex>
+#include <vector>
+
+#include "definitions.h"
+#include "fourvector.h"
+
+//Integral of an event, identified by its type and symmetrized invariants
+struct LoopCacheEntry
+{
+    std::array <real_t, 6> key_;
+    unsigned int type_;
+    unsigned int event_;
+    complex_t value_;
+};
+
+class ScalarLoopIntegrals
+{
+public:
+    //Constructor: all internal lines with mass 'mass', zero for massless
+    //lines, and renormalization scale 'scale' of the bubble
+    ScalarLoopIntegrals (const real_t& mass, const real_t& scale);
+
+    //Integrals with the internal mass of the constructor, cached until
+    //the next call of newEvent
+    complex_t bubble (const real_t& p1);
+    complex_t triangle (const real_t& p1, const real_t& p2,
+                        const real_t& p12);
+    complex_t box (const real_t& p1, const real_t& p2, const real_t& p3,
+                   const real_t& p4, const real_t& p12, const real_t& p23);
+    //Integrals from the momenta of the external legs, all incoming
+    complex_t bubble (const FourVector <real_t>& momentum);
+    complex_t triangle (const std::vector <FourVector <real_t>>& momenta);
+    complex_t box (const std::vector <FourVector <real_t>>& momenta);
+
+    //Integrals with arbitrary internal masses, the mass of line k sits
+    //between legs k and k + 1
+    complex_t bubble (const real_t& p1,
+                      const std::array <real_t, 2>& masses) const;
+    complex_t triangle (const real_t& p1, const real_t& p2,
+                        const real_t& p12,
+                        const std::array <real_t, 3>& masses) const;
+    complex_t box (const real_t& p1, const real_t& p2, const real_t& p3,
+                   const real_t& p4, const real_t& p12, const real_t& p23,
+                   const std::array <real_t, 4>& masses) const;
+
+    //Integrals for a batch of events, numberOfIntegrals per event
+    //invariants: invariants[(integral * k + i) * stride + event] with
+    //            k = 1, 3, 6 invariants in the argument order above
+    //results:    results[integral * batchSize + event]
+    //Repeated invariant combinations of an event are evaluated once. The
+    //batch layout is a convenience for callers holding SoA data, events
+    //are evaluated one after the other through the scalar path.
+    void bubbles (const real_t* invariants,
+                  const unsigned int& numberOfIntegrals,
+                  const unsigned int& batchSize, const unsigned int& stride,
+                  complex_t* results);
+    void triangles (const real_t* invariants,
+                    const unsigned int& numberOfIntegrals,
+                    const unsigned int& batchSize,
+                    const unsigned int& stride, complex_t* results);
+    void boxes (const real_t* invariants,
+                const unsigned int& numberOfIntegrals,
+                const unsigned int& batchSize, const unsigned int& stride,
+                complex_t* results);
+
+    //Forget the integrals of the last event
+    void newEvent ();
+    //Number of integrals taken from the cache
+    unsigned long cacheHits () const;
+
+private:
+    //Cached integral of the given type, invariants in argument order
+    complex_t cached (const unsigned int& type, const real_t* invariants);
+    //Batch over events with 'size' invariants per integral
+    void evaluateBatch (const unsigned int& type, const unsigned int& size,
+                        const real_t* invariants,
+                        const unsigned int& numberOfIntegrals,
+                        const unsigned int& batchSize,
+                        const unsigned int& stride, complex_t* results);
+
+    //Open addressing table, entries of older events count as empty
+    std::vector <LoopCacheEntry> cache_;
+    unsigned int cacheEntries_;
+    unsigned int event_;
+    unsigned long cacheHits_;
+
+    //Parameters
+    const real_t mass_;
+    const real_t scale_;
+
+};
+
+#endif
@@ -2,7 +2,6 @@
 
 #include <iostream>
 
-#include "fourvector_real.h"
 #include "testroutines.h"
 
 
@@ -20,6 +19,21 @@ int main()
         testUtilities ();
         //testFourVector ();
         //testScalarTreeAmplitude ();
+        //testEvaluationTape ();
+        //testShardedIntegration ();
+        //testEventPipeline ();
+        //testHistogram ();
+        //testLorentzTransformations ();
+        //testUnweighting ();
+        //testCInterface ();
+        //testComplexMomenta ();
+        //testMultiChannel ();
+        //testEvaluationPlans ();
+        //testLoopIntegrals ();
+        //testCutFirstEvaluation ();
+        //testFlavouredAmplitude ();
+        //testMemoryPlacement ();
+        //testDipoleSubtraction ();
 
     //Running environment
     #else
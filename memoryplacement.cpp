@@ -0,0 +1,275 @@
+/*
+    Placement of large evaluation buffers on NUMA nodes and huge pages.
+    Buffers of at least one MiB are mapped directly, bound to the node of
+    the allocating thread and optionally backed by transparent or explicit
+    huge pages. Smaller buffers come from the heap. Worker threads are
+    pinned to the CPUs of a node, so that the workspaces they allocate and
+    first touch stay local to them.
+*/
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <string>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "memoryplacement.h"
+
+namespace
+{
+    //Buffers from this size on are mapped, in multiples of a page
+    const std::size_t mappingThreshold = 1 << 20;
+    //Mapped buffers start with their mapping length, the header keeps
+    //the data aligned to a cache line
+    const std::size_t mappingHeader = 64;
+
+    //Memory policies of the kernel (numaif.h)
+    const int preferredPolicy = 1;
+    const unsigned long nodeFlag = 1;
+    const unsigned long addressFlag = 2;
+
+    //Node of the calling thread, set when pinned
+    thread_local int threadNode = -1;
+
+    //Page backing, initialized from the environment
+    HugePages& hugePagesStorage ()
+    {
+        static HugePages hugePages = [] ()
+        {
+            const char* value = std::getenv ("NLO4D_HUGE_PAGES");
+            if (value != nullptr && std::string (value) == "transparent")
+            {
+                return HugePages::TRANSPARENT;
+            }
+            if (value != nullptr && std::string (value) == "explicit")
+            {
+                return HugePages::EXPLICIT;
+            }
+            return HugePages::NONE;
+        } ();
+        return hugePages;
+    }
+
+    //Largest number in a sysfs list such as "0-3,8-11", -1 if empty
+    int parseList (const std::string& list, cpu_set_t* set)
+    {
+        int largest = -1;
+        const char* position = list.c_str ();
+
+        while (*position != '\0')
+        {
+            char* end = nullptr;
+            long first = std::strtol (position, &end, 10);
+            if (end == position)
+            {
+                break;
+            }
+            long last = first;
+            if (*end == '-')
+            {
+                position = end + 1;
+                last = std::strtol (position, &end, 10);
+            }
+            for (long i = first; i <= last; i++)
+            {
+                if (set != nullptr && i < CPU_SETSIZE)
+                {
+                    CPU_SET (i, set);
+                }
+            }
+            largest = std::max (largest, (int) last);
+            position = (*end == ',') ? end + 1 : end;
+            if (*end != ',')
+            {
+                break;
+            }
+        }
+
+        return largest;
+    }
+
+    //Size of a regular page
+    std::size_t basePageSize ()
+    {
+        static std::size_t size = [] ()
+        {
+            long value = sysconf (_SC_PAGESIZE);
+            return (value > 0) ? (std::size_t) value : (std::size_t) 4096;
+        } ();
+        return size;
+    }
+
+    //Default huge page size of the kernel, which MAP_HUGETLB uses
+    //without a size flag, from the Hugepagesize line of meminfo
+    std::size_t hugePageSize ()
+    {
+        static std::size_t size = [] ()
+        {
+            std::ifstream file ("/proc/meminfo");
+            std::string key;
+            std::size_t kilobytes = 0;
+            while (file >> key)
+            {
+                if (key == "Hugepagesize:" && file >> kilobytes)
+                {
+                    break;
+                }
+                file.ignore (256, '\n');
+            }
+            return (kilobytes > 0) ? kilobytes << 10 : (std::size_t) 2 << 20;
+        } ();
+        return size;
+    }
+
+    //First line of a sysfs file, empty if missing
+    std::string readLine (const std::string& fileName)
+    {
+        std::ifstream file (fileName);
+        std::string line;
+        std::getline (file, line);
+        return line;
+    }
+}
+
+//Set page backing
+void setHugePages (const HugePages& hugePages)
+{
+    hugePagesStorage () = hugePages;
+}
+
+//Page backing
+HugePages hugePages ()
+{
+    return hugePagesStorage ();
+}
+
+//Number of NUMA nodes
+unsigned int numberOfNumaNodes ()
+{
+    static unsigned int nodes = [] ()
+    {
+        int largest =
+            parseList (readLine ("/sys/devices/system/node/online"), nullptr);
+        return (largest < 0) ? 1u : (unsigned int) largest + 1;
+    } ();
+    return nodes;
+}
+
+//Pin the calling thread to the CPUs of a node
+bool pinThreadToNode (const unsigned int& node)
+{
+    if (node >= numberOfNumaNodes ())
+    {
+        return false;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO (&set);
+    std::string list = readLine ("/sys/devices/system/node/node"
+                                 + std::to_string (node) + "/cpulist");
+    if (parseList (list, &set) < 0
+        || pthread_setaffinity_np (pthread_self (), sizeof (set), &set) != 0)
+    {
+        return false;
+    }
+
+    threadNode = node;
+    return true;
+}
+
+//Node of the calling thread
+int threadNumaNode ()
+{
+    return threadNode;
+}
+
+//Node of a page
+int pageNumaNode (const void* address)
+{
+#ifdef SYS_get_mempolicy
+    int node = -1;
+    if (syscall (SYS_get_mempolicy, &node, nullptr, 0, address,
+                 nodeFlag | addressFlag) == 0)
+    {
+        return node;
+    }
+#endif
+    (void) address;
+    return -1;
+}
+
+//Allocate on a node
+void* allocatePlaced (const std::size_t& bytes, const int& node)
+{
+    if (bytes < mappingThreshold)
+    {
+        return ::operator new (bytes);
+    }
+
+    //Whole huge pages only if they are requested
+    const HugePages backing = hugePages ();
+    const std::size_t page = (backing == HugePages::NONE)
+                           ? basePageSize () : hugePageSize ();
+    std::size_t length = (bytes + mappingHeader + page - 1) / page * page;
+    void* pointer = MAP_FAILED;
+
+    //Explicit huge pages fail without reserved pages, fall back then
+    if (backing == HugePages::EXPLICIT)
+    {
+        pointer = mmap (nullptr, length, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+    if (pointer == MAP_FAILED)
+    {
+        pointer = mmap (nullptr, length, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (pointer == MAP_FAILED)
+        {
+            throw std::bad_alloc ();
+        }
+        if (backing != HugePages::NONE)
+        {
+            madvise (pointer, length, MADV_HUGEPAGE);
+        }
+    }
+
+    //Preferred policy: pages go to the node on first touch by any
+    //thread, other nodes are used only if it is full
+    int target = (node < 0) ? threadNode : node;
+#ifdef SYS_mbind
+    if (target >= 0 && target < 8 * (int) sizeof (unsigned long))
+    {
+        //The kernel counts one bit more than the mask holds
+        unsigned long mask = 1ul << target;
+        syscall (SYS_mbind, pointer, length, preferredPolicy, &mask,
+                 8 * sizeof (unsigned long) + 1, 0);
+    }
+#endif
+
+    //The backing may change before the buffer is freed, keep the length
+    *static_cast <std::size_t*> (pointer) = length;
+    return static_cast <char*> (pointer) + mappingHeader;
+}
+
+//Free storage of allocatePlaced
+void deallocatePlaced (void* pointer, const std::size_t& bytes)
+{
+    if (pointer == nullptr)
+    {
+        return;
+    }
+
+    if (bytes < mappingThreshold)
+    {
+        ::operator delete (pointer);
+        return;
+    }
+
+    void* mapping = static_cast <char*> (pointer) - mappingHeader;
+    munmap (mapping, *static_cast <std::size_t*> (mapping));
+}
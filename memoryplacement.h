@@ -0,0 +1,128 @@
+/*
+    Placement of large evaluation buffers on NUMA nodes and huge pages.
+    Buffers of at least one MiB are mapped directly, bound to the node of
+    the allocating thread and optionally backed by transparent or explicit
+    huge pages. Smaller buffers come from the heap. Worker threads are
+    pinned to the CPUs of a node, so that the workspaces they allocate and
+    first touch stay local to them.
+*/
+
+#ifndef MEMORY_PLACEMENT
+#define MEMORY_PLACEMENT
+
+#include <cstddef>
+#include <vector>
+
+//Page backing of new buffers
+enum class HugePages : unsigned char
+{
+    //Regular pages
+    NONE,
+    //Transparent huge pages requested with madvise
+    TRANSPARENT,
+    //Reserved huge pages (hugetlbfs), regular pages if none are left
+    EXPLICIT
+};
+
+//Page backing, taken from the environment variable NLO4D_HUGE_PAGES
+//('transparent' or 'explicit') by default
+void setHugePages (const HugePages& hugePages);
+HugePages hugePages ();
+
+//Number of NUMA nodes, one without NUMA support
+unsigned int numberOfNumaNodes ();
+//Pin the calling thread to the CPUs of a node, false if not possible.
+//Later allocations of the thread are placed on that node.
+bool pinThreadToNode (const unsigned int& node);
+//Node the calling thread is pinned to, -1 if not pinned
+int threadNumaNode ();
+//Node of the page at 'address', -1 if unknown or not yet touched
+int pageNumaNode (const void* address);
+
+//Allocate on a node, -1 for the node of the calling thread
+void* allocatePlaced (const std::size_t& bytes, const int& node);
+void deallocatePlaced (void* pointer, const std::size_t& bytes);
+
+//Allocator for std::vector placing its storage with allocatePlaced.
+//Storage of any two allocators is interchangeable.
+template <class T>
+class PlacedAllocator
+{
+public:
+    typedef T value_type;
+
+    //Constructor: storage on the node of the allocating thread, or on
+    //the given node
+    PlacedAllocator ();
+    PlacedAllocator (const int& node);
+    template <class U>
+    PlacedAllocator (const PlacedAllocator <U>& other);
+
+    T* allocate (const std::size_t& size);
+    void deallocate (T* pointer, const std::size_t& size);
+
+    int node () const;
+
+private:
+    int node_;
+
+};
+
+template <class T>
+using PlacedVector = std::vector <T, PlacedAllocator <T>>;
+
+template <class T, class U>
+bool operator== (const PlacedAllocator <T>&, const PlacedAllocator <U>&);
+template <class T, class U>
+bool operator!= (const PlacedAllocator <T>&, const PlacedAllocator <U>&);
+
+//---TEMPLATE MEMBER DEFINITIONS---
+
+//Constructor: node of the allocating thread
+template <class T>
+PlacedAllocator <T>::PlacedAllocator () : node_ (-1) {}
+
+//Constructor: fixed node
+template <class T>
+PlacedAllocator <T>::PlacedAllocator (const int& node) : node_ (node) {}
+
+//Constructor: rebind
+template <class T>
+template <class U>
+PlacedAllocator <T>::PlacedAllocator (const PlacedAllocator <U>& other)
+    : node_ (other.node ()) {}
+
+//Allocate storage for 'size' elements
+template <class T>
+T* PlacedAllocator <T>::allocate (const std::size_t& size)
+{
+    return static_cast <T*> (allocatePlaced (size * sizeof (T), node_));
+}
+
+//Free storage
+template <class T>
+void PlacedAllocator <T>::deallocate (T* pointer, const std::size_t& size)
+{
+    deallocatePlaced (pointer, size * sizeof (T));
+}
+
+//Node, -1 for the node of the allocating thread
+template <class T>
+int PlacedAllocator <T>::node () const
+{
+    return node_;
+}
+
+template <class T, class U>
+bool operator== (const PlacedAllocator <T>&, const PlacedAllocator <U>&)
+{
+    return true;
+}
+
+template <class T, class U>
+bool operator!= (const PlacedAllocator <T>&, const PlacedAllocator <U>&)
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,57 @@
+// Merge tool for shard results of sharded integration runs
+//
+// Usage: nlo4d_merge.out <merged output> <shard file> [<shard file> ...]
+
+#include <cmath>
+#include <complex>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "definitions.h"
+#include "integration.h"
+
+int main (int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        std::cout << "Usage: " << argv[0]
+            << " <merged output> <shard file> [<shard file> ...]\n";
+        return 1;
+    }
+
+    std::vector <ShardResult> results;
+    for (int i = 2; i < argc; i++)
+    {
+        ShardResult result;
+        if (!readShardResult (argv[i], result))
+        {
+            return 1;
+        }
+        results.push_back (result);
+    }
+
+    unsigned int numberOfMerged = 0;
+    ShardResult merged = mergeShardResults (results, &numberOfMerged);
+    if (!writeShardResult (argv[1], merged))
+    {
+        return 1;
+    }
+
+    std::cout << "Merged " << numberOfMerged << " of " << results.size ()
+        << " shards of iteration " << merged.iteration_ << ": "
+        << merged.numberOfPoints_ << " points";
+
+    //An error estimate needs at least two points
+    real_t n = merged.numberOfPoints_;
+    if (n > 1)
+    {
+        real_t mean = merged.sum_ / n;
+        real_t error = sqrt ((merged.sumOfSquares_ / n - mean * mean)
+                             / (n - 1));
+        std::cout << ", integral " << mean << " +- " << error;
+    }
+    std::cout << "\n";
+
+    return 0;
+}
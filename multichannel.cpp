@@ -0,0 +1,560 @@
+/*
+    Multi-channel phase space sampling for 2 -> n - 2 scattering in phi^3
+    theory. Every s-channel propagator topology of the amplitude, i.e.
+    every binary decay tree of the final state, is one channel. Channels
+    generate the invariant masses of their propagators with Breit-Wigner
+    or power-law importance sampling followed by isotropic two-body
+    decays. Channel weights are adapted during the run (Kleiss-Pittau).
+*/
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <iostream>
+#include <vector>
+
+#include "definitions.h"
+#include "fourvector.h"
+#include "multichannel.h"
+
+namespace
+{
+    const real_t pi = std::acos (-1.0);
+
+    //Kallen function
+    real_t kallen (const real_t& a, const real_t& b, const real_t& c)
+    {
+        real_t value = a * a + b * b + c * c - 2 * (a * b + a * c + b * c);
+        return (value > 0) ? value : 0;
+    }
+
+    //Map a uniform number to an invariant in [lower, upper], the density
+    //of the invariant is returned in 'density'
+    real_t mapInvariant (const InvariantMapping& mapping,
+                         const real_t& lower, const real_t& upper,
+                         const real_t& random, real_t& density)
+    {
+        if (mapping.width_ > 0)
+        {
+            real_t mass2 = mapping.mass_ * mapping.mass_;
+            real_t massWidth = mapping.mass_ * mapping.width_;
+            real_t yLower = std::atan ((lower - mass2) / massWidth);
+            real_t yUpper = std::atan ((upper - mass2) / massWidth);
+            real_t s = mass2 + massWidth
+                     * std::tan (yLower + random * (yUpper - yLower));
+            density = massWidth / (((s - mass2) * (s - mass2)
+                      + massWidth * massWidth) * (yUpper - yLower));
+            return s;
+        }
+
+        real_t tLower = lower + mapping.cutoff_;
+        real_t tUpper = upper + mapping.cutoff_;
+        real_t t;
+        if (mapping.exponent_ == 1)
+        {
+            real_t range = std::log (tUpper / tLower);
+            t = tLower * std::exp (random * range);
+            density = 1 / (t * range);
+        }
+        else
+        {
+            real_t power = 1 - mapping.exponent_;
+            real_t fLower = std::pow (tLower, power);
+            real_t fUpper = std::pow (tUpper, power);
+            t = std::pow (fLower + random * (fUpper - fLower), 1 / power);
+            density = power * std::pow (t, - mapping.exponent_)
+                    / (fUpper - fLower);
+        }
+
+        return t - mapping.cutoff_;
+    }
+
+    //Density of the mapping at the invariant s
+    real_t invariantDensity (const InvariantMapping& mapping,
+                             const real_t& lower, const real_t& upper,
+                             const real_t& s)
+    {
+        if (mapping.width_ > 0)
+        {
+            real_t mass2 = mapping.mass_ * mapping.mass_;
+            real_t massWidth = mapping.mass_ * mapping.width_;
+            real_t yLower = std::atan ((lower - mass2) / massWidth);
+            real_t yUpper = std::atan ((upper - mass2) / massWidth);
+            return massWidth / (((s - mass2) * (s - mass2)
+                   + massWidth * massWidth) * (yUpper - yLower));
+        }
+
+        real_t tLower = lower + mapping.cutoff_;
+        real_t tUpper = upper + mapping.cutoff_;
+        real_t t = s + mapping.cutoff_;
+        if (mapping.exponent_ == 1)
+        {
+            return 1 / (t * std::log (tUpper / tLower));
+        }
+
+        real_t power = 1 - mapping.exponent_;
+        return power * std::pow (t, - mapping.exponent_)
+             / (std::pow (tUpper, power) - std::pow (tLower, power));
+    }
+
+    //Densities of all channels are evaluated for every event, so the
+    //number of channels (2k - 3)!! for k final legs is limited
+    const unsigned long long maximumChannels = 1 << 14;
+
+    //Number of legs in a subset
+    unsigned int subsetSize (const unsigned int& subset)
+    {
+        return __builtin_popcount (subset);
+    }
+}
+
+//Constructor
+MultiChannelSampler::MultiChannelSampler (const unsigned int& numberOfLegs,
+                                          const real_t& energy,
+                                          const real_t& externalMass,
+                                          const InvariantMapping& mapping)
+    : lastBatchSize_ (0), numberOfLegs_ (numberOfLegs),
+      numberOfFinal_ (numberOfLegs - 2), energy_ (energy),
+      externalMass_ (externalMass), mapping_ (mapping)
+{
+    if (numberOfLegs < 4)
+    {
+        std::cout << "Error: multi-channel sampling needs at least 4 legs\n";
+        return;
+    }
+
+    unsigned long long numberOfChannels = 1;
+    for (unsigned int k = 3; k <= numberOfFinal_; k++)
+    {
+        numberOfChannels *= 2 * k - 3;
+        if (numberOfChannels > maximumChannels)
+        {
+            std::cout << "Error: " << numberOfFinal_ << " final legs give "
+                << "more than " << maximumChannels << " channels\n";
+            return;
+        }
+    }
+
+    channels_ = decayTrees ((1u << numberOfFinal_) - 1);
+    channelWeights_.assign (channels_.size (), 1.0 / channels_.size ());
+    varianceSums_.assign (channels_.size (), 0);
+
+    eventMomenta_.resize (1u << numberOfFinal_);
+    eventMasses_.resize (1u << numberOfFinal_);
+}
+
+//All decay trees of a subset in top-down order, a split is counted once
+//by keeping the lowest leg in the first part
+std::vector <std::vector <ChannelNode>> MultiChannelSampler::decayTrees
+    (const unsigned int& subset) const
+{
+    std::vector <std::vector <ChannelNode>> trees;
+    if (subsetSize (subset) == 1)
+    {
+        trees.push_back (std::vector <ChannelNode> ());
+        return trees;
+    }
+
+    unsigned int lowest = subset & (~subset + 1);
+    for (unsigned int first = (subset - 1) & subset; first != 0;
+         first = (first - 1) & subset)
+    {
+        if ((first & lowest) == 0)
+        {
+            continue;
+        }
+
+        unsigned int second = subset ^ first;
+        std::vector <std::vector <ChannelNode>> firstTrees
+            = decayTrees (first);
+        std::vector <std::vector <ChannelNode>> secondTrees
+            = decayTrees (second);
+
+        for (auto& firstTree : firstTrees)
+        {
+            for (auto& secondTree : secondTrees)
+            {
+                std::vector <ChannelNode> tree;
+                tree.push_back ({subset, first, second});
+                tree.insert (tree.end (), firstTree.begin (),
+                             firstTree.end ());
+                tree.insert (tree.end (), secondTree.begin (),
+                             secondTree.end ());
+                trees.push_back (tree);
+            }
+        }
+    }
+
+    return trees;
+}
+
+//Lightest invariant mass of a subset
+real_t MultiChannelSampler::minimumMass (const unsigned int& subset) const
+{
+    return subsetSize (subset) * externalMass_;
+}
+
+//Channel choice, n - 4 invariants and 2 angles for each of the n - 3
+//decays
+unsigned int MultiChannelSampler::dimension () const
+{
+    if (channels_.empty ())
+    {
+        return 0;
+    }
+
+    return 1 + (numberOfFinal_ - 2) + 2 * (numberOfFinal_ - 1);
+}
+
+unsigned int MultiChannelSampler::numberOfChannels () const
+{
+    return channels_.size ();
+}
+
+//Generate one event of a channel
+void MultiChannelSampler::generateEvent (const real_t* random,
+                                         const unsigned int& channel,
+                                         real_t* momenta,
+                                         const unsigned int& stride,
+                                         const unsigned int& event)
+{
+    const unsigned int root = (1u << numberOfFinal_) - 1;
+    std::vector <FourVector <real_t>>& momentum = eventMomenta_;
+    std::vector <real_t>& mass = eventMasses_;
+    real_t density;
+
+    momentum[root] = FourVector <real_t> (energy_, 0, 0, 0);
+    mass[root] = energy_;
+
+    unsigned int r = 0;
+    for (auto& node : channels_[channel])
+    {
+        const unsigned int first = node.first_;
+        const unsigned int second = node.second_;
+        const real_t parentMass = mass[node.subset_];
+
+        //Invariant masses of the daughters, the first one is sampled in
+        //the full range left by the lightest second daughter
+        if (subsetSize (first) == 1)
+        {
+            mass[first] = externalMass_;
+        }
+        else
+        {
+            real_t upper = parentMass - minimumMass (second);
+            real_t lower = minimumMass (first);
+            mass[first] = std::sqrt (mapInvariant
+                (mapping_, lower * lower, upper * upper, random[r++],
+                 density));
+        }
+
+        if (subsetSize (second) == 1)
+        {
+            mass[second] = externalMass_;
+        }
+        else
+        {
+            real_t upper = parentMass - mass[first];
+            real_t lower = minimumMass (second);
+            mass[second] = std::sqrt (mapInvariant
+                (mapping_, lower * lower, upper * upper, random[r++],
+                 density));
+        }
+
+        //Isotropic two-body decay in the rest frame of the parent
+        real_t parent2 = parentMass * parentMass;
+        real_t first2 = mass[first] * mass[first];
+        real_t second2 = mass[second] * mass[second];
+        real_t p = std::sqrt (kallen (parent2, first2, second2))
+                 / (2 * parentMass);
+        real_t cosTheta = 2 * random[r++] - 1;
+        real_t sinTheta = std::sqrt (std::max (1 - cosTheta * cosTheta, 0.0));
+        real_t phi = 2 * pi * random[r++];
+
+        real_t px = p * sinTheta * std::cos (phi);
+        real_t py = p * sinTheta * std::sin (phi);
+        real_t pz = p * cosTheta;
+        FourVector <real_t> firstRest (std::sqrt (p * p + first2),
+                                       px, py, pz);
+        FourVector <real_t> secondRest (std::sqrt (p * p + second2),
+                                        - px, - py, - pz);
+
+        momentum[first] = boostFromRestFrame (firstRest,
+                                              momentum[node.subset_]);
+        momentum[second] = boostFromRestFrame (secondRest,
+                                               momentum[node.subset_]);
+    }
+
+    //Incoming momenta enter with a minus sign
+    real_t beam = energy_ / 2;
+    real_t incoming[2][4] = {{- beam, 0, 0, - beam}, {- beam, 0, 0, beam}};
+    for (unsigned int leg = 0; leg < 2; leg++)
+    {
+        for (unsigned int c = 0; c < 4; c++)
+        {
+            momenta[(leg * 4 + c) * stride + event] = incoming[leg][c];
+        }
+    }
+
+    for (unsigned int leg = 0; leg < numberOfFinal_; leg++)
+    {
+        for (unsigned int c = 0; c < 4; c++)
+        {
+            momenta[((leg + 2) * 4 + c) * stride + event]
+                = momentum[1u << leg] (c);
+        }
+    }
+}
+
+//Generate a batch of events
+void MultiChannelSampler::generate (const real_t* random,
+                                    const unsigned int& batchSize,
+                                    real_t* momenta,
+                                    const unsigned int& stride,
+                                    real_t* weights)
+{
+    const unsigned int d = dimension ();
+    const unsigned int numberOfChannels = channels_.size ();
+
+    if (numberOfChannels == 0)
+    {
+        std::cout << "Error: sampler without channels\n";
+        std::fill (weights, weights + batchSize, 0);
+        return;
+    }
+
+    for (unsigned int event = 0; event < batchSize; event++)
+    {
+        //Channel from the cumulative channel weights
+        const real_t* eventRandom = random + event * d;
+        unsigned int channel = 0;
+        real_t cumulative = channelWeights_[0];
+        while (channel + 1 < numberOfChannels && eventRandom[0] >= cumulative)
+        {
+            channel++;
+            cumulative += channelWeights_[channel];
+        }
+
+        generateEvent (eventRandom + 1, channel, momenta, stride, event);
+    }
+
+    //Weight from the densities of all channels
+    densities_.resize (numberOfChannels * batchSize);
+    totalDensities_.assign (batchSize, 0);
+    densities (momenta, stride, batchSize, densities_.data ());
+
+    for (unsigned int c = 0; c < numberOfChannels; c++)
+    {
+        const real_t alpha = channelWeights_[c];
+        const real_t* channelDensities = densities_.data () + c * batchSize;
+        for (unsigned int event = 0; event < batchSize; event++)
+        {
+            totalDensities_[event] += alpha * channelDensities[event];
+        }
+    }
+
+    for (unsigned int event = 0; event < batchSize; event++)
+    {
+        weights[event] = 1 / totalDensities_[event];
+    }
+
+    lastBatchSize_ = batchSize;
+}
+
+//Densities of all channels, evaluated channel by channel and node by node
+//across the batch
+void MultiChannelSampler::densities (const real_t* momenta,
+                                     const unsigned int& stride,
+                                     const unsigned int& batchSize,
+                                     real_t* densities)
+{
+    if (channels_.empty ())
+    {
+        return;
+    }
+
+    const unsigned int numberOfSubsets = 1u << numberOfFinal_;
+    const unsigned int b = batchSize;
+
+    //Momentum sums of all final state subsets, each from a smaller subset
+    //and its highest leg
+    subsetMomenta_.resize (4 * numberOfSubsets * b);
+    invariants_.resize (numberOfSubsets * b);
+    for (unsigned int subset = 1; subset < numberOfSubsets; subset++)
+    {
+        unsigned int highest = 0;
+        while ((subset >> (highest + 1)) != 0)
+        {
+            highest++;
+        }
+        unsigned int rest = subset ^ (1u << highest);
+
+        real_t* sum = subsetMomenta_.data () + 4 * subset * b;
+        const real_t* restSum = subsetMomenta_.data () + 4 * rest * b;
+        for (unsigned int c = 0; c < 4; c++)
+        {
+            const real_t* leg = momenta + ((highest + 2) * 4 + c) * stride;
+            for (unsigned int event = 0; event < b; event++)
+            {
+                sum[c * b + event] = leg[event]
+                    + ((rest != 0) ? restSum[c * b + event] : 0);
+            }
+        }
+
+        real_t* s = invariants_.data () + subset * b;
+        for (unsigned int event = 0; event < b; event++)
+        {
+            s[event] = sum[event] * sum[event]
+                     - sum[b + event] * sum[b + event]
+                     - sum[2 * b + event] * sum[2 * b + event]
+                     - sum[3 * b + event] * sum[3 * b + event];
+        }
+    }
+
+    //Masses of single legs and of the initial state are fixed
+    for (unsigned int leg = 0; leg < numberOfFinal_; leg++)
+    {
+        real_t* s = invariants_.data () + (1u << leg) * b;
+        std::fill (s, s + b, externalMass_ * externalMass_);
+    }
+    real_t* rootInvariant = invariants_.data () + (numberOfSubsets - 1) * b;
+    std::fill (rootInvariant, rootInvariant + b, energy_ * energy_);
+
+    //g_c: inverse two-body phase space of every decay times the density
+    //of every sampled invariant
+    for (unsigned int channel = 0; channel < channels_.size (); channel++)
+    {
+        real_t* g = densities + channel * b;
+        std::fill (g, g + b, 1.0);
+
+        for (auto& node : channels_[channel])
+        {
+            const real_t* parent = invariants_.data () + node.subset_ * b;
+            const real_t* first = invariants_.data () + node.first_ * b;
+            const real_t* second = invariants_.data () + node.second_ * b;
+            const bool sampleFirst = subsetSize (node.first_) > 1;
+            const bool sampleSecond = subsetSize (node.second_) > 1;
+            const real_t minimumFirst = minimumMass (node.first_);
+            const real_t minimumSecond = minimumMass (node.second_);
+
+            for (unsigned int event = 0; event < b; event++)
+            {
+                real_t lambda = kallen (parent[event], first[event],
+                                        second[event]);
+                real_t factor = 8 * pi * parent[event] / std::sqrt (lambda);
+
+                real_t parentMass = std::sqrt (parent[event]);
+                if (sampleFirst)
+                {
+                    real_t upper = parentMass - minimumSecond;
+                    factor *= 2 * pi * invariantDensity
+                        (mapping_, minimumFirst * minimumFirst,
+                         upper * upper, first[event]);
+                }
+                if (sampleSecond)
+                {
+                    real_t upper = parentMass - std::sqrt (first[event]);
+                    factor *= 2 * pi * invariantDensity
+                        (mapping_, minimumSecond * minimumSecond,
+                         upper * upper, second[event]);
+                }
+
+                g[event] *= factor;
+            }
+        }
+    }
+}
+
+//Accumulate W_c = <g_c / g * w^2> with w = f / g
+void MultiChannelSampler::addIntegrand (const real_t* values,
+                                        const unsigned int& batchSize)
+{
+    if (batchSize != lastBatchSize_)
+    {
+        std::cout << "Error: integrand values do not match the last batch\n";
+        return;
+    }
+
+    for (unsigned int c = 0; c < channels_.size (); c++)
+    {
+        const real_t* channelDensities = densities_.data () + c * batchSize;
+        real_t sum = 0;
+        for (unsigned int event = 0; event < batchSize; event++)
+        {
+            real_t w = values[event] / totalDensities_[event];
+            sum += channelDensities[event] / totalDensities_[event] * w * w;
+        }
+        varianceSums_[c] += sum;
+    }
+}
+
+//New channel weights alpha_c ~ alpha_c * W_c^exponent
+void MultiChannelSampler::adapt (const real_t& exponent,
+                                 const real_t& minimumWeight)
+{
+    const unsigned int numberOfChannels = channels_.size ();
+    real_t sum = 0;
+    for (unsigned int c = 0; c < numberOfChannels; c++)
+    {
+        channelWeights_[c] *= std::pow (varianceSums_[c], exponent);
+        sum += channelWeights_[c];
+    }
+
+    if (numberOfChannels == 0)
+    {
+        return;
+    }
+    if (sum <= 0)
+    {
+        std::cout << "Error: no integrand values to adapt channel weights\n";
+        channelWeights_.assign (numberOfChannels, 1.0 / numberOfChannels);
+        return;
+    }
+
+    //Keep every channel alive, then normalize again
+    real_t floor = minimumWeight / numberOfChannels;
+    real_t total = 0;
+    for (unsigned int c = 0; c < numberOfChannels; c++)
+    {
+        channelWeights_[c] = std::max (channelWeights_[c] / sum, floor);
+        total += channelWeights_[c];
+    }
+    for (unsigned int c = 0; c < numberOfChannels; c++)
+    {
+        channelWeights_[c] /= total;
+        varianceSums_[c] = 0;
+    }
+}
+
+//Getters
+const std::vector <real_t>& MultiChannelSampler::channelWeights () const
+{
+    return channelWeights_;
+}
+
+const std::vector <ChannelNode>& MultiChannelSampler::channel
+    (const unsigned int& c) const
+{
+    return channels_[c];
+}
+
+//Set channel weights, normalized to one
+void MultiChannelSampler::setChannelWeights
+    (const std::vector <real_t>& weights)
+{
+    if (weights.size () != channels_.size ())
+    {
+        std::cout << "Error: expected " << channels_.size ()
+            << " channel weights\n";
+        return;
+    }
+
+    real_t sum = 0;
+    for (auto weight : weights)
+    {
+        sum += weight;
+    }
+    for (unsigned int c = 0; c < weights.size (); c++)
+    {
+        channelWeights_[c] = weights[c] / sum;
+    }
+}
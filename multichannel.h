@@ -0,0 +1,115 @@
+/*
+    Multi-channel phase space sampling for 2 -> n - 2 scattering in phi^3
+    theory. Every s-channel propagator topology of the amplitude, i.e.
+    every binary decay tree of the final state, is one channel. Channels
+    generate the invariant masses of their propagators with Breit-Wigner
+    or power-law importance sampling followed by isotropic two-body
+    decays. Channel weights are adapted during the run (Kleiss-Pittau).
+*/
+
+#ifndef MULTI_CHANNEL
+#define MULTI_CHANNEL
+
+#include <complex>
+#include <vector>
+
+#include "definitions.h"
+#include "fourvector.h"
+
+//Importance sampling of the invariant of a propagator: Breit-Wigner
+//in mass_ and width_ if the width is positive, otherwise the power law
+//(s + cutoff_)^-exponent_
+struct InvariantMapping
+{
+    real_t mass_;
+    real_t width_;
+    real_t exponent_;
+    real_t cutoff_;
+};
+
+//Internal node of a decay tree, subsets are bitmasks of final legs
+struct ChannelNode
+{
+    unsigned int subset_;
+    unsigned int first_;
+    unsigned int second_;
+};
+
+class MultiChannelSampler
+{
+public:
+    //Constructor: legs 0 and 1 collide along the z axis with total
+    //energy 'energy', legs 2 to n - 1 are produced with 'externalMass'.
+    //Without any channel, for fewer than 4 legs or more than 2^14
+    //channels, the sampler has dimension 0 and generates zero weights.
+    MultiChannelSampler (const unsigned int& numberOfLegs,
+                         const real_t& energy, const real_t& externalMass,
+                         const InvariantMapping& mapping);
+
+    //Random numbers per event, the first one selects the channel
+    unsigned int dimension () const;
+    unsigned int numberOfChannels () const;
+
+    //Generate a batch of events
+    //random:  random[event * dimension () + i], uniform in [0,1)
+    //momenta: momenta[(leg * 4 + component) * stride + event], all legs
+    //         outgoing, i.e. incoming momenta enter with a minus sign
+    //weights: phase space weight 1 / sum_c alpha_c g_c
+    void generate (const real_t* random, const unsigned int& batchSize,
+                   real_t* momenta, const unsigned int& stride,
+                   real_t* weights);
+
+    //Densities of all channels with respect to the phase space measure,
+    //densities[channel * batchSize + event]
+    void densities (const real_t* momenta, const unsigned int& stride,
+                    const unsigned int& batchSize, real_t* densities);
+
+    //Add integrand values of the last generated batch to the estimate
+    //of the channel weight variances
+    void addIntegrand (const real_t* values, const unsigned int& batchSize);
+    //New channel weights alpha_c ~ alpha_c * W_c^exponent, with alpha_c
+    //kept above minimumWeight / numberOfChannels
+    void adapt (const real_t& exponent = 0.5,
+                const real_t& minimumWeight = 1e-2);
+
+    //Getters
+    const std::vector <real_t>& channelWeights () const;
+    const std::vector <ChannelNode>& channel (const unsigned int& c) const;
+    void setChannelWeights (const std::vector <real_t>& weights);
+
+private:
+    //Generate one event of a channel
+    void generateEvent (const real_t* random, const unsigned int& channel,
+                        real_t* momenta, const unsigned int& stride,
+                        const unsigned int& event);
+    //All decay trees of a subset of final legs
+    std::vector <std::vector <ChannelNode>> decayTrees
+        (const unsigned int& subset) const;
+    //Lightest invariant mass of a subset
+    real_t minimumMass (const unsigned int& subset) const;
+
+    //Channels and their weights
+    std::vector <std::vector <ChannelNode>> channels_;
+    std::vector <real_t> channelWeights_;
+    //Sum of g_c / g * w^2 over the added events
+    std::vector <real_t> varianceSums_;
+
+    //Buffers of the last batch
+    std::vector <real_t> densities_;
+    std::vector <real_t> totalDensities_;
+    std::vector <real_t> invariants_;
+    std::vector <real_t> subsetMomenta_;
+    std::vector <FourVector <real_t>> eventMomenta_;
+    std::vector <real_t> eventMasses_;
+    unsigned int lastBatchSize_;
+
+    //Parameters
+    const unsigned int numberOfLegs_;
+    const unsigned int numberOfFinal_;
+    const real_t energy_;
+    const real_t externalMass_;
+    const InvariantMapping mapping_;
+
+};
+
+#endif
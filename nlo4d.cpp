@@ -0,0 +1,117 @@
+/*
+    C interface for Fortran and C event generators, see nlo4d.h.
+*/
+#include <complex>
+#include <iostream>
+
+#include "definitions.h"
+#include "evaluationtape.h"
+#include "nlo4d.h"
+#include "scalaramplitude.h"
+
+//Handle, opaque to C
+struct nlo4d_amplitude
+{
+    nlo4d_amplitude (const int& numberOfLegs, const real_t& coupling,
+                     const real_t& mass)
+        : amplitude_ (mass == 0
+                      ? ScalarTreeAmplitude (numberOfLegs, coupling)
+                      : ScalarTreeAmplitude (numberOfLegs, coupling, mass)),
+          numberOfLegs_ (numberOfLegs) {}
+
+    ScalarTreeAmplitude amplitude_;
+    const int numberOfLegs_;
+};
+
+//Complex results are written in place, std::complex <double> is laid
+//out as two doubles
+static_assert (sizeof (complex_t) == 2 * sizeof (double),
+               "complex_t must be layout compatible with double[2]");
+
+//Create handle
+nlo4d_amplitude* nlo4d_amplitude_create (int number_of_legs,
+                                         double coupling, double mass)
+{
+    //The tape holds about 3^(n - 1) / 2 splittings, beyond 16 legs it
+    //does not fit into memory
+    if (number_of_legs < 3 || number_of_legs > 16)
+    {
+        std::cout << "Error: number of legs " << number_of_legs
+            << " out of range\n";
+        return nullptr;
+    }
+
+    //No exception may leave the C interface
+    try
+    {
+        return new nlo4d_amplitude (number_of_legs, coupling, mass);
+    }
+    catch (...)
+    {
+        std::cout << "Error: amplitude for " << number_of_legs
+            << " legs could not be created\n";
+        return nullptr;
+    }
+}
+
+//Destroy handle
+void nlo4d_amplitude_destroy (nlo4d_amplitude* amplitude)
+{
+    delete amplitude;
+}
+
+//Evaluate a batch in a predefined layout
+int nlo4d_amplitude_evaluate (nlo4d_amplitude* amplitude,
+                              const double* momenta, int batch_size,
+                              int layout, double* results)
+{
+    if (amplitude == nullptr)
+    {
+        std::cout << "Error: invalid amplitude handle\n";
+        return 0;
+    }
+
+    switch (layout)
+    {
+        case NLO4D_LAYOUT_AOS:
+            return nlo4d_amplitude_evaluate_strided
+                (amplitude, momenta, batch_size, 1,
+                 4 * amplitude->numberOfLegs_, results);
+        case NLO4D_LAYOUT_SOA:
+            return nlo4d_amplitude_evaluate_strided
+                (amplitude, momenta, batch_size, batch_size, 1, results);
+    }
+
+    std::cout << "Error: unknown layout " << layout << "\n";
+    return 0;
+}
+
+//Evaluate a batch with arbitrary strides
+int nlo4d_amplitude_evaluate_strided (nlo4d_amplitude* amplitude,
+                                      const double* momenta, int batch_size,
+                                      int entry_stride, int event_stride,
+                                      double* results)
+{
+    if (amplitude == nullptr || momenta == nullptr || results == nullptr
+        || batch_size < 0 || entry_stride < 0 || event_stride < 0)
+    {
+        std::cout << "Error: invalid arguments of amplitude evaluation\n";
+        return 0;
+    }
+
+    TapeLayout layout = {(unsigned int) entry_stride,
+                         (unsigned int) event_stride};
+    try
+    {
+        amplitude->amplitude_.amplitude
+            (momenta, batch_size, layout,
+             reinterpret_cast <complex_t*> (results));
+    }
+    catch (...)
+    {
+        std::cout << "Error: amplitude evaluation failed\n";
+        return 0;
+    }
+
+    return 1;
+}
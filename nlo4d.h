@@ -0,0 +1,57 @@
+/*
+    C interface for Fortran and C event generators. Amplitudes are
+    evaluated for a batch of events read directly from a caller-owned
+    array of doubles into a caller-owned result array, without copies.
+    A handle keeps its workspace, so it must not be shared between
+    threads; create one handle per thread instead.
+
+    Momenta of an event are read at
+        momenta[(leg * 4 + component) * entry_stride + event * event_stride]
+    for the first number_of_legs - 1 legs, the last leg follows from
+    momentum conservation. Results are written as (real, imaginary)
+    pairs, i.e. results[2 * event] and results[2 * event + 1].
+
+    From Fortran, bind to the functions with bind(C) and pass scalars
+    with the value attribute; a momenta array p(0:3, n, nevents) is
+    NLO4D_LAYOUT_AOS.
+*/
+
+#ifndef NLO4D_C_INTERFACE
+#define NLO4D_C_INTERFACE
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Predefined layouts */
+/* One event after the other: entry_stride 1,
+   event_stride 4 * number_of_legs */
+#define NLO4D_LAYOUT_AOS 0
+/* One component row after the other: entry_stride batch_size,
+   event_stride 1 */
+#define NLO4D_LAYOUT_SOA 1
+
+typedef struct nlo4d_amplitude nlo4d_amplitude;
+
+/* Create handle for 3 to 16 legs, NULL on failure */
+nlo4d_amplitude* nlo4d_amplitude_create (int number_of_legs,
+                                         double coupling, double mass);
+/* Destroy handle, NULL is ignored */
+void nlo4d_amplitude_destroy (nlo4d_amplitude* amplitude);
+
+/* Evaluate a batch in a predefined layout, returns 1 on success and
+   0 on invalid arguments or failed workspace allocation */
+int nlo4d_amplitude_evaluate (nlo4d_amplitude* amplitude,
+                              const double* momenta, int batch_size,
+                              int layout, double* results);
+/* Evaluate a batch with arbitrary strides, in units of doubles */
+int nlo4d_amplitude_evaluate_strided (nlo4d_amplitude* amplitude,
+                                      const double* momenta, int batch_size,
+                                      int entry_stride, int event_stride,
+                                      double* results);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,233 @@
+/*
+    Hardware performance counters around measured regions, read through
+    the Linux perf_event_open interface. Counters that cannot be opened
+    (no PMU, restrictive perf_event_paranoid, other platforms) are
+    reported as unavailable and the measurement goes on without them.
+*/
+#include <algorithm>
+#include <complex>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "definitions.h"
+#include "perfcounters.h"
+
+namespace
+{
+    const char* counterName (const unsigned int& counter)
+    {
+        switch (static_cast <HardwareCounter> (counter))
+        {
+            case HardwareCounter::CYCLES:
+                return "cycles";
+            case HardwareCounter::INSTRUCTIONS:
+                return "instructions";
+            case HardwareCounter::L1_MISSES:
+                return "L1 misses";
+            case HardwareCounter::LLC_MISSES:
+                return "LLC misses";
+            case HardwareCounter::BRANCH_MISSES:
+                return "branch misses";
+        }
+
+        return "unknown";
+    }
+
+#ifdef __linux__
+    //Open one counter of the calling thread in the group of 'leader',
+    //as the leader of a new group if it is -1. -1 on failure.
+    int openCounter (const unsigned int& counter, const int& leader)
+    {
+        perf_event_attr attribute;
+        std::memset (&attribute, 0, sizeof (attribute));
+        attribute.size = sizeof (attribute);
+        //Members follow the leader, which is enabled per region
+        attribute.disabled = (leader < 0) ? 1 : 0;
+        attribute.exclude_kernel = 1;
+        attribute.exclude_hv = 1;
+        attribute.read_format = PERF_FORMAT_GROUP
+                              | PERF_FORMAT_TOTAL_TIME_ENABLED
+                              | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        switch (static_cast <HardwareCounter> (counter))
+        {
+            case HardwareCounter::CYCLES:
+                attribute.type = PERF_TYPE_HARDWARE;
+                attribute.config = PERF_COUNT_HW_CPU_CYCLES;
+                break;
+            case HardwareCounter::INSTRUCTIONS:
+                attribute.type = PERF_TYPE_HARDWARE;
+                attribute.config = PERF_COUNT_HW_INSTRUCTIONS;
+                break;
+            case HardwareCounter::L1_MISSES:
+                attribute.type = PERF_TYPE_HW_CACHE;
+                attribute.config = PERF_COUNT_HW_CACHE_L1D
+                    | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                    | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+                break;
+            case HardwareCounter::LLC_MISSES:
+                attribute.type = PERF_TYPE_HARDWARE;
+                attribute.config = PERF_COUNT_HW_CACHE_MISSES;
+                break;
+            case HardwareCounter::BRANCH_MISSES:
+                attribute.type = PERF_TYPE_HARDWARE;
+                attribute.config = PERF_COUNT_HW_BRANCH_MISSES;
+                break;
+        }
+
+        return syscall (__NR_perf_event_open, &attribute, 0, -1, leader, 0);
+    }
+#endif
+}
+
+//Constructor
+PerformanceCounters::PerformanceCounters ()
+    : leader_ (-1)
+{
+    //One group led by the first counter that opens, cycles if possible,
+    //so that all counters cover the same instructions
+    for (unsigned int i = 0; i < NUMBER_OF_HARDWARE_COUNTERS; i++)
+    {
+#ifdef __linux__
+        descriptors_[i] = openCounter (i, leader_);
+#else
+        descriptors_[i] = -1;
+#endif
+        if (leader_ < 0)
+        {
+            leader_ = descriptors_[i];
+        }
+        values_[i] = 0;
+    }
+}
+
+//Destructor
+PerformanceCounters::~PerformanceCounters ()
+{
+#ifdef __linux__
+    for (unsigned int i = NUMBER_OF_HARDWARE_COUNTERS; i-- > 0;)
+    {
+        if (descriptors_[i] >= 0)
+        {
+            close (descriptors_[i]);
+        }
+    }
+#endif
+}
+
+//Start measured region
+void PerformanceCounters::start ()
+{
+#ifdef __linux__
+    if (leader_ >= 0)
+    {
+        ioctl (leader_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl (leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#endif
+}
+
+//Stop measured region and read counts
+void PerformanceCounters::stop ()
+{
+#ifdef __linux__
+    for (unsigned int i = 0; i < NUMBER_OF_HARDWARE_COUNTERS; i++)
+    {
+        values_[i] = 0;
+    }
+    if (leader_ < 0)
+    {
+        return;
+    }
+    ioctl (leader_, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    //Number of counters, time enabled, time running, then the counts in
+    //the order the counters were opened
+    unsigned long long data[3 + NUMBER_OF_HARDWARE_COUNTERS] = {};
+    ssize_t bytes = read (leader_, data, sizeof (data));
+    if (bytes < (ssize_t) (3 * sizeof (data[0])))
+    {
+        return;
+    }
+    const unsigned long long counters =
+        std::min <unsigned long long> (data[0], NUMBER_OF_HARDWARE_COUNTERS);
+
+    //Scale up if the group was multiplexed with other events
+    const real_t scale = (data[2] > 0 && data[2] < data[1])
+                       ? (real_t) data[1] / data[2] : 1;
+    unsigned int position = 0;
+    for (unsigned int i = 0; i < NUMBER_OF_HARDWARE_COUNTERS; i++)
+    {
+        if (descriptors_[i] >= 0 && position < counters)
+        {
+            values_[i] = scale * data[3 + position++];
+        }
+    }
+#endif
+}
+
+//Check availability
+bool PerformanceCounters::available () const
+{
+    for (unsigned int i = 0; i < NUMBER_OF_HARDWARE_COUNTERS; i++)
+    {
+        if (descriptors_[i] >= 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool PerformanceCounters::available (const HardwareCounter& counter) const
+{
+    return descriptors_[static_cast <unsigned int> (counter)] >= 0;
+}
+
+//Count of the last region
+real_t PerformanceCounters::value (const HardwareCounter& counter) const
+{
+    return values_[static_cast <unsigned int> (counter)];
+}
+
+//IPC and counts per operation of the last region
+void PerformanceCounters::print (std::ostream& out,
+                                 const unsigned long long& operations,
+                                 const std::string& unit) const
+{
+    if (!available ())
+    {
+        out << "Hardware counters not available\n";
+        return;
+    }
+
+    if (available (HardwareCounter::CYCLES)
+        && available (HardwareCounter::INSTRUCTIONS)
+        && value (HardwareCounter::CYCLES) > 0)
+    {
+        out << "IPC: " << value (HardwareCounter::INSTRUCTIONS)
+                          / value (HardwareCounter::CYCLES) << "\n";
+    }
+
+    for (unsigned int i = 0; i < NUMBER_OF_HARDWARE_COUNTERS; i++)
+    {
+        out << counterName (i) << " per " << unit << ": ";
+        if (descriptors_[i] < 0)
+        {
+            out << "n/a\n";
+        }
+        else
+        {
+            out << values_[i] / (operations > 0 ? operations : 1) << "\n";
+        }
+    }
+}
@@ -0,0 +1,63 @@
+/*
+    Hardware performance counters around measured regions, read through
+    the Linux perf_event_open interface. Counters that cannot be opened
+    (no PMU, restrictive perf_event_paranoid, other platforms) are
+    reported as unavailable and the measurement goes on without them.
+*/
+
+#ifndef PERF_COUNTERS
+#define PERF_COUNTERS
+
+#include <complex>
+#include <iostream>
+#include <string>
+
+#include "definitions.h"
+
+enum class HardwareCounter : unsigned char
+{
+    CYCLES,
+    INSTRUCTIONS,
+    //L1 data cache read misses
+    L1_MISSES,
+    //Last level cache misses
+    LLC_MISSES,
+    BRANCH_MISSES
+};
+
+const unsigned int NUMBER_OF_HARDWARE_COUNTERS = 5;
+
+class PerformanceCounters
+{
+public:
+    //Constructor: open all counters of the calling thread, user space only
+    PerformanceCounters ();
+    //Destructor: close counters
+    ~PerformanceCounters ();
+
+    PerformanceCounters (const PerformanceCounters&) = delete;
+    PerformanceCounters& operator = (const PerformanceCounters&) = delete;
+
+    //Measured region
+    void start ();
+    void stop ();
+
+    //True if at least one or the given counter could be opened
+    bool available () const;
+    bool available (const HardwareCounter& counter) const;
+    //Count of the last region, scaled if the group was multiplexed
+    real_t value (const HardwareCounter& counter) const;
+
+    //IPC and counts per operation of the last region
+    void print (std::ostream& out, const unsigned long long& operations,
+                const std::string& unit) const;
+
+private:
+    //Counters are read as one group through the first counter opened
+    int descriptors_[NUMBER_OF_HARDWARE_COUNTERS];
+    int leader_;
+    real_t values_[NUMBER_OF_HARDWARE_COUNTERS];
+
+};
+
+#endif
@@ -0,0 +1,301 @@
+/*
+    Staged event pipeline: generate -> cut -> evaluate -> accumulate.
+    Stages run on their own threads and exchange fixed-size event blocks
+    through bounded lock-free queues. Blocks are taken from and returned
+    to a preallocated pool, so nothing is allocated in steady state.
+    Optionally threads are pinned to NUMA nodes, with one pool of blocks
+    per node.
+*/
+#include <algorithm>
+#include <atomic>
+#include <complex>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "definitions.h"
+#include "memoryplacement.h"
+#include "pipeline.h"
+
+//---EVENT BLOCK---
+
+//Constructor
+EventBlock::EventBlock (const unsigned int& numberOfLegs,
+                        const unsigned int& capacity, const int& node)
+    : index_ (0), size_ (0), capacity_ (capacity),
+      numberOfLegs_ (numberOfLegs), node_ (node),
+      momenta_ (4 * numberOfLegs * capacity, 0,
+                PlacedAllocator <real_t> (node)),
+      weights_ (capacity, 0, PlacedAllocator <real_t> (node)),
+      amplitudes_ (capacity, 0, PlacedAllocator <complex_t> (node)) {}
+
+//Pointer to the row of a momentum component
+real_t* EventBlock::momentum (const unsigned int& leg,
+                              const unsigned int& component)
+{
+    return &momenta_[(4 * leg + component) * capacity_];
+}
+
+//---BLOCK QUEUE---
+
+//Constructor: only the queue in use gets its full capacity
+BlockQueue::BlockQueue (const unsigned int& capacity,
+                        const bool& singleThreaded)
+    : singleThreaded_ (singleThreaded),
+      spsc_ (singleThreaded ? capacity : 1),
+      mpmc_ (singleThreaded ? 1 : capacity) {}
+
+bool BlockQueue::push (EventBlock* const& block)
+{
+    return singleThreaded_ ? spsc_.push (block) : mpmc_.push (block);
+}
+
+bool BlockQueue::pop (EventBlock*& block)
+{
+    return singleThreaded_ ? spsc_.pop (block) : mpmc_.pop (block);
+}
+
+//---PIPELINE---
+
+//Constructor
+EventPipeline::EventPipeline (const PipelineConfiguration& configuration,
+                              const GenerateStage& generate,
+                              const BlockStage& cut,
+                              const BlockStage& evaluate,
+                              const BlockStage& accumulate)
+    : generate_ (generate), nextIndex_ (0), processed_ (0),
+      configuration_ (configuration)
+{
+    stages_[1] = cut;
+    stages_[2] = evaluate;
+    stages_[3] = accumulate;
+
+    for (unsigned int stage = 0; stage < 4; stage++)
+    {
+        active_[stage] = 0;
+        fullWaits_[stage] = 0;
+        emptyWaits_[stage] = 0;
+    }
+
+    //One pool per node of a generate thread if threads are pinned
+    unsigned int numberOfPools = 1;
+    if (configuration_.pinThreads_)
+    {
+        numberOfPools = std::min (numberOfNumaNodes (),
+                                  std::max (configuration_.threads_[0], 1u));
+    }
+    for (unsigned int pool = 0; pool < numberOfPools; pool++)
+    {
+        pools_.push_back (new BlockQueue (configuration_.numberOfBlocks_,
+                                          false));
+    }
+
+    //Preallocate all blocks, distributed over the nodes in turn
+    blocks_.reserve (configuration_.numberOfBlocks_);
+    for (unsigned int i = 0; i < configuration_.numberOfBlocks_; i++)
+    {
+        int node = configuration_.pinThreads_ ? i % numberOfPools : -1;
+        blocks_.emplace_back (configuration_.numberOfLegs_,
+                              configuration_.blockSize_, node);
+    }
+
+    //Reallocate the blocks of each node from a thread pinned to it, so
+    //their pages are first touched there
+    if (configuration_.pinThreads_)
+    {
+        std::vector <std::thread> threads;
+        for (unsigned int pool = 0; pool < numberOfPools; pool++)
+        {
+            threads.push_back (std::thread ([this, pool] ()
+            {
+                pinThreadToNode (pool);
+                for (auto& block : blocks_)
+                {
+                    if (block.node_ == (int) pool)
+                    {
+                        block = EventBlock (block.numberOfLegs_,
+                                            block.capacity_, block.node_);
+                    }
+                }
+            }));
+        }
+        for (auto& thread : threads)
+        {
+            thread.join ();
+        }
+    }
+
+    for (auto& block : blocks_)
+    {
+        pools_[std::max (block.node_, 0)]->push (&block);
+    }
+
+    //Queues between consecutive stages
+    for (unsigned int stage = 0; stage < 3; stage++)
+    {
+        bool singleThreaded = configuration_.threads_[stage] <= 1
+                           && configuration_.threads_[stage + 1] <= 1;
+        queues_.push_back (new BlockQueue (configuration_.queueCapacity_,
+                                           singleThreaded));
+    }
+}
+
+//Destructor
+EventPipeline::~EventPipeline ()
+{
+    for (auto queue : queues_)
+    {
+        delete queue;
+    }
+    for (auto pool : pools_)
+    {
+        delete pool;
+    }
+}
+
+//Run until every generate thread is done
+unsigned long long EventPipeline::run ()
+{
+    processed_ = 0;
+    nextIndex_ = 0;
+
+    std::vector <std::thread> threads;
+
+    for (unsigned int stage = 0; stage < 4; stage++)
+    {
+        unsigned int numberOfThreads =
+            std::max (configuration_.threads_[stage], 1u);
+
+        fullWaits_[stage] = 0;
+        emptyWaits_[stage] = 0;
+        active_[stage] = numberOfThreads;
+
+        for (unsigned int thread = 0; thread < numberOfThreads; thread++)
+        {
+            if (stage == 0)
+            {
+                threads.push_back (std::thread
+                    (&EventPipeline::generateLoop, this, thread));
+            }
+            else
+            {
+                threads.push_back (std::thread
+                    (&EventPipeline::stageLoop, this, stage, thread));
+            }
+        }
+    }
+
+    for (auto& thread : threads)
+    {
+        thread.join ();
+    }
+
+    return processed_;
+}
+
+//Generate loop: take blocks from the pool and fill them
+void EventPipeline::generateLoop (const unsigned int& thread)
+{
+    //Blocks come from the pool of the node of the thread
+    BlockQueue& pool = *pools_[thread % pools_.size ()];
+    if (configuration_.pinThreads_)
+    {
+        pinThreadToNode (thread % pools_.size ());
+    }
+
+    while (true)
+    {
+        EventBlock* block = nullptr;
+        while (!pool.pop (block))
+        {
+            emptyWaits_[0]++;
+            std::this_thread::yield ();
+        }
+
+        block->size_ = 0;
+        block->index_ = nextIndex_++;
+
+        if (!generate_ (*block, thread))
+        {
+            pool.push (block);
+            break;
+        }
+
+        pushBlock (*queues_[0], block, 0);
+    }
+
+    active_[0]--;
+}
+
+//Stage loop: process blocks until upstream is done and drained
+void EventPipeline::stageLoop (const unsigned int& stage,
+                               const unsigned int& thread)
+{
+    BlockQueue& input = *queues_[stage - 1];
+    if (configuration_.pinThreads_)
+    {
+        pinThreadToNode (thread % numberOfNumaNodes ());
+    }
+
+    while (true)
+    {
+        EventBlock* block = nullptr;
+
+        if (!input.pop (block))
+        {
+            //Upstream pushes happen before it is marked done
+            if (active_[stage - 1] == 0)
+            {
+                if (!input.pop (block))
+                {
+                    break;
+                }
+            }
+            else
+            {
+                emptyWaits_[stage]++;
+                std::this_thread::yield ();
+                continue;
+            }
+        }
+
+        if (stages_[stage])
+        {
+            stages_[stage] (*block, thread);
+        }
+
+        if (stage == 3)
+        {
+            processed_++;
+            pools_[std::max (block->node_, 0)]->push (block);
+        }
+        else
+        {
+            pushBlock (*queues_[stage], block, stage);
+        }
+    }
+
+    active_[stage]--;
+}
+
+//Push with back-pressure
+void EventPipeline::pushBlock (BlockQueue& queue, EventBlock* block,
+                               const unsigned int& stage)
+{
+    while (!queue.push (block))
+    {
+        fullWaits_[stage]++;
+        std::this_thread::yield ();
+    }
+}
+
+//Statistics of the last run
+unsigned long long EventPipeline::fullWaits (const unsigned int& stage) const
+{
+    return fullWaits_[stage];
+}
+
+unsigned long long EventPipeline::emptyWaits (const unsigned int& stage) const
+{
+    return emptyWaits_[stage];
+}
@@ -0,0 +1,326 @@
+/*
+    Staged event pipeline: generate -> cut -> evaluate -> accumulate.
+    Stages run on their own threads and exchange fixed-size event blocks
+    through bounded lock-free queues. Blocks are taken from and returned
+    to a preallocated pool, so nothing is allocated in steady state.
+    Optionally threads are pinned to NUMA nodes, with one pool of blocks
+    per node.
+*/
+
+#ifndef PIPELINE
+#define PIPELINE
+
+#include <atomic>
+#include <complex>
+#include <functional>
+#include <vector>
+
+#include "definitions.h"
+#include "memoryplacement.h"
+
+//Block of events in SoA layout
+struct EventBlock
+{
+    //Constructor: storage on the given NUMA node, -1 for the node of the
+    //constructing thread
+    EventBlock (const unsigned int& numberOfLegs,
+                const unsigned int& capacity, const int& node = -1);
+
+    //Pointer to the row of a momentum component
+    real_t* momentum (const unsigned int& leg, const unsigned int& component);
+
+    //Sequence number, assigned by the generate stage
+    unsigned long long index_;
+    //Number of filled events
+    unsigned int size_;
+    unsigned int capacity_;
+    unsigned int numberOfLegs_;
+    int node_;
+
+    //momenta_[(leg * 4 + component) * capacity_ + event]
+    PlacedVector <real_t> momenta_;
+    //Phase space weight, zero for events failing cuts
+    PlacedVector <real_t> weights_;
+    PlacedVector <complex_t> amplitudes_;
+};
+
+//Bounded single-producer single-consumer queue
+template <class T>
+class SpscQueue
+{
+public:
+    //Constructor: capacity is rounded up to a power of two
+    SpscQueue (const unsigned int& capacity);
+
+    //Return false if full or empty respectively
+    bool push (const T& value);
+    bool pop (T& value);
+
+private:
+    std::vector <T> buffer_;
+    unsigned int mask_;
+
+    //Producer and consumer positions on separate cache lines
+    char padding0_[64];
+    std::atomic <unsigned long long> head_;
+    char padding1_[64];
+    std::atomic <unsigned long long> tail_;
+    char padding2_[64];
+
+};
+
+//Bounded multi-producer multi-consumer queue with per-cell sequence
+//numbers (Vyukov)
+template <class T>
+class MpmcQueue
+{
+public:
+    //Constructor: capacity is rounded up to a power of two
+    MpmcQueue (const unsigned int& capacity);
+
+    //Return false if full or empty respectively
+    bool push (const T& value);
+    bool pop (T& value);
+
+private:
+    struct Cell
+    {
+        std::atomic <unsigned long long> sequence_;
+        T value_;
+    };
+
+    std::vector <Cell> buffer_;
+    unsigned int mask_;
+
+    char padding0_[64];
+    std::atomic <unsigned long long> head_;
+    char padding1_[64];
+    std::atomic <unsigned long long> tail_;
+    char padding2_[64];
+
+};
+
+//Queue between two stages, single-producer single-consumer when both
+//stages run on one thread
+class BlockQueue
+{
+public:
+    BlockQueue (const unsigned int& capacity, const bool& singleThreaded);
+
+    bool push (EventBlock* const& block);
+    bool pop (EventBlock*& block);
+
+private:
+    const bool singleThreaded_;
+    SpscQueue <EventBlock*> spsc_;
+    MpmcQueue <EventBlock*> mpmc_;
+
+};
+
+//Stage functions, called with the block and the index of the thread
+//within its stage. Generate returns false once no events are left.
+typedef std::function <bool (EventBlock&, const unsigned int&)> GenerateStage;
+typedef std::function <void (EventBlock&, const unsigned int&)> BlockStage;
+
+struct PipelineConfiguration
+{
+    unsigned int numberOfLegs_;
+    //Events per block
+    unsigned int blockSize_;
+    //Blocks in the pool, bounds the events in flight
+    unsigned int numberOfBlocks_;
+    //Capacity of each queue between stages
+    unsigned int queueCapacity_;
+    //Threads per stage: generate, cut, evaluate, accumulate
+    unsigned int threads_[4];
+    //Pin thread k of every stage to NUMA node k modulo the number of
+    //nodes. Blocks are split into one pool per node of a generate thread
+    //and first touched on their node. Only the generate stage is
+    //NUMA-local: later stages pop from queues shared by all nodes and
+    //may process a block placed on another node.
+    bool pinThreads_;
+};
+
+class EventPipeline
+{
+public:
+    //Constructor: a missing cut stage passes blocks through
+    EventPipeline (const PipelineConfiguration& configuration,
+                   const GenerateStage& generate, const BlockStage& cut,
+                   const BlockStage& evaluate, const BlockStage& accumulate);
+    //Destructor
+    ~EventPipeline ();
+
+    //Run until every generate thread is done, return number of blocks
+    unsigned long long run ();
+
+    //Times a stage found its output queue full (back-pressure) or its
+    //input queue empty, in the last run
+    unsigned long long fullWaits (const unsigned int& stage) const;
+    unsigned long long emptyWaits (const unsigned int& stage) const;
+
+private:
+    //Thread loops
+    void generateLoop (const unsigned int& thread);
+    void stageLoop (const unsigned int& stage, const unsigned int& thread);
+    //Push with back-pressure
+    void pushBlock (BlockQueue& queue, EventBlock* block,
+                    const unsigned int& stage);
+
+    //Stages
+    GenerateStage generate_;
+    BlockStage stages_[4];
+
+    //Blocks and queues
+    std::vector <EventBlock> blocks_;
+    std::vector <BlockQueue*> pools_;
+    std::vector <BlockQueue*> queues_;
+
+    //Running threads per stage
+    std::atomic <unsigned int> active_[4];
+    std::atomic <unsigned long long> nextIndex_;
+    std::atomic <unsigned long long> processed_;
+    std::atomic <unsigned long long> fullWaits_[4];
+    std::atomic <unsigned long long> emptyWaits_[4];
+
+    //Parameters
+    const PipelineConfiguration configuration_;
+
+};
+
+//---TEMPLATE MEMBER DEFINITIONS---
+
+//Round up to a power of two
+inline unsigned int powerOfTwoCapacity (const unsigned int& capacity)
+{
+    unsigned int result = 1;
+    while (result < capacity)
+    {
+        result *= 2;
+    }
+    return result;
+}
+
+//Constructor
+template <class T>
+SpscQueue <T>::SpscQueue (const unsigned int& capacity)
+    : buffer_ (powerOfTwoCapacity (capacity)),
+      mask_ (powerOfTwoCapacity (capacity) - 1), head_ (0), tail_ (0) {}
+
+//Push, producer side only
+template <class T>
+bool SpscQueue <T>::push (const T& value)
+{
+    unsigned long long tail = tail_.load (std::memory_order_relaxed);
+
+    if (tail - head_.load (std::memory_order_acquire) > mask_)
+    {
+        return false;
+    }
+
+    buffer_[tail & mask_] = value;
+    tail_.store (tail + 1, std::memory_order_release);
+
+    return true;
+}
+
+//Pop, consumer side only
+template <class T>
+bool SpscQueue <T>::pop (T& value)
+{
+    unsigned long long head = head_.load (std::memory_order_relaxed);
+
+    if (head == tail_.load (std::memory_order_acquire))
+    {
+        return false;
+    }
+
+    value = buffer_[head & mask_];
+    head_.store (head + 1, std::memory_order_release);
+
+    return true;
+}
+
+//Constructor
+template <class T>
+MpmcQueue <T>::MpmcQueue (const unsigned int& capacity)
+    : buffer_ (powerOfTwoCapacity (capacity)),
+      mask_ (powerOfTwoCapacity (capacity) - 1), head_ (0), tail_ (0)
+{
+    for (unsigned int i = 0; i <= mask_; i++)
+    {
+        buffer_[i].sequence_.store (i, std::memory_order_relaxed);
+    }
+}
+
+//Push
+template <class T>
+bool MpmcQueue <T>::push (const T& value)
+{
+    unsigned long long position = tail_.load (std::memory_order_relaxed);
+
+    while (true)
+    {
+        Cell& cell = buffer_[position & mask_];
+        unsigned long long sequence =
+            cell.sequence_.load (std::memory_order_acquire);
+        long long difference = (long long) sequence - (long long) position;
+
+        if (difference == 0)
+        {
+            if (tail_.compare_exchange_weak (position, position + 1,
+                                             std::memory_order_relaxed))
+            {
+                cell.value_ = value;
+                cell.sequence_.store (position + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (difference < 0)
+        {
+            return false;
+        }
+        else
+        {
+            position = tail_.load (std::memory_order_relaxed);
+        }
+    }
+}
+
+//Pop
+template <class T>
+bool MpmcQueue <T>::pop (T& value)
+{
+    unsigned long long position = head_.load (std::memory_order_relaxed);
+
+    while (true)
+    {
+        Cell& cell = buffer_[position & mask_];
+        unsigned long long sequence =
+            cell.sequence_.load (std::memory_order_acquire);
+        long long difference = (long long) sequence
+                             - (long long) (position + 1);
+
+        if (difference == 0)
+        {
+            if (head_.compare_exchange_weak (position, position + 1,
+                                             std::memory_order_relaxed))
+            {
+                value = cell.value_;
+                cell.sequence_.store (position + mask_ + 1,
+                                      std::memory_order_release);
+                return true;
+            }
+        }
+        else if (difference < 0)
+        {
+            return false;
+        }
+        else
+        {
+            position = head_.load (std::memory_order_relaxed);
+        }
+    }
+}
+
+#endif
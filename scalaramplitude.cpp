@@ -6,25 +6,42 @@
 #include <complex>
 #include <vector>
 
+#include "currenttable.h"
 #include "definitions.h"
+#include "evaluationtape.h"
 #include "fourvector.h"
+#include "instrumentation.h"
 #include "scalaramplitude.h"
 
 //Constructor: default
 ScalarTreeAmplitude::ScalarTreeAmplitude ()
-    : numberOfLegs_ (1), coupling_(1), mass_ (0), massless_(true) {}
+    : tape_ (1), lastInput_ (TapeInput::MOMENTA), numberOfLegs_ (1),
+      coupling_(1), mass_ (0), massless_(true), width_ (0) {}
 
 //Constructor: massless
 ScalarTreeAmplitude::ScalarTreeAmplitude
     (const int& numberOfLegs, const real_t& coupling)
-    : numberOfLegs_ (numberOfLegs), coupling_(coupling), mass_ (0),
-      massless_(true) {}
+    : tape_ (numberOfLegs), lastInput_ (TapeInput::MOMENTA),
+      numberOfLegs_ (numberOfLegs), coupling_(coupling), mass_ (0),
+      massless_(true), width_ (0) {}
 
 //Constructor: massive
 ScalarTreeAmplitude::ScalarTreeAmplitude
     (const int& numberOfLegs, const real_t& coupling, const real_t& mass)
-    : numberOfLegs_ (numberOfLegs), coupling_(coupling), mass_ (mass),
-      massless_(false) {}
+    : tape_ (numberOfLegs), lastInput_ (TapeInput::MOMENTA),
+      numberOfLegs_ (numberOfLegs), coupling_(coupling), mass_ (mass),
+      massless_(false), width_ (0) {}
+
+//Constructor: massive with width in the fixed-width scheme
+ScalarTreeAmplitude::ScalarTreeAmplitude
+    (const int& numberOfLegs, const real_t& coupling, const real_t& mass,
+     const real_t& width)
+    : tape_ (numberOfLegs), lastInput_ (TapeInput::MOMENTA),
+      numberOfLegs_ (numberOfLegs), coupling_(coupling), mass_ (mass),
+      massless_(false), width_ (width)
+{
+    tape_.setWidth (width_);
+}
 
 //Amputated massless recursive current
 complex_t ScalarTreeAmplitude::masslessCurrentAmputated
@@ -39,6 +56,8 @@ complex_t ScalarTreeAmplitude::masslessCurrentAmputated
     //Generate all set combinations except the last one via bit representation
     for (unsigned int i = 0; i < pow(2, n) - 1; i++)
     {
+        NLO4D_TIMER_START (splittingTimer);
+
         //Initialize two sets of current momenta and idList
         std::vector <FourVector <real_t>> currentMomenta1;
         std::vector <FourVector <real_t>> currentMomenta2;
@@ -47,6 +66,7 @@ complex_t ScalarTreeAmplitude::masslessCurrentAmputated
         std::vector <unsigned int> idList2;
 
         //The first set always contains the first element of set 'momenta'
+        NLO4D_COUNT (allocations_, 2);
         currentMomenta1.push_back (momenta.at (0));
         idList1.push_back (idList.at (0));
 
@@ -58,21 +78,31 @@ complex_t ScalarTreeAmplitude::masslessCurrentAmputated
             //Element is in the first set
             if ((i & readoff) == readoff)
             {
+                NLO4D_COUNT_GROWTH (currentMomenta1);
+                NLO4D_COUNT_GROWTH (idList1);
                 currentMomenta1.push_back (momenta.at (j + 1));
                 idList1.push_back (idList.at (j + 1));
             }
             //Element is in the second set
             else
             {
+                NLO4D_COUNT_GROWTH (currentMomenta2);
+                NLO4D_COUNT_GROWTH (idList2);
                 currentMomenta2.push_back (momenta.at (j + 1));
                 idList2.push_back (idList.at (j + 1));
             }
 
         }
 
+        NLO4D_TIMER_PHASE (splittingTimer, AmplitudePhase::SPLITTING);
+
         //Momenta generation complete, calculate contribution
-        result += vertex() * masslessCurrent(currentMomenta1, idList1)
-                        * masslessCurrent(currentMomenta2, idList2);
+        complex_t current1 = masslessCurrent(currentMomenta1, idList1);
+        complex_t current2 = masslessCurrent(currentMomenta2, idList2);
+
+        NLO4D_TIMER_START (accumulationTimer);
+        result += vertex() * current1 * current2;
+        NLO4D_TIMER_PHASE (accumulationTimer, AmplitudePhase::ACCUMULATION);
     }
 
     return result;
@@ -91,6 +121,8 @@ complex_t ScalarTreeAmplitude::massiveCurrentAmputated
     //Generate all set combinations except the last one via bit representation
     for (unsigned int i = 0; i < pow(2, n) - 1; i++)
     {
+        NLO4D_TIMER_START (splittingTimer);
+
         //Initialize two sets of current momenta and idList
         std::vector <FourVector <real_t>> currentMomenta1;
         std::vector <FourVector <real_t>> currentMomenta2;
@@ -99,6 +131,7 @@ complex_t ScalarTreeAmplitude::massiveCurrentAmputated
         std::vector <unsigned int> idList2;
 
         //The first set always contains the first element of set 'momenta'
+        NLO4D_COUNT (allocations_, 2);
         currentMomenta1.push_back (momenta.at (0));
         idList1.push_back (idList.at (0));
 
@@ -110,21 +143,31 @@ complex_t ScalarTreeAmplitude::massiveCurrentAmputated
             //Element is in the first set
             if ((i & readoff) == readoff)
             {
+                NLO4D_COUNT_GROWTH (currentMomenta1);
+                NLO4D_COUNT_GROWTH (idList1);
                 currentMomenta1.push_back (momenta.at (j + 1));
                 idList1.push_back (idList.at (j + 1));
             }
             //Element is in the second set
             else
             {
+                NLO4D_COUNT_GROWTH (currentMomenta2);
+                NLO4D_COUNT_GROWTH (idList2);
                 currentMomenta2.push_back (momenta.at (j + 1));
                 idList2.push_back (idList.at (j + 1));
             }
 
         }
 
+        NLO4D_TIMER_PHASE (splittingTimer, AmplitudePhase::SPLITTING);
+
         //Momenta generation complete, calculate contribution
-        result += vertex() * massiveCurrent(currentMomenta1, idList1)
-                        * massiveCurrent(currentMomenta2, idList2);
+        complex_t current1 = massiveCurrent(currentMomenta1, idList1);
+        complex_t current2 = massiveCurrent(currentMomenta2, idList2);
+
+        NLO4D_TIMER_START (accumulationTimer);
+        result += vertex() * current1 * current2;
+        NLO4D_TIMER_PHASE (accumulationTimer, AmplitudePhase::ACCUMULATION);
     }
 
     return result;
@@ -157,18 +200,31 @@ complex_t ScalarTreeAmplitude::masslessCurrent
         {
             if (i.ID_ == currentID)
             {
+                NLO4D_COUNT (currentsReused_, 1);
                 return i.value_;
             }
         }
 
         //Calculate current, store it and return it
-        complex_t result = masslessPropagator (sum (momenta))
+        NLO4D_TIMER_START (momentumTimer);
+        FourVector <real_t> momentum = sum (momenta);
+        NLO4D_TIMER_PHASE (momentumTimer, AmplitudePhase::MOMENTUM_SUM);
+
+        NLO4D_TIMER_START (propagatorTimer);
+        complex_t propagator = masslessPropagator (momentum);
+        NLO4D_TIMER_PHASE (propagatorTimer, AmplitudePhase::PROPAGATOR);
+
+        complex_t result = propagator
                          * masslessCurrentAmputated (momenta, idList);
 
+        NLO4D_COUNT (currentsComputed_, 1);
+        NLO4D_COUNT (levelCurrents_[momenta.size ()], 1);
+
         LabeledContainer container_t;
         container_t.ID_ = currentID;
         container_t.value_ = result;
 
+        NLO4D_COUNT_GROWTH (currentStorage_ [level]);
         currentStorage_ [level].push_back (container_t);
 
         return result;
@@ -203,18 +259,31 @@ complex_t ScalarTreeAmplitude::massiveCurrent
         {
             if (i.ID_ == currentID)
             {
+                NLO4D_COUNT (currentsReused_, 1);
                 return i.value_;
             }
         }
 
         //Calculate current, store it and return it
-        complex_t result = massivePropagator (sum (momenta))
+        NLO4D_TIMER_START (momentumTimer);
+        FourVector <real_t> momentum = sum (momenta);
+        NLO4D_TIMER_PHASE (momentumTimer, AmplitudePhase::MOMENTUM_SUM);
+
+        NLO4D_TIMER_START (propagatorTimer);
+        complex_t propagator = massivePropagator (momentum);
+        NLO4D_TIMER_PHASE (propagatorTimer, AmplitudePhase::PROPAGATOR);
+
+        complex_t result = propagator
                          * massiveCurrentAmputated (momenta, idList);
 
+        NLO4D_COUNT (currentsComputed_, 1);
+        NLO4D_COUNT (levelCurrents_[momenta.size ()], 1);
+
         LabeledContainer container_t;
         container_t.ID_ = currentID;
         container_t.value_ = result;
 
+        NLO4D_COUNT_GROWTH (currentStorage_ [level]);
         currentStorage_ [level].push_back (container_t);
 
         return result;
@@ -225,6 +294,396 @@ complex_t ScalarTreeAmplitude::massiveCurrent
 //Amplitude
 complex_t ScalarTreeAmplitude::amplitude
     (const std::vector <FourVector <real_t>>& momenta)
+{
+    if (momenta.size() == numberOfLegs_)
+    {
+        //Pack all but the last leg for the tape, batch of one event
+        NLO4D_COUNT (allocations_,
+                     momentumBuffer_.capacity () < 4 * momenta.size ());
+        momentumBuffer_.resize (4 * momenta.size ());
+        for (unsigned int i = 0; i + 1 < numberOfLegs_; i++)
+        {
+            for (unsigned int j = 0; j < 4; j++)
+            {
+                momentumBuffer_[4 * i + j] = momenta[i](j);
+            }
+        }
+
+        complex_t result = 0;
+        tape_.execute (momentumBuffer_.data (), 1, mass_, &result);
+        lastInput_ = TapeInput::MOMENTA;
+
+        //Multiply with overall coupling factor
+        result *= pow(coupling_, numberOfLegs_ - 2);
+
+        return result;
+    }
+
+    else
+    {
+        std::cout << "Error: number of legs and "
+            << "number of external momenta do not match\n";
+        return 0;
+    }
+}
+
+//Amplitudes for a batch of events
+std::vector <complex_t> ScalarTreeAmplitude::amplitude
+    (const std::vector <std::vector <FourVector <real_t>>>& events)
+{
+    unsigned int batchSize = events.size ();
+    std::vector <complex_t> results (batchSize, 0);
+
+    for (auto& momenta : events)
+    {
+        if (momenta.size () != numberOfLegs_)
+        {
+            std::cout << "Error: number of legs and "
+                << "number of external momenta do not match\n";
+            return results;
+        }
+    }
+
+    //Pack all but the last leg in SoA layout
+    momentumBuffer_.resize (4 * numberOfLegs_ * batchSize);
+    for (unsigned int event = 0; event < batchSize; event++)
+    {
+        for (unsigned int i = 0; i + 1 < numberOfLegs_; i++)
+        {
+            for (unsigned int j = 0; j < 4; j++)
+            {
+                momentumBuffer_[(4 * i + j) * batchSize + event]
+                    = events[event][i](j);
+            }
+        }
+    }
+
+    tape_.execute (momentumBuffer_.data (), batchSize, mass_, results.data ());
+    lastInput_ = TapeInput::MOMENTA;
+
+    //Multiply with overall coupling factor
+    real_t couplingFactor = pow(coupling_, numberOfLegs_ - 2);
+    for (auto& result : results)
+    {
+        result *= couplingFactor;
+    }
+
+    return results;
+}
+
+//Amplitude for complex momenta
+complex_t ScalarTreeAmplitude::amplitude
+    (const std::vector <FourVector <complex_t>>& momenta)
+{
+    if (momenta.size () != numberOfLegs_)
+    {
+        std::cout << "Error: number of legs and "
+            << "number of external momenta do not match\n";
+        return 0;
+    }
+
+    //Real parts followed by imaginary parts, batch of one event
+    unsigned int size = 4 * numberOfLegs_;
+    momentumBuffer_.resize (2 * size);
+    for (unsigned int i = 0; i + 1 < numberOfLegs_; i++)
+    {
+        for (unsigned int j = 0; j < 4; j++)
+        {
+            complex_t component = momenta[i](j);
+            momentumBuffer_[4 * i + j] = component.real ();
+            momentumBuffer_[size + 4 * i + j] = component.imag ();
+        }
+    }
+
+    complex_t result = 0;
+    TapeLayout layout = {1, size};
+    amplitude (momentumBuffer_.data (), momentumBuffer_.data () + size, 1,
+               layout, &result);
+
+    return result;
+}
+
+//Amplitudes for a batch of events with complex momenta
+std::vector <complex_t> ScalarTreeAmplitude::amplitude
+    (const std::vector <std::vector <FourVector <complex_t>>>& events)
+{
+    unsigned int batchSize = events.size ();
+    std::vector <complex_t> results (batchSize, 0);
+
+    for (auto& momenta : events)
+    {
+        if (momenta.size () != numberOfLegs_)
+        {
+            std::cout << "Error: number of legs and "
+                << "number of external momenta do not match\n";
+            return results;
+        }
+    }
+
+    //Real and imaginary parts in separate SoA blocks
+    unsigned int size = 4 * numberOfLegs_ * batchSize;
+    momentumBuffer_.resize (2 * size);
+    for (unsigned int event = 0; event < batchSize; event++)
+    {
+        for (unsigned int i = 0; i + 1 < numberOfLegs_; i++)
+        {
+            for (unsigned int j = 0; j < 4; j++)
+            {
+                complex_t component = events[event][i](j);
+                unsigned int index = (4 * i + j) * batchSize + event;
+                momentumBuffer_[index] = component.real ();
+                momentumBuffer_[size + index] = component.imag ();
+            }
+        }
+    }
+
+    TapeLayout layout = {batchSize, 1};
+    amplitude (momentumBuffer_.data (), momentumBuffer_.data () + size,
+               batchSize, layout, results.data ());
+
+    return results;
+}
+
+//Amplitudes for a batch of complex momenta in split arrays
+void ScalarTreeAmplitude::amplitude (const real_t* momentaReal,
+                                     const real_t* momentaImag,
+                                     const unsigned int& batchSize,
+                                     const TapeLayout& layout,
+                                     complex_t* results)
+{
+    tape_.execute (momentaReal, momentaImag, batchSize, mass_, results,
+                   layout);
+    lastInput_ = TapeInput::MOMENTA;
+
+    //Multiply with overall coupling factor
+    real_t couplingFactor = pow(coupling_, numberOfLegs_ - 2);
+    for (unsigned int i = 0; i < batchSize; i++)
+    {
+        results[i] *= couplingFactor;
+    }
+}
+
+//Pack invariant matrix of one event for the tape
+bool ScalarTreeAmplitude::packInvariants
+    (const std::vector <std::vector <real_t>>& invariants,
+     const unsigned int& event, const unsigned int& batchSize)
+{
+    if (invariants.size () != numberOfLegs_)
+    {
+        return false;
+    }
+
+    //Only the first n - 1 legs enter the recursion
+    unsigned int n = numberOfLegs_ - 1;
+    for (unsigned int i = 0; i < n; i++)
+    {
+        if (invariants[i].size () != numberOfLegs_)
+        {
+            return false;
+        }
+
+        for (unsigned int j = 0; j < n; j++)
+        {
+            momentumBuffer_[(i * n + j) * batchSize + event]
+                = invariants[i][j];
+        }
+    }
+
+    return true;
+}
+
+//Amplitude from invariants
+complex_t ScalarTreeAmplitude::amplitudeFromInvariants
+    (const std::vector <std::vector <real_t>>& invariants)
+{
+    std::vector <std::vector <std::vector <real_t>>> events = {invariants};
+
+    return amplitudeFromInvariants (events).at (0);
+}
+
+//Amplitudes from invariants for a batch of events
+std::vector <complex_t> ScalarTreeAmplitude::amplitudeFromInvariants
+    (const std::vector <std::vector <std::vector <real_t>>>& events)
+{
+    unsigned int batchSize = events.size ();
+    std::vector <complex_t> results (batchSize, 0);
+
+    //Compile on first use
+    if (invariantTape_.input () != TapeInput::INVARIANTS)
+    {
+        invariantTape_ = EvaluationTape (numberOfLegs_, TapeInput::INVARIANTS);
+        invariantTape_.setWidth (width_);
+    }
+
+    momentumBuffer_.resize (numberOfLegs_ * numberOfLegs_ * batchSize);
+    for (unsigned int event = 0; event < batchSize; event++)
+    {
+        if (!packInvariants (events[event], event, batchSize))
+        {
+            std::cout << "Error: number of legs and "
+                << "dimension of invariant matrix do not match\n";
+            return results;
+        }
+    }
+
+    invariantTape_.execute (momentumBuffer_.data (), batchSize, mass_,
+                            results.data ());
+    lastInput_ = TapeInput::INVARIANTS;
+
+    //Multiply with overall coupling factor
+    real_t couplingFactor = pow(coupling_, numberOfLegs_ - 2);
+    for (auto& result : results)
+    {
+        result *= couplingFactor;
+    }
+
+    return results;
+}
+
+//Amplitudes for a batch of events in SoA layout
+void ScalarTreeAmplitude::amplitude (const real_t* momenta,
+                                     const unsigned int& batchSize,
+                                     const unsigned int& stride,
+                                     complex_t* results)
+{
+    TapeLayout layout = {(stride == 0) ? batchSize : stride, 1};
+    amplitude (momenta, batchSize, layout, results);
+}
+
+//Amplitudes for a batch of events with arbitrary strides
+void ScalarTreeAmplitude::amplitude (const real_t* momenta,
+                                     const unsigned int& batchSize,
+                                     const TapeLayout& layout,
+                                     complex_t* results)
+{
+    tape_.execute (momenta, batchSize, mass_, results, layout);
+    lastInput_ = TapeInput::MOMENTA;
+
+    //Multiply with overall coupling factor
+    real_t couplingFactor = pow(coupling_, numberOfLegs_ - 2);
+    for (unsigned int i = 0; i < batchSize; i++)
+    {
+        results[i] *= couplingFactor;
+    }
+}
+
+//Amplitudes for a batch of events with cuts applied first
+unsigned int ScalarTreeAmplitude::amplitude (const real_t* momenta,
+                                             const unsigned int& batchSize,
+                                             const unsigned int& stride,
+                                             const CutPredicate& cut,
+                                             complex_t* results,
+                                             real_t* weights)
+{
+    unsigned int rowStride = (stride == 0) ? batchSize : stride;
+
+    NLO4D_COUNT (allocations_, accepted_.capacity () < batchSize);
+    accepted_.resize (batchSize);
+    acceptedEvents_.resize (batchSize);
+    cut (momenta, batchSize, rowStride, accepted_.data ());
+
+    //Branch-free compaction of the accepted event indices
+    unsigned int numberOfAccepted = 0;
+    for (unsigned int event = 0; event < batchSize; event++)
+    {
+        acceptedEvents_[numberOfAccepted] = event;
+        numberOfAccepted += (accepted_[event] != 0);
+    }
+
+    if (weights != nullptr)
+    {
+        for (unsigned int event = 0; event < batchSize; event++)
+        {
+            weights[event] = (accepted_[event] != 0) ? weights[event] : 0;
+        }
+    }
+
+    //Everything accepted: evaluate in place
+    if (numberOfAccepted == batchSize)
+    {
+        amplitude (momenta, batchSize, rowStride, results);
+        return numberOfAccepted;
+    }
+
+    for (unsigned int event = 0; event < batchSize; event++)
+    {
+        results[event] = 0;
+    }
+    if (numberOfAccepted == 0)
+    {
+        return 0;
+    }
+
+    //Gather the rows of the first n - 1 legs into a dense block
+    unsigned int numberOfRows = 4 * (numberOfLegs_ - 1);
+    NLO4D_COUNT (allocations_, momentumBuffer_.capacity ()
+                               < numberOfRows * numberOfAccepted);
+    momentumBuffer_.resize (numberOfRows * numberOfAccepted);
+    acceptedResults_.resize (numberOfAccepted);
+    for (unsigned int row = 0; row < numberOfRows; row++)
+    {
+        const real_t* source = momenta + row * rowStride;
+        real_t* target = momentumBuffer_.data () + row * numberOfAccepted;
+        for (unsigned int i = 0; i < numberOfAccepted; i++)
+        {
+            target[i] = source[acceptedEvents_[i]];
+        }
+    }
+
+    amplitude (momentumBuffer_.data (), numberOfAccepted, numberOfAccepted,
+               acceptedResults_.data ());
+
+    //Scatter back to the positions in the batch
+    for (unsigned int i = 0; i < numberOfAccepted; i++)
+    {
+        results[acceptedEvents_[i]] = acceptedResults_[i];
+    }
+
+    return numberOfAccepted;
+}
+
+//Amplitude with all currents exported
+const CurrentTable& ScalarTreeAmplitude::evaluate
+    (const std::vector <FourVector <real_t>>& momenta)
+{
+    if (momenta.size() != numberOfLegs_)
+    {
+        std::cout << "Error: number of legs and "
+            << "number of external momenta do not match\n";
+        table_.resize (numberOfLegs_, true);
+        return table_;
+    }
+
+    amplitude (momenta);
+
+    return currentTable (0);
+}
+
+//Current table of an event of the last evaluation
+const CurrentTable& ScalarTreeAmplitude::currentTable
+    (const unsigned int& event)
+{
+    if (lastInput_ == TapeInput::MOMENTA)
+    {
+        tape_.exportEvent (event, table_);
+    }
+    else
+    {
+        invariantTape_.exportEvent (event, table_);
+    }
+
+    if (table_.size () > 0)
+    {
+        table_.amplitude_ = table_.currents_[table_.rootSubset ()]
+                          * pow(coupling_, numberOfLegs_ - 2);
+    }
+
+    return table_;
+}
+
+//Amplitude via explicit recursion
+complex_t ScalarTreeAmplitude::recursiveAmplitude
+    (const std::vector <FourVector <real_t>>& momenta)
 {
     if (momenta.size() == numberOfLegs_)
     {
@@ -241,6 +700,8 @@ complex_t ScalarTreeAmplitude::amplitude
         }
 
         //Initialize container for calculated currents
+        NLO4D_COUNT (amplitudes_, 1);
+        NLO4D_COUNT (allocations_, 1);
         currentStorage_ = new std::vector <LabeledContainer> [numberOfLegs_ - 2];
 
         //Initialize container for result
@@ -287,5 +748,6 @@ complex_t ScalarTreeAmplitude::masslessPropagator
 complex_t ScalarTreeAmplitude::massivePropagator
     (const FourVector <real_t>& momenta)
 {
-    return imaginaryUnit / (momenta * momenta - mass_ * mass_);
+    return imaginaryUnit / (momenta * momenta - mass_ * mass_
+                            + imaginaryUnit * mass_ * width_);
 }
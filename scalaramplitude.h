@@ -8,11 +8,22 @@
 
 #include <iostream>
 #include <complex>
+#include <functional>
 #include <vector>
 
+#include "currenttable.h"
 #include "definitions.h"
+#include "evaluationtape.h"
 #include "fourvector.h"
 
+//Vectorized cut predicate on a batch in SoA layout,
+//momenta[(leg * 4 + component) * stride + event], sets accepted[event]
+//to one for events passing the cuts and to zero otherwise
+typedef std::function <void (const real_t* momenta,
+                             const unsigned int& batchSize,
+                             const unsigned int& stride,
+                             unsigned char* accepted)> CutPredicate;
+
 class ScalarTreeAmplitude
 {
 public:
@@ -23,11 +34,67 @@ public:
     //Constructor: massive
     ScalarTreeAmplitude (const int& numberOfLegs, const real_t& coupling,
                          const real_t& mass);
+    //Constructor: massive with width, propagators i / (p^2 - m^2 + i m w)
+    ScalarTreeAmplitude (const int& numberOfLegs, const real_t& coupling,
+                         const real_t& mass, const real_t& width);
 
     //Amplitude
     complex_t amplitude (const std::vector <FourVector <real_t>>& momenta);
+    //Amplitudes for a batch of events
+    std::vector <complex_t> amplitude
+        (const std::vector <std::vector <FourVector <real_t>>>& events);
+    //Amplitudes for a batch of events in SoA layout,
+    //momenta[(leg * 4 + component) * stride + event], no copies made
+    void amplitude (const real_t* momenta, const unsigned int& batchSize,
+                    const unsigned int& stride, complex_t* results);
+    //Amplitudes for a batch of events with arbitrary strides,
+    //momenta[(leg * 4 + component) * entryStride_ + event * eventStride_]
+    void amplitude (const real_t* momenta, const unsigned int& batchSize,
+                    const TapeLayout& layout, complex_t* results);
+    //Amplitudes for a batch in SoA layout with cuts applied first: only
+    //accepted events are compacted into a dense block and evaluated,
+    //rejected events get a zero amplitude and, if given, a zero weight.
+    //Returns the number of accepted events, current tables of the last
+    //evaluation refer to their position in the dense block.
+    unsigned int amplitude (const real_t* momenta,
+                            const unsigned int& batchSize,
+                            const unsigned int& stride,
+                            const CutPredicate& cut, complex_t* results,
+                            real_t* weights = nullptr);
+    //Amplitude for complex momenta, e.g. on contour-deformed or
+    //BCFW-shifted kinematics
+    complex_t amplitude (const std::vector <FourVector <complex_t>>& momenta);
+    //Amplitudes for a batch of events with complex momenta
+    std::vector <complex_t> amplitude
+        (const std::vector <std::vector <FourVector <complex_t>>>& events);
+    //Amplitudes for a batch of complex momenta given by real and
+    //imaginary parts in separate arrays of the same layout
+    void amplitude (const real_t* momentaReal, const real_t* momentaImag,
+                    const unsigned int& batchSize, const TapeLayout& layout,
+                    complex_t* results);
+    //Amplitude from the matrix of invariants s_ij = (p_i + p_j)^2 with
+    //masses s_ii = p_i^2, four-momenta are never formed
+    complex_t amplitudeFromInvariants
+        (const std::vector <std::vector <real_t>>& invariants);
+    //Amplitudes from invariants for a batch of events
+    std::vector <complex_t> amplitudeFromInvariants
+        (const std::vector <std::vector <std::vector <real_t>>>& events);
+    //Amplitude with all off-shell currents and subset momenta exported,
+    //the table stays valid until the next evaluation
+    const CurrentTable& evaluate
+        (const std::vector <FourVector <real_t>>& momenta);
+    //Current table of an event of the last (batch) evaluation
+    const CurrentTable& currentTable (const unsigned int& event);
+    //Amplitude via explicit recursion, kept as a crosscheck of the tape
+    complex_t recursiveAmplitude
+        (const std::vector <FourVector <real_t>>& momenta);
 
 private:
+    //Pack invariant matrices for the tape, false if dimensions mismatch
+    bool packInvariants
+        (const std::vector <std::vector <real_t>>& invariants,
+         const unsigned int& event, const unsigned int& batchSize);
+
     //Amputated off-shell currents
     complex_t masslessCurrentAmputated
         (const std::vector <FourVector <real_t>>& momenta,
@@ -53,12 +120,24 @@ private:
 
     //Containers
     std::vector <LabeledContainer>* currentStorage_;
+    std::vector <real_t> momentumBuffer_;
+    //Cut flags, indices and amplitudes of the accepted events
+    std::vector <unsigned char> accepted_;
+    std::vector <unsigned int> acceptedEvents_;
+    std::vector <complex_t> acceptedResults_;
+
+    //Compiled recursion
+    EvaluationTape tape_;
+    EvaluationTape invariantTape_;
+    TapeInput lastInput_;
+    CurrentTable table_;
 
     //Parameters
     const unsigned int numberOfLegs_;
     const real_t coupling_;
     const real_t mass_;
     const bool massless_;
+    const real_t width_;
 
 };
 
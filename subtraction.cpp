@@ -0,0 +1,390 @@
+/*
+    Dipole subtraction for the real corrections of massless scalar phi^3
+    theory. For a batch of (n + 1)-leg events every dipole maps the real
+    momenta onto on-shell, momentum conserving n-leg kinematics, all
+    mapped points of the batch are evaluated by the batched Born amplitude
+    in cache-sized blocks and the dipoles are summed to the counterterm of
+    each event. Singular pairs are partitioned with weights
+    (1 / s_ij^4) / sum_ab (1 / s_ab^4), which suppress a pair whose Born
+    amplitude is itself singular in the limit of another pair.
+    The diagrams with the propagator 1 / s_ij give S = -g A / s_ij, with A
+    the Born amplitude at the unmapped merged momentum p_i + p_j. Besides
+    the leading term of the mapped Born, the counterterm of a pair holds
+    the change of the Born under the mapping and the interference of S
+    with the other diagrams R = M - S, so that s_ij (|M|^2 - sum D)
+    vanishes in the collinear limits and |M|^2 / sum D goes to one in the
+    soft limits.
+*/
+#include <algorithm>
+#include <complex>
+#include <iostream>
+#include <utility>
+
+#include "instrumentation.h"
+#include "kerneldispatch.h"
+#include "subtraction.h"
+
+namespace
+{
+    //Mapped points per Born evaluation, keeps the workspace of the tape
+    //in cache
+    const unsigned int bornBlockSize = 256;
+}
+
+//Constructor
+DipoleSubtraction::DipoleSubtraction (const unsigned int& numberOfLegs,
+                                      const real_t& coupling,
+                                      const unsigned int& numberOfIncoming)
+    : born_ (std::max (numberOfLegs, 4u) - 1, coupling),
+      real_ (std::max (numberOfLegs, 4u), coupling),
+      workspaceBatchSize_ (0), numberOfLegs_ (numberOfLegs),
+      numberOfIncoming_ (numberOfIncoming), coupling_ (coupling)
+{
+    if (numberOfLegs < 4 || numberOfIncoming > 2)
+    {
+        std::cout << "Error: dipole subtraction needs at least 4 legs "
+            << "and at most 2 incoming legs\n";
+        return;
+    }
+
+    //Every unordered pair with a final leg that can become soft or
+    //collinear, every other leg as spectator
+    for (unsigned int j = numberOfIncoming; j < numberOfLegs; j++)
+    {
+        for (unsigned int i = 0; i < j; i++)
+        {
+            for (unsigned int k = 0; k < numberOfLegs; k++)
+            {
+                if (k != i && k != j)
+                {
+                    dipoles_.push_back ({i, j, k});
+                }
+            }
+        }
+    }
+    finalRows_.reserve (numberOfLegs);
+    mappedFinalRows_.reserve (numberOfLegs);
+}
+
+//Resize workspace if batch size changed
+void DipoleSubtraction::prepareWorkspace (const unsigned int& batchSize)
+{
+    if (batchSize == workspaceBatchSize_)
+    {
+        return;
+    }
+
+    const unsigned int n = numberOfLegs_;
+    const unsigned int size = dipoles_.size () * batchSize;
+    const unsigned int pairs = dipoles_.size () / (n - 2) * batchSize;
+    NLO4D_COUNT (allocations_, 10);
+    invariants_.assign (n * n * batchSize, 0);
+    pairWeights_.assign (n * n * batchSize, 0);
+    pairTerms_.assign (n * n * batchSize, 0);
+    eikonals_.assign ((n + 1) * batchSize, 0);
+    mapped_.assign (4 * (n - 1) * size, 0);
+    merged_.assign (4 * (n - 1) * pairs, 0);
+    bornAmplitudes_.assign (size, 0);
+    mergedAmplitudes_.assign (pairs, 0);
+    realAmplitudes_.assign (batchSize, 0);
+    dipoleValues_.assign (size, 0);
+
+    workspaceBatchSize_ = batchSize;
+}
+
+//Counterterms for a batch of real events
+void DipoleSubtraction::counterterms (const real_t* momenta,
+                                      const unsigned int& batchSize,
+                                      const unsigned int& stride,
+                                      real_t* counterterms)
+{
+    const unsigned int b = batchSize;
+    std::fill (counterterms, counterterms + b, 0);
+
+    if (dipoles_.empty () || b == 0)
+    {
+        return;
+    }
+    if (stride < b)
+    {
+        std::cout << "Error: stride smaller than the batch size\n";
+        return;
+    }
+
+    prepareWorkspace (b);
+
+    const unsigned int n = numberOfLegs_;
+    const unsigned int numberOfDipoles = dipoles_.size ();
+    const unsigned int t = numberOfDipoles * b;
+    const unsigned int u = numberOfDipoles / (n - 2) * b;
+
+    //Invariants of all pairs a < c
+    for (unsigned int a = 0; a < n; a++)
+    {
+        const real_t* pa = momenta + 4 * a * stride;
+        for (unsigned int c = a + 1; c < n; c++)
+        {
+            const real_t* pc = momenta + 4 * c * stride;
+            real_t* s = invariants_.data () + (a * n + c) * b;
+            for (unsigned int event = 0; event < b; event++)
+            {
+                s[event] = 2 * (pa[event] * pc[event]
+                                - pa[stride + event] * pc[stride + event]
+                                - pa[2 * stride + event]
+                                  * pc[2 * stride + event]
+                                - pa[3 * stride + event]
+                                  * pc[3 * stride + event]);
+            }
+        }
+    }
+
+    //Eikonal factors sum_c 1 / s_ac and the partition sum over the
+    //singular pairs
+    real_t* partition = eikonals_.data () + n * b;
+    std::fill (eikonals_.begin (), eikonals_.end (), 0);
+    for (unsigned int a = 0; a < n; a++)
+    {
+        for (unsigned int c = a + 1; c < n; c++)
+        {
+            const real_t* s = invariants_.data () + (a * n + c) * b;
+            real_t* ea = eikonals_.data () + a * b;
+            real_t* ec = eikonals_.data () + c * b;
+            const real_t singular = (c >= numberOfIncoming_) ? 1 : 0;
+            for (unsigned int event = 0; event < b; event++)
+            {
+                real_t inverse = 1 / s[event];
+                ea[event] += inverse;
+                ec[event] += inverse;
+                real_t inverse2 = inverse * inverse;
+                partition[event] += singular * inverse2 * inverse2;
+            }
+        }
+    }
+
+    //Weight of a pair shared by its N spectators,
+    //(1 / s_ij^4) / (N sum_ab 1 / s_ab^4)
+    const real_t spectators = n - 2;
+    for (unsigned int j = numberOfIncoming_; j < n; j++)
+    {
+        for (unsigned int i = 0; i < j; i++)
+        {
+            const real_t* s = invariants_.data () + (i * n + j) * b;
+            real_t* weight = pairWeights_.data () + (i * n + j) * b;
+            for (unsigned int event = 0; event < b; event++)
+            {
+                real_t collinear = 1 / (s[event] * s[event]);
+                weight[event] = collinear * collinear
+                              / (spectators * partition[event]);
+            }
+        }
+    }
+
+    //Unmapped points of the pairs, p_i + p_j off-shell in the Born leg of
+    //the emitter and all other legs as they are
+    unsigned int pair = 0;
+    for (unsigned int j = numberOfIncoming_; j < n; j++)
+    {
+        for (unsigned int i = 0; i < j; i++)
+        {
+            real_t* merged = merged_.data () + pair * b;
+            for (unsigned int leg = 0; leg < n; leg++)
+            {
+                if (leg == j)
+                {
+                    continue;
+                }
+                const unsigned int bornLeg = (leg < j) ? leg : leg - 1;
+                for (unsigned int c = 0; c < 4; c++)
+                {
+                    const real_t* row = momenta + (4 * leg + c) * stride;
+                    const real_t* emitted = momenta + (4 * j + c) * stride;
+                    real_t* out = merged + (4 * bornLeg + c) * u;
+                    if (leg == i)
+                    {
+                        for (unsigned int event = 0; event < b; event++)
+                        {
+                            out[event] = row[event] + emitted[event];
+                        }
+                    }
+                    else
+                    {
+                        std::copy (row, row + b, out);
+                    }
+                }
+            }
+            pair++;
+        }
+    }
+
+    //Mapped momenta, the merged pair takes the Born leg of the emitter and
+    //later legs move down by one
+    DipoleKernel mapDipole = dipoleKernel ();
+    InitialDipoleKernel mapInitialDipole = initialDipoleKernel ();
+    for (unsigned int d = 0; d < numberOfDipoles; d++)
+    {
+        const unsigned int i = dipoles_[d].emitter_;
+        const unsigned int j = dipoles_[d].emitted_;
+        const unsigned int k = dipoles_[d].spectator_;
+        auto bornLeg = [j] (const unsigned int& leg)
+        {
+            return (leg < j) ? leg : leg - 1;
+        };
+        real_t* mapped = mapped_.data () + d * b;
+
+        //Both incoming: the spectator is kept, the emitter rescaled along
+        //its beam and the final legs absorb the recoil
+        if (i < numberOfIncoming_ && k < numberOfIncoming_)
+        {
+            finalRows_.clear ();
+            mappedFinalRows_.clear ();
+            for (unsigned int leg = numberOfIncoming_; leg < n; leg++)
+            {
+                if (leg != j)
+                {
+                    finalRows_.push_back (momenta + 4 * leg * stride);
+                    mappedFinalRows_.push_back (mapped
+                                                + 4 * bornLeg (leg) * t);
+                }
+            }
+            mapInitialDipole (momenta + 4 * i * stride,
+                              momenta + 4 * j * stride,
+                              momenta + 4 * k * stride, finalRows_.data (),
+                              finalRows_.size (), stride,
+                              mapped + 4 * bornLeg (i) * t,
+                              mapped + 4 * bornLeg (k) * t,
+                              mappedFinalRows_.data (), t, b);
+            continue;
+        }
+
+        for (unsigned int leg = 0; leg < n; leg++)
+        {
+            if (leg == i || leg == j || leg == k)
+            {
+                continue;
+            }
+            for (unsigned int c = 0; c < 4; c++)
+            {
+                const real_t* row = momenta + (4 * leg + c) * stride;
+                std::copy (row, row + b,
+                           mapped + (4 * bornLeg (leg) + c) * t);
+            }
+        }
+
+        //An incoming emitter with a final spectator is mapped the other
+        //way round: the spectator absorbs the emitted leg and the emitter
+        //is rescaled, which keeps it along its direction
+        unsigned int first = i;
+        unsigned int last = k;
+        if (i < numberOfIncoming_ && k >= numberOfIncoming_)
+        {
+            std::swap (first, last);
+        }
+        mapDipole (momenta + 4 * first * stride, momenta + 4 * j * stride,
+                   momenta + 4 * last * stride, stride,
+                   mapped + 4 * bornLeg (first) * t,
+                   mapped + 4 * bornLeg (last) * t, t, b);
+    }
+
+    //All mapped and unmapped points and the real events in blocks
+    for (unsigned int first = 0; first < t; first += bornBlockSize)
+    {
+        born_.amplitude (mapped_.data () + first,
+                         std::min (bornBlockSize, t - first), t,
+                         bornAmplitudes_.data () + first);
+    }
+    for (unsigned int first = 0; first < u; first += bornBlockSize)
+    {
+        born_.amplitude (merged_.data () + first,
+                         std::min (bornBlockSize, u - first), u,
+                         mergedAmplitudes_.data () + first);
+    }
+    for (unsigned int first = 0; first < b; first += bornBlockSize)
+    {
+        real_.amplitude (momenta + first,
+                         std::min (bornBlockSize, b - first), stride,
+                         realAmplitudes_.data () + first);
+    }
+
+    //Singular part S = -g A / s_ij of a pair, the vertex i g times the
+    //propagator i / s_ij. Leading and next-to-leading collinear terms
+    //|S|^2 + 2 Re (S* R) = |M|^2 - |M - S|^2
+    pair = 0;
+    for (unsigned int j = numberOfIncoming_; j < n; j++)
+    {
+        for (unsigned int i = 0; i < j; i++)
+        {
+            const real_t* s = invariants_.data () + (i * n + j) * b;
+            const complex_t* merged = mergedAmplitudes_.data () + pair * b;
+            const complex_t* real = realAmplitudes_.data ();
+            real_t* terms = pairTerms_.data () + (i * n + j) * b;
+            for (unsigned int event = 0; event < b; event++)
+            {
+                complex_t singular = -coupling_ * merged[event] / s[event];
+                terms[event] = std::norm (real[event])
+                             - std::norm (real[event] - singular);
+            }
+            pair++;
+        }
+    }
+
+    //D = weight * (|S|^2 + 2 Re (S* R) + g^2 |M_born|^2 rho^2): the
+    //eikonal cross terms rho^2 = (E_j - 1 / s_ij)^2, plus (E_i - 1 / s_ij)^2
+    //for a final i, complete the soft limits to g^2 |M_born|^2 E^2 and are
+    //finite in the collinear limit
+    const real_t g2 = coupling_ * coupling_;
+    for (unsigned int d = 0; d < numberOfDipoles; d++)
+    {
+        const unsigned int i = dipoles_[d].emitter_;
+        const unsigned int j = dipoles_[d].emitted_;
+        const real_t* s = invariants_.data () + (i * n + j) * b;
+        const real_t* ei = eikonals_.data () + i * b;
+        const real_t* ej = eikonals_.data () + j * b;
+        const real_t* weight = pairWeights_.data () + (i * n + j) * b;
+        const real_t* terms = pairTerms_.data () + (i * n + j) * b;
+        const complex_t* born = bornAmplitudes_.data () + d * b;
+        real_t* value = dipoleValues_.data () + d * b;
+        const real_t finalEmitter = (i >= numberOfIncoming_) ? 1 : 0;
+
+        for (unsigned int event = 0; event < b; event++)
+        {
+            real_t inverse = 1 / s[event];
+            real_t rj = ej[event] - inverse;
+            real_t ri = ei[event] - inverse;
+            real_t rho2 = rj * rj + finalEmitter * ri * ri;
+            value[event] = weight[event] * (terms[event]
+                         + g2 * std::norm (born[event]) * rho2);
+            counterterms[event] += value[event];
+        }
+    }
+}
+
+//Getters
+unsigned int DipoleSubtraction::numberOfLegs () const
+{
+    return numberOfLegs_;
+}
+
+const std::vector <Dipole>& DipoleSubtraction::dipoles () const
+{
+    return dipoles_;
+}
+
+const real_t* DipoleSubtraction::mappedMomenta () const
+{
+    return mapped_.data ();
+}
+
+const complex_t* DipoleSubtraction::bornAmplitudes () const
+{
+    return bornAmplitudes_.data ();
+}
+
+const real_t* DipoleSubtraction::dipoleValues () const
+{
+    return dipoleValues_.data ();
+}
+
+const complex_t* DipoleSubtraction::realAmplitudes () const
+{
+    return realAmplitudes_.data ();
+}
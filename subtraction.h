@@ -0,0 +1,107 @@
+/*
+    Dipole subtraction for the real corrections of massless scalar phi^3
+    theory. For a batch of (n + 1)-leg events every dipole maps the real
+    momenta onto on-shell, momentum conserving n-leg kinematics, all
+    mapped points of the batch are evaluated by the batched Born amplitude
+    in cache-sized blocks and the dipoles are summed to the counterterm of
+    each event. Singular pairs are partitioned with weights
+    (1 / s_ij^4) / sum_ab (1 / s_ab^4), which suppress a pair whose Born
+    amplitude is itself singular in the limit of another pair.
+    The diagrams with the propagator 1 / s_ij give S = -g A / s_ij, with A
+    the Born amplitude at the unmapped merged momentum p_i + p_j. Besides
+    the leading term of the mapped Born, the counterterm of a pair holds
+    the change of the Born under the mapping and the interference of S
+    with the other diagrams R = M - S, so that s_ij (|M|^2 - sum D)
+    vanishes in the collinear limits and |M|^2 / sum D goes to one in the
+    soft limits.
+*/
+
+#ifndef SUBTRACTION
+#define SUBTRACTION
+
+#include <complex>
+#include <vector>
+
+#include "definitions.h"
+#include "memoryplacement.h"
+#include "scalaramplitude.h"
+
+//Emitter and emitted leg are merged, the spectator absorbs the recoil.
+//The emitted leg is always a final leg. If emitter and spectator are both
+//incoming, the emitter is rescaled along its beam and the final legs
+//absorb the recoil instead.
+struct Dipole
+{
+    unsigned int emitter_;
+    unsigned int emitted_;
+    unsigned int spectator_;
+};
+
+class DipoleSubtraction
+{
+public:
+    //Constructor: counterterms for 'numberOfLegs' real legs, the first
+    //'numberOfIncoming' of them incoming. Momenta are all outgoing as
+    //generated by MultiChannelSampler, incoming ones with negative energy.
+    DipoleSubtraction (const unsigned int& numberOfLegs,
+                       const real_t& coupling,
+                       const unsigned int& numberOfIncoming = 2);
+
+    //Counterterms for a batch of real events in SoA layout holding all
+    //legs, momenta[(leg * 4 + component) * stride + event]
+    void counterterms (const real_t* momenta, const unsigned int& batchSize,
+                       const unsigned int& stride, real_t* counterterms);
+
+    //Getters
+    unsigned int numberOfLegs () const;
+    const std::vector <Dipole>& dipoles () const;
+    //Mapped Born momenta of the last batch, all dipoles of a leg and
+    //component adjacent, mapped[(leg * 4 + component) * stride
+    //+ dipole * batchSize + event] with stride = dipoles * batchSize
+    const real_t* mappedMomenta () const;
+    //Born amplitudes and dipole values of the last batch,
+    //values[dipole * batchSize + event]
+    const complex_t* bornAmplitudes () const;
+    const real_t* dipoleValues () const;
+    //Real amplitudes of the last batch, which the counterterms need for
+    //the interference terms
+    const complex_t* realAmplitudes () const;
+
+private:
+    //Resize workspace if batch size changed
+    void prepareWorkspace (const unsigned int& batchSize);
+
+    //Dipoles, their Born evaluator and the real amplitude
+    std::vector <Dipole> dipoles_;
+    ScalarTreeAmplitude born_;
+    ScalarTreeAmplitude real_;
+
+    //Workspace of the last batch: invariants s_ab = 2 p_a.p_b, weights and
+    //collinear terms of the pairs a < b at row a * numberOfLegs + b,
+    //eikonal factors sum_b 1 / s_ab of the legs followed by the partition
+    //sum, mapped momenta and unmapped momenta of the pairs with their Born
+    //amplitudes, real amplitudes and dipole values
+    PlacedVector <real_t> invariants_;
+    PlacedVector <real_t> pairWeights_;
+    PlacedVector <real_t> pairTerms_;
+    PlacedVector <real_t> eikonals_;
+    PlacedVector <real_t> mapped_;
+    PlacedVector <real_t> merged_;
+    PlacedVector <complex_t> bornAmplitudes_;
+    PlacedVector <complex_t> mergedAmplitudes_;
+    PlacedVector <complex_t> realAmplitudes_;
+    PlacedVector <real_t> dipoleValues_;
+    unsigned int workspaceBatchSize_;
+    //Rows of the final legs of an initial-initial dipole and their mapped
+    //rows, reserved for all legs
+    std::vector <const real_t*> finalRows_;
+    std::vector <real_t*> mappedFinalRows_;
+
+    //Parameters
+    const unsigned int numberOfLegs_;
+    const unsigned int numberOfIncoming_;
+    const real_t coupling_;
+
+};
+
+#endif
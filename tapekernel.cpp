@@ -0,0 +1,473 @@
+/*
+    Numeric kernels executing the evaluation tape for real and complex
+    kinematics. This file is compiled once per instruction set, with
+    TAPE_KERNEL and COMPLEX_TAPE_KERNEL naming the variant and the
+    matching -m flags given in the makefile. It must not define or odr-use
+    inline functions shared with other translation units.
+*/
+#include <complex>
+
+#include "definitions.h"
+#include "evaluationtape.h"
+#include "instrumentation.h"
+#include "kerneldispatch.h"
+
+#ifndef TAPE_KERNEL
+#define TAPE_KERNEL executeTapeSse2
+#endif
+
+#ifndef COMPLEX_TAPE_KERNEL
+#define COMPLEX_TAPE_KERNEL executeComplexTapeSse2
+#endif
+
+namespace
+{
+    //Copy an input row of the batch, contiguous events vectorize
+    void loadInput (real_t* target, const real_t* source,
+                    const unsigned int& eventStride,
+                    const unsigned int& batchSize)
+    {
+        const unsigned int b = batchSize;
+
+        if (eventStride == 1)
+        {
+            for (unsigned int i = 0; i < b; i++)
+            {
+                target[i] = source[i];
+            }
+        }
+        else
+        {
+            const unsigned int stride = eventStride;
+            for (unsigned int i = 0; i < b; i++)
+            {
+                target[i] = source[i * stride];
+            }
+        }
+    }
+
+    //Instructions between a prefetch and the use of the data
+    const unsigned int prefetchDistance = 8;
+
+    //Prefetch the current of a slot. Rows are fetched completely up to
+    //eight cache lines, which covers the small batches used at high
+    //multiplicity and starts the hardware stream for longer rows.
+    void prefetchCurrent (const real_t* current,
+                          const unsigned int& batchSize)
+    {
+        const unsigned int reals = (batchSize < 64) ? batchSize : 64;
+
+        for (unsigned int i = 0; i < reals; i += 8)
+        {
+            __builtin_prefetch (current + i);
+            __builtin_prefetch (current + batchSize + i);
+        }
+    }
+
+    //Prefetch both operands of a multiply-accumulate ahead of its use,
+    //their slots are far apart from the target at large multiplicity
+    void prefetchOperands (const TapeInstruction* instructions,
+                           const unsigned int& k,
+                           const unsigned int& numberOfInstructions,
+                           const real_t* current,
+                           const unsigned int& batchSize)
+    {
+        if (k + prefetchDistance >= numberOfInstructions)
+        {
+            return;
+        }
+
+        const TapeInstruction& ahead = instructions[k + prefetchDistance];
+        if (ahead.operation_ == TapeOperation::MULTIPLY_ACCUMULATE)
+        {
+            prefetchCurrent (current + 2 * ahead.first_ * batchSize,
+                             batchSize);
+            prefetchCurrent (current + 2 * ahead.second_ * batchSize,
+                             batchSize);
+        }
+    }
+
+#ifdef NLO4D_INSTRUMENTATION
+    //Phase an operation is attributed to
+    AmplitudePhase tapePhase (const TapeOperation& operation)
+    {
+        switch (operation)
+        {
+            case TapeOperation::PROPAGATOR:
+                return AmplitudePhase::PROPAGATOR;
+            case TapeOperation::CLEAR_CURRENT:
+            case TapeOperation::MULTIPLY_ACCUMULATE:
+                return AmplitudePhase::ACCUMULATION;
+            default:
+                return AmplitudePhase::MOMENTUM_SUM;
+        }
+    }
+#endif
+}
+
+//Execute instructions on the workspace, see TapeOperation for semantics
+void TAPE_KERNEL (const TapeInstruction* instructions,
+                  const unsigned int& numberOfInstructions,
+                  const real_t* input, const unsigned int& inputStride,
+                  const unsigned int& eventStride,
+                  const unsigned int& batchSize,
+                  const real_t& massSquared, const real_t& massWidth,
+                  real_t* momentum,
+                  real_t* invariant, real_t* current)
+{
+    const unsigned int b = batchSize;
+
+    for (unsigned int k = 0; k < numberOfInstructions; k++)
+    {
+        const TapeInstruction& instruction = instructions[k];
+        const unsigned int t = instruction.target_;
+        const unsigned int f = instruction.first_;
+        const unsigned int s = instruction.second_;
+
+        prefetchOperands (instructions, k, numberOfInstructions, current, b);
+
+        NLO4D_TIMER_START (timer);
+
+        switch (instruction.operation_)
+        {
+            case TapeOperation::LOAD_MOMENTUM:
+            {
+                for (unsigned int j = 0; j < 4; j++)
+                {
+                    loadInput (momentum + (4 * t + j) * b,
+                               input + (4 * f + j) * inputStride,
+                               eventStride, b);
+                }
+                for (unsigned int i = 0; i < b; i++)
+                {
+                    current[2 * t * b + i] = 1;
+                    current[(2 * t + 1) * b + i] = 0;
+                }
+                break;
+            }
+            case TapeOperation::MOMENTUM_ADD:
+            {
+                const real_t* first = momentum + 4 * f * b;
+                const real_t* second = momentum + 4 * s * b;
+                real_t* target = momentum + 4 * t * b;
+                for (unsigned int i = 0; i < 4 * b; i++)
+                {
+                    target[i] = first[i] + second[i];
+                }
+                break;
+            }
+            case TapeOperation::INVARIANT:
+            {
+                const real_t* p = momentum + 4 * f * b;
+                real_t* target = invariant + t * b;
+                for (unsigned int i = 0; i < b; i++)
+                {
+                    target[i] = p[i] * p[i] - p[b + i] * p[b + i]
+                              - p[2 * b + i] * p[2 * b + i]
+                              - p[3 * b + i] * p[3 * b + i];
+                }
+                break;
+            }
+            case TapeOperation::CLEAR_CURRENT:
+            {
+                for (unsigned int i = 0; i < b; i++)
+                {
+                    current[2 * t * b + i] = 0;
+                    current[(2 * t + 1) * b + i] = 0;
+                }
+                break;
+            }
+            case TapeOperation::MULTIPLY_ACCUMULATE:
+            {
+                const real_t* re1 = current + 2 * f * b;
+                const real_t* im1 = current + (2 * f + 1) * b;
+                const real_t* re2 = current + 2 * s * b;
+                const real_t* im2 = current + (2 * s + 1) * b;
+                real_t* re = current + 2 * t * b;
+                real_t* im = current + (2 * t + 1) * b;
+                for (unsigned int i = 0; i < b; i++)
+                {
+                    re[i] += re1[i] * re2[i] - im1[i] * im2[i];
+                    im[i] += re1[i] * im2[i] + im1[i] * re2[i];
+                }
+                break;
+            }
+            case TapeOperation::PROPAGATOR:
+            {
+                //vertex * propagator = i * i / (p^2 - m^2 + i m w),
+                //purely real without width
+                const real_t* p2 = invariant + f * b;
+                real_t* re = current + 2 * t * b;
+                real_t* im = current + (2 * t + 1) * b;
+                const real_t w = massWidth;
+                if (w == 0)
+                {
+                    for (unsigned int i = 0; i < b; i++)
+                    {
+                        real_t factor = - 1 / (p2[i] - massSquared);
+                        re[i] *= factor;
+                        im[i] *= factor;
+                    }
+                }
+                else
+                {
+                    for (unsigned int i = 0; i < b; i++)
+                    {
+                        real_t d = p2[i] - massSquared;
+                        real_t scale = - 1 / (d * d + w * w);
+                        real_t fr = d * scale;
+                        real_t fi = - w * scale;
+                        real_t cr = re[i];
+                        re[i] = cr * fr - im[i] * fi;
+                        im[i] = cr * fi + im[i] * fr;
+                    }
+                }
+                break;
+            }
+            case TapeOperation::LOAD_LEG_INVARIANT:
+            {
+                loadInput (invariant + t * b, input + f * inputStride,
+                           eventStride, b);
+                for (unsigned int i = 0; i < b; i++)
+                {
+                    current[2 * t * b + i] = 1;
+                    current[(2 * t + 1) * b + i] = 0;
+                }
+                break;
+            }
+            case TapeOperation::LOAD_INVARIANT:
+            {
+                loadInput (invariant + t * b, input + f * inputStride,
+                           eventStride, b);
+                break;
+            }
+            case TapeOperation::INVARIANT_ADD:
+            {
+                const real_t* first = invariant + f * b;
+                const real_t* second = invariant + s * b;
+                real_t* target = invariant + t * b;
+                for (unsigned int i = 0; i < b; i++)
+                {
+                    target[i] = first[i] + second[i];
+                }
+                break;
+            }
+            case TapeOperation::INVARIANT_ACCUMULATE:
+            {
+                const real_t* first = invariant + f * b;
+                const real_t* second = invariant + s * b;
+                real_t* target = invariant + t * b;
+                for (unsigned int i = 0; i < b; i++)
+                {
+                    target[i] += first[i] - second[i];
+                }
+                break;
+            }
+            case TapeOperation::INVARIANT_SUBTRACT:
+            {
+                const real_t* first = invariant + f * b;
+                const real_t* second = invariant + s * b;
+                real_t* target = invariant + t * b;
+                for (unsigned int i = 0; i < b; i++)
+                {
+                    target[i] -= first[i] + second[i];
+                }
+                break;
+            }
+        }
+
+        NLO4D_TIMER_PHASE (timer, tapePhase (instruction.operation_));
+    }
+}
+
+//Execute instructions with complex momenta and invariants, real and
+//imaginary parts in separate arrays of the same layout
+void COMPLEX_TAPE_KERNEL (const TapeInstruction* instructions,
+                          const unsigned int& numberOfInstructions,
+                          const real_t* inputReal, const real_t* inputImag,
+                          const unsigned int& inputStride,
+                          const unsigned int& eventStride,
+                          const unsigned int& batchSize,
+                          const real_t& massSquared,
+                          const real_t& massWidth,
+                          real_t* momentumReal, real_t* momentumImag,
+                          real_t* invariantReal, real_t* invariantImag,
+                          real_t* current)
+{
+    const unsigned int b = batchSize;
+
+    for (unsigned int k = 0; k < numberOfInstructions; k++)
+    {
+        const TapeInstruction& instruction = instructions[k];
+        const unsigned int t = instruction.target_;
+        const unsigned int f = instruction.first_;
+        const unsigned int s = instruction.second_;
+
+        prefetchOperands (instructions, k, numberOfInstructions, current, b);
+
+        switch (instruction.operation_)
+        {
+            case TapeOperation::LOAD_MOMENTUM:
+            {
+                for (unsigned int j = 0; j < 4; j++)
+                {
+                    loadInput (momentumReal + (4 * t + j) * b,
+                               inputReal + (4 * f + j) * inputStride,
+                               eventStride, b);
+                    loadInput (momentumImag + (4 * t + j) * b,
+                               inputImag + (4 * f + j) * inputStride,
+                               eventStride, b);
+                }
+                for (unsigned int i = 0; i < b; i++)
+                {
+                    current[2 * t * b + i] = 1;
+                    current[(2 * t + 1) * b + i] = 0;
+                }
+                break;
+            }
+            case TapeOperation::MOMENTUM_ADD:
+            {
+                for (real_t* part : {momentumReal, momentumImag})
+                {
+                    const real_t* first = part + 4 * f * b;
+                    const real_t* second = part + 4 * s * b;
+                    real_t* target = part + 4 * t * b;
+                    for (unsigned int i = 0; i < 4 * b; i++)
+                    {
+                        target[i] = first[i] + second[i];
+                    }
+                }
+                break;
+            }
+            case TapeOperation::INVARIANT:
+            {
+                //p^2 = sum_mu g_mu (a_mu + i c_mu)^2
+                const real_t* a = momentumReal + 4 * f * b;
+                const real_t* c = momentumImag + 4 * f * b;
+                real_t* re = invariantReal + t * b;
+                real_t* im = invariantImag + t * b;
+                for (unsigned int i = 0; i < b; i++)
+                {
+                    re[i] = a[i] * a[i] - c[i] * c[i]
+                          - a[b + i] * a[b + i] + c[b + i] * c[b + i]
+                          - a[2 * b + i] * a[2 * b + i]
+                          + c[2 * b + i] * c[2 * b + i]
+                          - a[3 * b + i] * a[3 * b + i]
+                          + c[3 * b + i] * c[3 * b + i];
+                    im[i] = 2 * (a[i] * c[i] - a[b + i] * c[b + i]
+                                 - a[2 * b + i] * c[2 * b + i]
+                                 - a[3 * b + i] * c[3 * b + i]);
+                }
+                break;
+            }
+            case TapeOperation::CLEAR_CURRENT:
+            {
+                for (unsigned int i = 0; i < b; i++)
+                {
+                    current[2 * t * b + i] = 0;
+                    current[(2 * t + 1) * b + i] = 0;
+                }
+                break;
+            }
+            case TapeOperation::MULTIPLY_ACCUMULATE:
+            {
+                const real_t* re1 = current + 2 * f * b;
+                const real_t* im1 = current + (2 * f + 1) * b;
+                const real_t* re2 = current + 2 * s * b;
+                const real_t* im2 = current + (2 * s + 1) * b;
+                real_t* re = current + 2 * t * b;
+                real_t* im = current + (2 * t + 1) * b;
+                for (unsigned int i = 0; i < b; i++)
+                {
+                    re[i] += re1[i] * re2[i] - im1[i] * im2[i];
+                    im[i] += re1[i] * im2[i] + im1[i] * re2[i];
+                }
+                break;
+            }
+            case TapeOperation::PROPAGATOR:
+            {
+                //vertex * propagator = - 1 / (p^2 - m^2 + i m w)
+                const real_t* p2Real = invariantReal + f * b;
+                const real_t* p2Imag = invariantImag + f * b;
+                real_t* re = current + 2 * t * b;
+                real_t* im = current + (2 * t + 1) * b;
+                const real_t w = massWidth;
+                for (unsigned int i = 0; i < b; i++)
+                {
+                    real_t dr = p2Real[i] - massSquared;
+                    real_t di = p2Imag[i] + w;
+                    real_t scale = - 1 / (dr * dr + di * di);
+                    real_t fr = dr * scale;
+                    real_t fi = - di * scale;
+                    real_t cr = re[i];
+                    re[i] = cr * fr - im[i] * fi;
+                    im[i] = cr * fi + im[i] * fr;
+                }
+                break;
+            }
+            case TapeOperation::LOAD_LEG_INVARIANT:
+            {
+                loadInput (invariantReal + t * b, inputReal + f * inputStride,
+                           eventStride, b);
+                loadInput (invariantImag + t * b, inputImag + f * inputStride,
+                           eventStride, b);
+                for (unsigned int i = 0; i < b; i++)
+                {
+                    current[2 * t * b + i] = 1;
+                    current[(2 * t + 1) * b + i] = 0;
+                }
+                break;
+            }
+            case TapeOperation::LOAD_INVARIANT:
+            {
+                loadInput (invariantReal + t * b, inputReal + f * inputStride,
+                           eventStride, b);
+                loadInput (invariantImag + t * b, inputImag + f * inputStride,
+                           eventStride, b);
+                break;
+            }
+            case TapeOperation::INVARIANT_ADD:
+            {
+                for (real_t* part : {invariantReal, invariantImag})
+                {
+                    const real_t* first = part + f * b;
+                    const real_t* second = part + s * b;
+                    real_t* target = part + t * b;
+                    for (unsigned int i = 0; i < b; i++)
+                    {
+                        target[i] = first[i] + second[i];
+                    }
+                }
+                break;
+            }
+            case TapeOperation::INVARIANT_ACCUMULATE:
+            {
+                for (real_t* part : {invariantReal, invariantImag})
+                {
+                    const real_t* first = part + f * b;
+                    const real_t* second = part + s * b;
+                    real_t* target = part + t * b;
+                    for (unsigned int i = 0; i < b; i++)
+                    {
+                        target[i] += first[i] - second[i];
+                    }
+                }
+                break;
+            }
+            case TapeOperation::INVARIANT_SUBTRACT:
+            {
+                for (real_t* part : {invariantReal, invariantImag})
+                {
+                    const real_t* first = part + f * b;
+                    const real_t* second = part + s * b;
+                    real_t* target = part + t * b;
+                    for (unsigned int i = 0; i < b; i++)
+                    {
+                        target[i] -= first[i] + second[i];
+                    }
+                }
+                break;
+            }
+        }
+    }
+}
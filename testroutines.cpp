@@ -1,11 +1,30 @@
 //Testroutines
 #include <array>
 #include <complex>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <ctime>
+#include <fstream>
+#include <random>
 
 #include "definitions.h"
+#include "evaluationtape.h"
+#include "flavouredamplitude.h"
 #include "fourvector.h"
+#include "histogram.h"
+#include "instrumentation.h"
+#include "integration.h"
+#include "memoryplacement.h"
+#include "kerneldispatch.h"
+#include "loopintegrals.h"
+#include "multichannel.h"
+#include "nlo4d.h"
+#include "perfcounters.h"
+#include "pipeline.h"
 #include "scalaramplitude.h"
+#include "subtraction.h"
+#include "unweighting.h"
 
 void testUtilities ()
 {
@@ -152,6 +171,10 @@ void testScalarTreeAmplitude ()
 
     std::cout << "\nCalculating amplitude in " << nPoints << " points...\n";
 
+    PerformanceCounters counters;
+
+    resetStatistics ();
+    counters.start ();
     clock_t tStart = clock();
 
     for (unsigned int i = 0; i < nPoints; i++)
@@ -160,11 +183,23 @@ void testScalarTreeAmplitude ()
     }
 
     clock_t tEnd = clock();
+    counters.stop ();
 
     real_t tTotal = (double)(tEnd - tStart)/CLOCKS_PER_SEC;
 
     std::cout << "Total time taken: " << tTotal << "\n";
     std::cout << "Avg. time per calculation: " << tTotal/nPoints <<"\n";
+    counters.print (std::cout, nPoints, "amplitude");
+    printStatistics (std::cout, collectStatistics ());
+
+    //Hot-path statistics of the explicit recursion
+    resetStatistics ();
+    for (unsigned int i = 0; i < nPoints / 100; i++)
+    {
+        amplitude6.recursiveAmplitude (momenta6);
+    }
+    std::cout << "Explicit recursion:\n";
+    printStatistics (std::cout, collectStatistics ());
 
 /*
     complex_t analytical;
@@ -175,3 +210,1953 @@ void testScalarTreeAmplitude ()
     std::cout << "4 leg amplitude: analytical: " << analytical << "\n";
 */
 }
+
+void testEvaluationTape ()
+{
+    std::cout << "\n*** Testing EvaluationTape ***\n";
+
+    std::vector <FourVector <real_t>> momenta =
+        {{1, 22, 3, 44}, {11, 2, 33, 4}, {-1, 22, -4, 55},
+         {-2, 32, -5, 5}, {8, 11, 21, 7}, {3, -7, 12, 9},
+         {-6, 4, 2, -15}};
+    momenta.push_back (- sum (momenta));
+
+    real_t coupling = 2.5;
+    real_t mass = 3.5;
+
+    //Crosscheck with the recursive evaluation
+    for (unsigned int n = 3; n <= momenta.size (); n++)
+    {
+        std::vector <FourVector <real_t>> momentaN (momenta.begin (),
+                                                    momenta.begin () + n - 1);
+        momentaN.push_back (- sum (momentaN));
+
+        ScalarTreeAmplitude massless (n, coupling);
+        ScalarTreeAmplitude massive (n, coupling, mass);
+
+        complex_t tape = massless.amplitude (momentaN);
+        complex_t recursive = massless.recursiveAmplitude (momentaN);
+        complex_t tapeMassive = massive.amplitude (momentaN);
+        complex_t recursiveMassive = massive.recursiveAmplitude (momentaN);
+
+        //Same amplitude from the matrix of invariants
+        std::vector <std::vector <real_t>> invariants =
+            invariantMatrix (momentaN);
+        complex_t fromInvariants =
+            massive.amplitudeFromInvariants (invariants);
+
+        std::cout << n << " legs, "
+            << EvaluationTape (n).numberOfInstructions () << " instructions: "
+            << tape << " vs " << recursive << " | massive: "
+            << tapeMassive << " vs " << recursiveMassive << " | match: "
+            << (std::abs (tape - recursive) <= 1e-12 * std::abs (recursive)
+                && std::abs (tapeMassive - recursiveMassive)
+                   <= 1e-12 * std::abs (recursiveMassive))
+            << " | invariants match: "
+            << (std::abs (fromInvariants - recursiveMassive)
+                <= 1e-10 * std::abs (recursiveMassive)) << "\n";
+    }
+
+    //Current table against currents rebuilt by hand for 5 legs:
+    //J(0,1) = vertex * propagator (p0 + p1)
+    ScalarTreeAmplitude amplitude5 (5, coupling, mass);
+    std::vector <FourVector <real_t>> momenta5 (momenta.begin (),
+                                                momenta.begin () + 4);
+    momenta5.push_back (- sum (momenta5));
+
+    const CurrentTable& table = amplitude5.evaluate (momenta5);
+    FourVector <real_t> p01 = momenta5[0] + momenta5[1];
+    complex_t current01 = imaginaryUnit * imaginaryUnit
+                        / (p01.square () - mass * mass);
+
+    std::cout << "Current table: " << table.size () << " entries, root "
+        << table.rootSubset () << ", amplitude "
+        << table.amplitude () << "\n";
+    std::cout << "J(0,1): " << table.current (3) << " vs " << current01
+        << " | P(0,1): " << table.momentum (3) << " vs " << p01
+        << " | root momentum: " << table.momentum (table.rootSubset ())
+        << " vs " << - momenta5[4] << "\n";
+    std::cout << "Table amplitude match: "
+        << isClose (table.amplitude (),
+                     amplitude5.recursiveAmplitude (momenta5)) << "\n";
+
+    //Batch evaluation
+    unsigned int batchSize = 64;
+    ScalarTreeAmplitude amplitude6 (6, coupling, mass);
+    std::vector <std::vector <FourVector <real_t>>> events;
+    for (unsigned int i = 0; i < batchSize; i++)
+    {
+        std::vector <FourVector <real_t>> event (momenta.begin (),
+                                                 momenta.begin () + 5);
+        event[i % 5] = (1 + 0.01 * i) * event[i % 5];
+        event.push_back (- sum (event));
+        events.push_back (event);
+    }
+
+    std::vector <complex_t> batch = amplitude6.amplitude (events);
+    bool batchMatch = true;
+    for (unsigned int i = 0; i < batchSize; i++)
+    {
+        complex_t single = amplitude6.recursiveAmplitude (events[i]);
+        batchMatch = batchMatch
+            && std::abs (batch[i] - single) <= 1e-12 * std::abs (single);
+    }
+    std::cout << "Batch of " << batchSize << " events match: "
+        << batchMatch << "\n";
+
+    //Every supported kernel variant gives the same batch
+    KernelVariant defaultVariant = kernelVariant ();
+    std::cout << "Kernel variant: " << kernelVariantName (defaultVariant)
+        << "\n";
+    for (KernelVariant variant : {KernelVariant::SSE2, KernelVariant::AVX2,
+                                  KernelVariant::AVX512})
+    {
+        if (!kernelVariantSupported (variant))
+        {
+            std::cout << kernelVariantName (variant) << ": not supported\n";
+            continue;
+        }
+
+        setKernelVariant (variant);
+        std::vector <complex_t> variantBatch = amplitude6.amplitude (events);
+        bool variantMatch = true;
+        for (unsigned int i = 0; i < batchSize; i++)
+        {
+            variantMatch = variantMatch && std::abs (variantBatch[i] - batch[i])
+                                           <= 1e-12 * std::abs (batch[i]);
+        }
+        std::cout << kernelVariantName (variant) << " match: "
+            << variantMatch << "\n";
+    }
+    setKernelVariant (defaultVariant);
+
+    //Timing and hardware counters of the recursion, the tape for single
+    //events and batches
+    unsigned int nPoints = 1e4;
+    PerformanceCounters counters;
+
+    counters.start ();
+    clock_t tStart = clock();
+    for (unsigned int i = 0; i < nPoints; i++)
+    {
+        amplitude6.recursiveAmplitude (events[0]);
+    }
+    clock_t tEnd = clock();
+    counters.stop ();
+    real_t tRecursive = (double)(tEnd - tStart)/CLOCKS_PER_SEC;
+
+    std::cout << "Avg. time per calculation (recursive): "
+        << tRecursive/nPoints << "\n";
+    counters.print (std::cout, nPoints, "amplitude");
+
+    counters.start ();
+    tStart = clock();
+    for (unsigned int i = 0; i < nPoints; i++)
+    {
+        amplitude6.amplitude (events[0]);
+    }
+    tEnd = clock();
+    counters.stop ();
+    real_t tTape = (double)(tEnd - tStart)/CLOCKS_PER_SEC;
+
+    std::cout << "Avg. time per calculation (tape): " << tTape/nPoints << "\n";
+    counters.print (std::cout, nPoints, "amplitude");
+
+    counters.start ();
+    tStart = clock();
+    for (unsigned int i = 0; i < nPoints / batchSize; i++)
+    {
+        amplitude6.amplitude (events);
+    }
+    tEnd = clock();
+    counters.stop ();
+    real_t tBatch = (double)(tEnd - tStart)/CLOCKS_PER_SEC;
+
+    std::cout << "Avg. time per calculation (tape, batch): "
+        << tBatch/(nPoints / batchSize * batchSize) << "\n";
+    counters.print (std::cout, nPoints / batchSize * batchSize, "amplitude");
+
+    //High multiplicity: the current table far exceeds the caches
+    const unsigned int manyLegs = 14;
+    const unsigned int smallBatch = 16;
+    std::mt19937_64 generator (14);
+    std::uniform_real_distribution <real_t> uniform (-10, 10);
+    std::vector <std::vector <FourVector <real_t>>> manyEvents;
+    for (unsigned int i = 0; i < smallBatch; i++)
+    {
+        std::vector <FourVector <real_t>> event;
+        for (unsigned int leg = 0; leg + 1 < manyLegs; leg++)
+        {
+            event.push_back (FourVector <real_t> (uniform (generator),
+                uniform (generator), uniform (generator),
+                uniform (generator)));
+        }
+        event.push_back (- sum (event));
+        manyEvents.push_back (event);
+    }
+
+    ScalarTreeAmplitude amplitude14 (manyLegs, 1.5, 2);
+    std::vector <complex_t> manyBatch = amplitude14.amplitude (manyEvents);
+    complex_t manySingle = amplitude14.amplitude (manyEvents.back ());
+    std::cout << manyLegs << " legs, batch matches single event: "
+        << (std::abs (manyBatch.back () - manySingle)
+            <= 1e-12 * std::abs (manySingle)) << "\n";
+
+    EvaluationTape tape14 (manyLegs);
+    unsigned int multiplyAccumulates = 0;
+    for (unsigned int k = 0; k < tape14.numberOfInstructions (); k++)
+    {
+        multiplyAccumulates += (tape14.instructions ()[k].operation_
+                                == TapeOperation::MULTIPLY_ACCUMULATE);
+    }
+
+    unsigned int manyRepetitions = 4;
+    counters.start ();
+    tStart = clock();
+    for (unsigned int i = 0; i < manyRepetitions; i++)
+    {
+        amplitude14.amplitude (manyEvents);
+    }
+    tEnd = clock();
+    counters.stop ();
+    real_t tMany = (double)(tEnd - tStart)/CLOCKS_PER_SEC;
+
+    std::cout << "Avg. time per calculation (" << manyLegs << " legs, batch of "
+        << smallBatch << "): " << tMany / (manyRepetitions * smallBatch)
+        << ", per multiply-accumulate and event: "
+        << tMany / (manyRepetitions * smallBatch) / multiplyAccumulates
+        << "\n";
+    counters.print (std::cout, manyRepetitions * smallBatch, "amplitude");
+}
+
+void testShardedIntegration ()
+{
+    std::cout << "\n*** Testing ShardedIntegrator ***\n";
+
+    //Peaked integrand on [0,1]^3, each factor normalized to one
+    const real_t width = 0.05;
+    const real_t norm = width / (atan (0.5 / width) - atan (-0.5 / width));
+    Integrand peak = [=] (const std::vector <real_t>& x)
+    {
+        real_t value = 1;
+        for (real_t xj : x)
+        {
+            value *= norm / ((xj - 0.5) * (xj - 0.5) + width * width);
+        }
+        return value;
+    };
+    Integrand observable = [] (const std::vector <real_t>& x)
+    {
+        return x[0];
+    };
+
+    ShardedIntegrator local (peak, 3, 8, 2000, 12345);
+    ShardedIntegrator forked (peak, 3, 8, 2000, 12345);
+    local.setHistogram (observable, 10, 0, 1);
+    forked.setHistogram (observable, 10, 0, 1);
+
+    char directory[] = "/tmp/nlo4d_shards_XXXXXX";
+    if (mkdtemp (directory) == nullptr)
+    {
+        std::cout << "Error: cannot create shard directory\n";
+        return;
+    }
+
+    for (unsigned int iteration = 0; iteration < 5; iteration++)
+    {
+        ShardResult localResult = local.runIteration (iteration);
+        ShardResult forkedResult =
+            forked.runIterationForked (iteration, 3, directory);
+
+        local.update (localResult);
+        forked.update (forkedResult);
+
+        std::cout << "Iteration " << iteration << ": "
+            << local.integral () << " +- " << local.error ()
+            << " | forked identical: "
+            << (localResult.sum_ == forkedResult.sum_
+                && localResult.sumOfSquares_ == forkedResult.sumOfSquares_
+                && localResult.histogramSums_ == forkedResult.histogramSums_
+                && local.grid ().edges () == forked.grid ().edges ())
+            << "\n";
+    }
+
+    std::cout << "Expected: 1\n";
+    std::cout << "Histogram of x0:";
+    for (real_t bin : local.histogram ())
+    {
+        std::cout << " " << bin;
+    }
+    std::cout << "\n";
+
+    //Shard file round trip
+    ShardResult shard = local.runShard (0, 0);
+    ShardResult readBack;
+    std::string fileName = ShardedIntegrator::shardFileName (directory, 99, 0);
+    bool roundTrip = writeShardResult (fileName, shard)
+                  && readShardResult (fileName, readBack)
+                  && readBack.sum_ == shard.sum_
+                  && readBack.gridAccumulator_ == shard.gridAccumulator_;
+    std::cout << "Shard file round trip: " << roundTrip << "\n";
+
+    //A shard given twice is counted once
+    ShardResult twice = mergeShardResults ({shard, readBack});
+    std::cout << "Duplicate shard counted once: "
+        << (twice.numberOfPoints_ == shard.numberOfPoints_) << "\n";
+
+    //A shard with a shorter squares array is not merged
+    ShardResult shortSquares = shard;
+    shortSquares.shardIndex_ = 1;
+    shortSquares.histogramSquares_.pop_back ();
+    unsigned int numberOfMerged = 0;
+    mergeShardResults ({shard, shortSquares}, &numberOfMerged);
+    std::cout << "Mismatched squares rejected: " << (numberOfMerged == 1)
+        << "\n";
+
+    //An array size beyond the end of the file fails before allocating,
+    //the first array size follows 40 bytes of header and totals
+    {
+        std::fstream file (fileName, std::ios::binary | std::ios::in
+                                     | std::ios::out);
+        uint32_t size = 0xffffffff;
+        file.seekp (40);
+        file.write (reinterpret_cast <const char*> (&size), sizeof (size));
+    }
+    ShardResult corrupted;
+    std::cout << "Oversized array rejected: "
+        << !readShardResult (fileName, corrupted) << "\n";
+
+    //Clean up shard files
+    std::remove (fileName.c_str ());
+    for (unsigned int iteration = 0; iteration < 5; iteration++)
+    {
+        for (unsigned int shard = 0; shard < 8; shard++)
+        {
+            std::remove (ShardedIntegrator::shardFileName
+                (directory, iteration, shard).c_str ());
+        }
+    }
+    std::remove (directory);
+}
+
+void testEventPipeline ()
+{
+    std::cout << "\n*** Testing EventPipeline ***\n";
+
+    const unsigned int numberOfLegs = 6;
+    const unsigned int blockSize = 128;
+    const unsigned int numberOfBlocks = 200;
+    const real_t coupling = 2.5;
+    const real_t mass = 3.5;
+
+    //Random momenta of the first n - 1 legs, last leg by conservation,
+    //reproducible from the block index
+    GenerateStage generate = [=] (EventBlock& block, const unsigned int&)
+    {
+        if (block.index_ >= numberOfBlocks)
+        {
+            return false;
+        }
+
+        std::mt19937_64 generator (1000 + block.index_);
+        std::uniform_real_distribution <real_t> uniform (-1, 1);
+
+        block.size_ = block.capacity_;
+        for (unsigned int event = 0; event < block.size_; event++)
+        {
+            for (unsigned int j = 0; j < 4; j++)
+            {
+                real_t last = 0;
+                for (unsigned int leg = 0; leg + 1 < numberOfLegs; leg++)
+                {
+                    real_t value = 10 * uniform (generator);
+                    block.momentum (leg, j)[event] = value;
+                    last -= value;
+                }
+                block.momentum (numberOfLegs - 1, j)[event] = last;
+            }
+            block.weights_[event] = 1;
+        }
+        return true;
+    };
+
+    //Cut on the energy of the first leg
+    BlockStage cut = [] (EventBlock& block, const unsigned int&)
+    {
+        for (unsigned int event = 0; event < block.size_; event++)
+        {
+            if (block.momentum (0, 0)[event] < 0)
+            {
+                block.weights_[event] = 0;
+            }
+        }
+    };
+
+    //Results per block, summed in block order afterwards
+    std::vector <real_t> blockSums (numberOfBlocks, 0);
+    BlockStage accumulate = [&] (EventBlock& block, const unsigned int&)
+    {
+        real_t sum = 0;
+        for (unsigned int event = 0; event < block.size_; event++)
+        {
+            sum += block.weights_[event] * std::norm (block.amplitudes_[event]);
+        }
+        blockSums[block.index_] = sum;
+    };
+
+    real_t reference = 0;
+    for (unsigned int threads : {1, 2, 4})
+    {
+        //One amplitude per evaluate thread
+        std::vector <ScalarTreeAmplitude> amplitudes
+            (threads, ScalarTreeAmplitude (numberOfLegs, coupling, mass));
+        BlockStage evaluate = [&] (EventBlock& block,
+                                   const unsigned int& thread)
+        {
+            amplitudes[thread].amplitude (block.momenta_.data (), block.size_,
+                                          block.capacity_,
+                                          block.amplitudes_.data ());
+        };
+
+        PipelineConfiguration configuration =
+            {numberOfLegs, blockSize, 16, 4, {1, 1, threads, 1}, false};
+        EventPipeline pipeline (configuration, generate, cut, evaluate,
+                                accumulate);
+
+        std::fill (blockSums.begin (), blockSums.end (), 0);
+        clock_t tStart = clock();
+        unsigned long long processed = pipeline.run ();
+        clock_t tEnd = clock();
+
+        real_t total = 0;
+        for (real_t sum : blockSums)
+        {
+            total += sum;
+        }
+        if (threads == 1)
+        {
+            reference = total;
+        }
+
+        std::cout << threads << " evaluate threads: " << processed
+            << " blocks, sum " << total << ", identical: "
+            << (total == reference) << ", back-pressure waits: "
+            << pipeline.fullWaits (0) << ", CPU time: "
+            << (double)(tEnd - tStart)/CLOCKS_PER_SEC << "\n";
+    }
+}
+
+void testHistogram ()
+{
+    std::cout << "\n*** Testing Histogram ***\n";
+
+    //Batched and single fills agree, including under- and overflow
+    std::vector <real_t> values = {-1, 0, 0.05, 0.5, 0.999, 1, 2, 0.3};
+    std::vector <real_t> weights = {1, 2, 3, 4, 5, 6, 7, 8};
+
+    Histogram batched (10, 0, 1);
+    Histogram single (10, 0, 1);
+    Histogram variable ({0, 0.1, 0.2, 0.4, 0.7, 1});
+    batched.fill (values.data (), weights.data (), values.size ());
+    variable.fill (values.data (), weights.data (), values.size ());
+    for (unsigned int i = 0; i < values.size (); i++)
+    {
+        single.fill (values[i], weights[i]);
+    }
+
+    bool same = true;
+    for (unsigned int bin = 0; bin < 12; bin++)
+    {
+        same = same && batched.sum (bin) == single.sum (bin);
+    }
+    std::cout << "Batched fill matches single fills: " << same << "\n";
+    std::cout << "Underflow: " << batched.sum (0) << ", overflow: "
+        << batched.sum (11) << ", bin [0.5, 0.6): " << batched.sum (6)
+        << ", variable bin [0.4, 0.7): " << variable.sum (4) << "\n";
+
+    //Thread copies filled in parallel from pipeline blocks
+    const unsigned int numberOfLegs = 4;
+    const unsigned int numberOfThreads = 3;
+    HistogramCollection collection (numberOfThreads);
+    unsigned int mass12 = collection.book ("m12", Histogram (20, 0, 20));
+    unsigned int energy0 = collection.book ("E0", Histogram (20, -10, 10));
+    unsigned int angle01 = collection.book ("cos01", Histogram (10, -1, 1));
+
+    GenerateStage generate = [=] (EventBlock& block, const unsigned int&)
+    {
+        if (block.index_ >= 50)
+        {
+            return false;
+        }
+
+        std::mt19937_64 generator (block.index_);
+        std::uniform_real_distribution <real_t> uniform (-10, 10);
+        block.size_ = block.capacity_;
+        for (unsigned int leg = 0; leg < numberOfLegs; leg++)
+        {
+            for (unsigned int j = 0; j < 4; j++)
+            {
+                for (unsigned int event = 0; event < block.size_; event++)
+                {
+                    block.momentum (leg, j)[event] = uniform (generator);
+                }
+            }
+        }
+        std::fill (block.weights_.begin (), block.weights_.end (), 1);
+        return true;
+    };
+
+    std::vector <std::vector <real_t>> buffers
+        (numberOfThreads, std::vector <real_t> (64));
+    BlockStage accumulate = [&] (EventBlock& block, const unsigned int& thread)
+    {
+        real_t* buffer = buffers[thread].data ();
+        const real_t* weights = block.weights_.data ();
+
+        blockInvariantMass (block, 3, buffer);
+        collection.local (thread, mass12).fill (buffer, weights, block.size_);
+        blockEnergy (block, 0, buffer);
+        collection.local (thread, energy0).fill (buffer, weights, block.size_);
+        blockCosAngle (block, 0, 1, buffer);
+        collection.local (thread, angle01).fill (buffer, weights, block.size_);
+    };
+
+    PipelineConfiguration configuration =
+        {numberOfLegs, 64, 8, 4, {1, 1, 1, numberOfThreads}, false};
+    EventPipeline pipeline (configuration, generate, BlockStage (),
+                            BlockStage (), accumulate);
+    pipeline.run ();
+
+    Histogram energy = collection.merged (energy0);
+    real_t total = 0;
+    for (unsigned int bin = 0; bin <= energy.numberOfBins () + 1; bin++)
+    {
+        total += energy.sum (bin);
+    }
+    std::cout << "Entries: " << energy.entries () << ", total weight: "
+        << total << "\n";
+
+    //Files of two processes merge into doubled contents
+    std::string fileName = "/tmp/nlo4d_histograms.bin";
+    HistogramCollection other;
+    bool merged = collection.write (fileName) && other.read (fileName)
+               && other.addFile (fileName);
+    std::cout << "File merge: " << merged << ", doubled: "
+        << (other.merged (mass12).sum (5)
+            == 2 * collection.merged (mass12).sum (5)) << "\n";
+
+    //Corrupted binning is rejected before allocating: the bin count of the
+    //first histogram follows 16 bytes of header and its name
+    {
+        std::fstream file (fileName, std::ios::binary | std::ios::in
+                                     | std::ios::out);
+        uint32_t numberOfBins = 0xffffffff;
+        file.seekp (16 + collection.name (0).size ());
+        file.write (reinterpret_cast <const char*> (&numberOfBins),
+                    sizeof (numberOfBins));
+    }
+    HistogramCollection corrupted;
+    std::cout << "Corrupted binning rejected: "
+        << !corrupted.read (fileName) << "\n";
+    std::cout << "Empty edges give no bins: "
+        << (Histogram (std::vector <real_t> ()).numberOfBins () == 0) << "\n";
+    std::remove (fileName.c_str ());
+}
+
+void testLorentzTransformations ()
+{
+    std::cout << "\n*** Testing Lorentz Transformations ***\n";
+
+    FourVector <real_t> frame (5, 1, -2, 3);
+    FourVector <real_t> vector (4, 0.5, 1.5, -2);
+
+    //The frame itself ends up at rest
+    FourVector <real_t> rest = boostToRestFrame (frame, frame);
+    std::cout << "Frame at rest: (" << rest(0) << ", " << rest(1) << ", "
+        << rest(2) << ", " << rest(3) << "), mass: " << sqrt (frame * frame)
+        << "\n";
+
+    //Round trip and invariance
+    FourVector <real_t> boosted = boostToRestFrame (vector, frame);
+    FourVector <real_t> back = boostFromRestFrame (boosted, frame);
+    bool roundTrip = true;
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        roundTrip = roundTrip && std::abs (back(i) - vector(i)) <= 1e-12;
+    }
+    std::cout << "Round trip: " << roundTrip << ", invariant kept: "
+        << (std::abs (boosted * boosted - vector * vector) <= 1e-12) << ", "
+        << (std::abs (boosted * rest - vector * frame) <= 1e-12) << "\n";
+
+    //Rotation keeps the invariant and the energy
+    std::array <real_t, 3> axis = {{1, 1, 0}};
+    FourVector <real_t> rotated = rotate (vector, axis, 0.7);
+    std::cout << "Rotation keeps invariant: "
+        << (std::abs (rotated * rotated - vector * vector) <= 1e-12)
+        << ", energy: "
+        << (rotated(0) == vector(0)) << "\n";
+
+    //Batched kernels match the scalar functions for every variant
+    const unsigned int size = 37;
+    std::mt19937_64 generator (7);
+    std::uniform_real_distribution <real_t> uniform (-1, 1);
+    std::vector <real_t> frames (4 * size), vectors (4 * size);
+    for (unsigned int event = 0; event < size; event++)
+    {
+        for (unsigned int j = 1; j < 4; j++)
+        {
+            frames[j * size + event] = uniform (generator);
+            vectors[j * size + event] = uniform (generator);
+        }
+        frames[event] = 3 + uniform (generator);
+        vectors[event] = 2 + uniform (generator);
+    }
+    std::array <real_t, 9> rotation = rotationMatrix (axis, 0.7);
+
+    KernelVariant defaultVariant = kernelVariant ();
+    for (KernelVariant variant : {KernelVariant::SSE2, KernelVariant::AVX2,
+                                  KernelVariant::AVX512})
+    {
+        if (!kernelVariantSupported (variant))
+        {
+            std::cout << kernelVariantName (variant) << ": not supported\n";
+            continue;
+        }
+        setKernelVariant (variant);
+
+        std::vector <real_t> batch = vectors;
+        real_t* e = &batch[0];
+        real_t* x = &batch[size];
+        real_t* y = &batch[2 * size];
+        real_t* z = &batch[3 * size];
+        boostBatch (e, x, y, z, &frames[0], &frames[size], &frames[2 * size],
+                    &frames[3 * size], -1, size);
+        rotateBatch (x, y, z, rotation, size);
+
+        bool match = true;
+        for (unsigned int event = 0; event < size; event++)
+        {
+            FourVector <real_t> p (vectors[event], vectors[size + event],
+                                   vectors[2 * size + event],
+                                   vectors[3 * size + event]);
+            FourVector <real_t> f (frames[event], frames[size + event],
+                                   frames[2 * size + event],
+                                   frames[3 * size + event]);
+            FourVector <real_t> expected =
+                rotate (boostToRestFrame (p, f), rotation);
+            match = match && std::abs (e[event] - expected(0)) <= 1e-12
+                          && std::abs (x[event] - expected(1)) <= 1e-12
+                          && std::abs (y[event] - expected(2)) <= 1e-12
+                          && std::abs (z[event] - expected(3)) <= 1e-12;
+        }
+        std::cout << kernelVariantName (variant) << " match: " << match
+            << "\n";
+    }
+    setKernelVariant (defaultVariant);
+}
+
+void testUnweighting ()
+{
+    std::cout << "\n*** Testing Unweighter ***\n";
+
+    const unsigned int numberOfLegs = 5;
+    const unsigned int warmUpBlocks = 20;
+    const unsigned int numberOfBlocks = 200;
+    const real_t coupling = 2.5;
+    //Heavy enough that no propagator goes on-shell
+    const real_t mass = 50;
+
+    //Random momenta from the block index, warm-up blocks come first
+    unsigned int offset = 0;
+    unsigned int lastBlock = warmUpBlocks;
+    GenerateStage generate = [&] (EventBlock& block, const unsigned int&)
+    {
+        if (block.index_ >= lastBlock)
+        {
+            return false;
+        }
+
+        std::mt19937_64 generator (2000 + offset + block.index_);
+        std::uniform_real_distribution <real_t> uniform (-1, 1);
+
+        block.size_ = block.capacity_;
+        for (unsigned int event = 0; event < block.size_; event++)
+        {
+            for (unsigned int j = 0; j < 4; j++)
+            {
+                real_t last = 0;
+                for (unsigned int leg = 0; leg + 1 < numberOfLegs; leg++)
+                {
+                    real_t value = 10 * uniform (generator);
+                    block.momentum (leg, j)[event] = value;
+                    last -= value;
+                }
+                block.momentum (numberOfLegs - 1, j)[event] = last;
+            }
+            block.weights_[event] = 1;
+        }
+        return true;
+    };
+
+    std::vector <real_t> weightedSums (numberOfBlocks, 0);
+    std::vector <real_t> unweightedSums (numberOfBlocks, 0);
+    real_t referenceSum = 0;
+
+    for (unsigned int threads : {1, 4})
+    {
+        std::vector <ScalarTreeAmplitude> amplitudes
+            (threads, ScalarTreeAmplitude (numberOfLegs, coupling, mass));
+        BlockStage evaluate = [&] (EventBlock& block,
+                                   const unsigned int& thread)
+        {
+            amplitudes[thread].amplitude (block.momenta_.data (), block.size_,
+                                          block.capacity_,
+                                          block.amplitudes_.data ());
+        };
+
+        Unweighter unweighter (threads, 42);
+        PipelineConfiguration configuration =
+            {numberOfLegs, 128, 16, 4, {1, 1, threads, threads}, false};
+
+        //Warm-up pass estimates the cap
+        BlockStage warmUp = [&] (EventBlock& block,
+                                 const unsigned int& thread)
+        {
+            unweighter.warmUp (block, thread);
+        };
+        offset = 0;
+        lastBlock = warmUpBlocks;
+        EventPipeline (configuration, generate, BlockStage (), evaluate,
+                       warmUp).run ();
+        unweighter.finishWarmUp ();
+
+        //Streaming pass, weighted and unweighted sums per block
+        BlockStage accumulate = [&] (EventBlock& block,
+                                     const unsigned int& thread)
+        {
+            real_t weighted = 0;
+            for (unsigned int event = 0; event < block.size_; event++)
+            {
+                weighted += block.weights_[event]
+                          * std::norm (block.amplitudes_[event]);
+            }
+            unweighter.unweight (block, thread);
+
+            real_t unweighted = 0;
+            for (unsigned int event = 0; event < block.size_; event++)
+            {
+                unweighted += block.weights_[event];
+            }
+            weightedSums[block.index_] = weighted;
+            unweightedSums[block.index_] = unweighted;
+        };
+        offset = warmUpBlocks;
+        lastBlock = numberOfBlocks;
+        EventPipeline (configuration, generate, BlockStage (), evaluate,
+                       accumulate).run ();
+
+        real_t weighted = 0;
+        real_t unweighted = 0;
+        for (unsigned int i = 0; i < numberOfBlocks; i++)
+        {
+            weighted += weightedSums[i];
+            unweighted += unweightedSums[i];
+        }
+        if (threads == 1)
+        {
+            referenceSum = unweighted;
+        }
+
+        UnweightingStatistics statistics = unweighter.statistics ();
+        std::cout << threads << " threads:\n";
+        unweighter.print (std::cout);
+        std::cout << "Unweighted / weighted sum: " << unweighted / weighted
+            << ", expected error: "
+            << 1 / sqrt ((real_t) statistics.accepted_)
+            << ", identical to 1 thread: " << (unweighted == referenceSum)
+            << "\n";
+    }
+}
+
+void testCInterface ()
+{
+    std::cout << "\n*** Testing C interface ***\n";
+
+    const int numberOfLegs = 6;
+    const int batchSize = 37;
+    const real_t coupling = 2.5;
+    const real_t mass = 3.5;
+
+    //Events one after the other, as a Fortran array p(0:3, n, nevents)
+    std::mt19937_64 generator (11);
+    std::uniform_real_distribution <real_t> uniform (-10, 10);
+    std::vector <double> aos (4 * numberOfLegs * batchSize);
+    std::vector <double> soa (4 * numberOfLegs * batchSize);
+    std::vector <std::vector <FourVector <real_t>>> events (batchSize);
+
+    for (int event = 0; event < batchSize; event++)
+    {
+        for (int leg = 0; leg + 1 < numberOfLegs; leg++)
+        {
+            FourVector <real_t> p (uniform (generator), uniform (generator),
+                                   uniform (generator), uniform (generator));
+            events[event].push_back (p);
+        }
+        events[event].push_back (- sum (events[event]));
+
+        for (int leg = 0; leg < numberOfLegs; leg++)
+        {
+            for (int j = 0; j < 4; j++)
+            {
+                aos[(event * numberOfLegs + leg) * 4 + j] =
+                    events[event][leg](j);
+                soa[(leg * 4 + j) * batchSize + event] =
+                    events[event][leg](j);
+            }
+        }
+    }
+
+    ScalarTreeAmplitude amplitude (numberOfLegs, coupling, mass);
+    std::vector <complex_t> reference = amplitude.amplitude (events);
+
+    nlo4d_amplitude* handle =
+        nlo4d_amplitude_create (numberOfLegs, coupling, mass);
+    std::vector <double> results (2 * batchSize);
+
+    for (int layout : {NLO4D_LAYOUT_AOS, NLO4D_LAYOUT_SOA})
+    {
+        const double* momenta =
+            (layout == NLO4D_LAYOUT_AOS) ? aos.data () : soa.data ();
+        int status = nlo4d_amplitude_evaluate (handle, momenta, batchSize,
+                                               layout, results.data ());
+
+        bool match = true;
+        for (int event = 0; event < batchSize; event++)
+        {
+            complex_t result (results[2 * event], results[2 * event + 1]);
+            match = match && std::abs (result - reference[event])
+                             <= 1e-12 * std::abs (reference[event]);
+        }
+        std::cout << ((layout == NLO4D_LAYOUT_AOS) ? "AoS" : "SoA")
+            << ": status " << status << ", match: " << match << "\n";
+    }
+
+    std::cout << "Invalid layout rejected: "
+        << (nlo4d_amplitude_evaluate (handle, aos.data (), batchSize, 7,
+                                      results.data ()) == 0) << "\n";
+    std::cout << "Too many legs rejected: "
+        << (nlo4d_amplitude_create (17, coupling, mass) == nullptr) << "\n";
+    nlo4d_amplitude_destroy (handle);
+}
+
+void testComplexMomenta ()
+{
+    std::cout << "\n*** Testing complex momenta ***\n";
+
+    std::vector <FourVector <real_t>> momenta =
+        {{1, 22, 3, 44}, {11, 2, 33, 4}, {-1, 22, -4, 55},
+         {-2, 32, -5, 5}, {8, 11, 21, 7}};
+    momenta.push_back (- sum (momenta));
+
+    real_t coupling = 2.5;
+    real_t mass = 3.5;
+    ScalarTreeAmplitude amplitude6 (6, coupling, mass);
+
+    //Real kinematics through the complex path
+    std::vector <FourVector <complex_t>> complexMomenta;
+    for (auto& p : momenta)
+    {
+        complexMomenta.push_back (FourVector <complex_t> (p));
+    }
+    complex_t real = amplitude6.amplitude (momenta);
+    std::cout << "Real momenta match: "
+        << (std::abs (amplitude6.amplitude (complexMomenta) - real)
+            <= 1e-12 * std::abs (real)) << "\n";
+
+    //Shift p0 -> p0 + z q, p1 -> p1 - z q keeps momentum conservation
+    FourVector <real_t> q (1, 2, -3, 4);
+    auto shifted = [&] (const complex_t& z, const unsigned int& n)
+    {
+        std::vector <FourVector <complex_t>> event;
+        for (unsigned int i = 0; i + 1 < n; i++)
+        {
+            event.push_back (FourVector <complex_t> (momenta[i]));
+        }
+        event[0] = event[0] + z * q;
+        event[1] = event[1] - z * q;
+        event.push_back (- sum (event));
+        return event;
+    };
+
+    //Four legs against the sum of the three channels
+    ScalarTreeAmplitude amplitude4 (4, coupling, mass);
+    std::vector <FourVector <complex_t>> event4 =
+        shifted (complex_t (0.3, 1.7), 4);
+    complex_t analytical = 0;
+    for (auto& pair : {std::make_pair (0, 1), std::make_pair (0, 2),
+                       std::make_pair (1, 2)})
+    {
+        FourVector <complex_t> p = event4[pair.first] + event4[pair.second];
+        analytical -= 1. / (p.square () - mass * mass);
+    }
+    analytical *= imaginaryUnit * coupling * coupling;
+    complex_t tape4 = amplitude4.amplitude (event4);
+    std::cout << "4 legs: " << tape4 << " vs " << analytical << " | match: "
+        << (std::abs (tape4 - analytical) <= 1e-12 * std::abs (analytical))
+        << "\n";
+
+    //A = i R with R real on real kinematics, so A(z*) = - A(z)*
+    complex_t z (0.8, -2.1);
+    complex_t forward = amplitude6.amplitude (shifted (z, 6));
+    complex_t conjugated = amplitude6.amplitude (shifted (std::conj (z), 6));
+    std::cout << "6 legs, A(z) = " << forward << " | reflection match: "
+        << (std::abs (conjugated + std::conj (forward))
+            <= 1e-12 * std::abs (forward)) << "\n";
+
+    //Batch against single events, and timing against real momenta
+    unsigned int batchSize = 64;
+    std::vector <std::vector <FourVector <complex_t>>> events;
+    std::vector <std::vector <FourVector <real_t>>> realEvents;
+    for (unsigned int i = 0; i < batchSize; i++)
+    {
+        events.push_back (shifted (complex_t (0.01 * i, 0.02 * i), 6));
+        realEvents.push_back (momenta);
+    }
+    std::vector <complex_t> batch = amplitude6.amplitude (events);
+    bool batchMatch = true;
+    for (unsigned int i = 0; i < batchSize; i++)
+    {
+        complex_t single = amplitude6.amplitude (events[i]);
+        batchMatch = batchMatch
+            && std::abs (batch[i] - single) <= 1e-12 * std::abs (single);
+    }
+    std::cout << "Batch of " << batchSize << " events match: " << batchMatch
+        << "\n";
+
+    unsigned int nPoints = 1e5;
+    clock_t tStart = clock();
+    for (unsigned int i = 0; i < nPoints / batchSize; i++)
+    {
+        amplitude6.amplitude (realEvents);
+    }
+    real_t tReal = (double)(clock() - tStart)/CLOCKS_PER_SEC;
+
+    tStart = clock();
+    for (unsigned int i = 0; i < nPoints / batchSize; i++)
+    {
+        amplitude6.amplitude (events);
+    }
+    real_t tComplex = (double)(clock() - tStart)/CLOCKS_PER_SEC;
+
+    std::cout << "Avg. time per calculation (batch): real "
+        << tReal/(nPoints / batchSize * batchSize) << ", complex "
+        << tComplex/(nPoints / batchSize * batchSize) << "\n";
+}
+
+void testMultiChannel ()
+{
+    std::cout << "\n*** Testing multi-channel phase space ***\n";
+
+    const unsigned int numberOfLegs = 6;
+    const unsigned int batchSize = 256;
+    const real_t energy = 10;
+    const real_t coupling = 2.5;
+    const real_t mass = 3;
+    const real_t width = 0.05;
+
+    //Monte Carlo estimate of the integral of f with the given sampler
+    std::mt19937_64 generator (7);
+    std::uniform_real_distribution <real_t> uniform (0, 1);
+    std::vector <real_t> momenta (4 * numberOfLegs * batchSize);
+    std::vector <real_t> weights (batchSize);
+    std::vector <real_t> values (batchSize);
+    std::vector <complex_t> amplitudes (batchSize);
+    auto integrate = [&] (MultiChannelSampler& sampler,
+                          ScalarTreeAmplitude* amplitude,
+                          const unsigned int& numberOfBatches,
+                          const bool& adapt, real_t& error)
+    {
+        std::vector <real_t> random (sampler.dimension () * batchSize);
+        real_t sum = 0;
+        real_t sum2 = 0;
+        for (unsigned int i = 0; i < numberOfBatches; i++)
+        {
+            for (auto& r : random)
+            {
+                r = uniform (generator);
+            }
+            sampler.generate (random.data (), batchSize, momenta.data (),
+                              batchSize, weights.data ());
+
+            if (amplitude != nullptr)
+            {
+                amplitude->amplitude (momenta.data (), batchSize, batchSize,
+                                      amplitudes.data ());
+            }
+            for (unsigned int event = 0; event < batchSize; event++)
+            {
+                values[event] = (amplitude != nullptr)
+                              ? std::norm (amplitudes[event]) : 1;
+                real_t w = values[event] * weights[event];
+                sum += w;
+                sum2 += w * w;
+            }
+
+            if (adapt)
+            {
+                sampler.addIntegrand (values.data (), batchSize);
+            }
+        }
+
+        real_t n = numberOfBatches * batchSize;
+        real_t mean = sum / n;
+        error = std::sqrt ((sum2 / n - mean * mean) / n);
+        return mean;
+    };
+
+    //Massless phase space volume
+    //(2 pi)^(4 - 3k) (pi / 2)^(k - 1) S^(k - 2) / ((k - 1)! (k - 2)!)
+    const unsigned int k = numberOfLegs - 2;
+    real_t factorials = 1;
+    for (unsigned int i = 2; i < k; i++)
+    {
+        factorials *= i * (i - 1);
+    }
+    real_t volume = std::pow (2 * std::acos (-1.0), 4.0 - 3 * k)
+                  * std::pow (std::acos (-1.0) / 2, k - 1.0)
+                  * std::pow (energy * energy, k - 2.0) / factorials;
+
+    InvariantMapping flat = {0, 0, 0, 0};
+    InvariantMapping powerLaw = {0, 0, 0.8, 1};
+    InvariantMapping breitWigner = {mass, width, 0, 0};
+
+    real_t error;
+    MultiChannelSampler flatSampler (numberOfLegs, energy, 0, flat);
+    MultiChannelSampler powerLawSampler (numberOfLegs, energy, 0, powerLaw);
+    std::cout << flatSampler.numberOfChannels () << " channels, "
+        << flatSampler.dimension () << " random numbers per event\n";
+    MultiChannelSampler tooLarge (10, energy, 0, flat);
+    std::vector <real_t> tooLargeWeights (1, 1);
+    tooLarge.generate (nullptr, 1, nullptr, 1, tooLargeWeights.data ());
+    std::cout << "8 final legs rejected: "
+        << (tooLarge.numberOfChannels () == 0 && tooLarge.dimension () == 0
+            && tooLargeWeights[0] == 0) << "\n";
+    real_t flatVolume = integrate (flatSampler, nullptr, 100, false, error);
+    std::cout << "Volume, flat mapping: " << flatVolume / volume
+        << " +- " << error / volume << " of analytic\n";
+    real_t powerLawVolume = integrate (powerLawSampler, nullptr, 100, false,
+                                       error);
+    std::cout << "Volume, power law: " << powerLawVolume / volume
+        << " +- " << error / volume << " of analytic\n";
+
+    //Resonant propagators: single events and the tape agree with a width
+    ScalarTreeAmplitude amplitude (numberOfLegs, coupling, mass, width);
+    std::vector <FourVector <real_t>> event;
+    for (unsigned int leg = 0; leg < numberOfLegs; leg++)
+    {
+        event.push_back (FourVector <real_t> (momenta[leg * 4 * batchSize],
+            momenta[(leg * 4 + 1) * batchSize],
+            momenta[(leg * 4 + 2) * batchSize],
+            momenta[(leg * 4 + 3) * batchSize]));
+    }
+    complex_t single = amplitude.amplitude (event);
+    std::vector <complex_t> batch = amplitude.amplitude
+        (std::vector <std::vector <FourVector <real_t>>> (1, event));
+    std::cout << "Width, single event matches tape: "
+        << (std::abs (single - batch[0]) <= 1e-12 * std::abs (single))
+        << "\n";
+
+    //Relative error per event: flat sampling against adapted channels
+    const unsigned int numberOfBatches = 200;
+    real_t flatCross = integrate (flatSampler, &amplitude, numberOfBatches,
+                                  false, error);
+    real_t flatSpread = error / flatCross
+                      * std::sqrt ((real_t) numberOfBatches * batchSize);
+    std::cout << "Flat: " << flatCross << " +- " << error
+        << ", relative spread " << flatSpread << "\n";
+
+    MultiChannelSampler sampler (numberOfLegs, energy, 0, breitWigner);
+    for (unsigned int iteration = 0; iteration < 5; iteration++)
+    {
+        integrate (sampler, &amplitude, 20, true, error);
+        sampler.adapt ();
+    }
+    real_t maximumWeight = 0;
+    for (auto alpha : sampler.channelWeights ())
+    {
+        maximumWeight = std::max (maximumWeight, alpha);
+    }
+    real_t cross = integrate (sampler, &amplitude, numberOfBatches, false,
+                              error);
+    real_t spread = error / cross
+                  * std::sqrt ((real_t) numberOfBatches * batchSize);
+    std::cout << "Multi-channel: " << cross << " +- " << error
+        << ", relative spread " << spread << ", largest channel weight "
+        << maximumWeight << "\n";
+    std::cout << "Variance reduction: " << flatSpread * flatSpread
+        / (spread * spread) << "\n";
+}
+
+void testEvaluationPlans ()
+{
+    std::cout << "\n*** Testing evaluation plans ***\n";
+
+    const unsigned int numberOfLegs = 15;
+    const unsigned int batchSize = 8;
+    const std::string previousDirectory = planDirectory ();
+
+    std::mt19937_64 generator (41);
+    std::uniform_real_distribution <real_t> uniform (-10, 10);
+    std::vector <real_t> momenta (4 * (numberOfLegs - 1) * batchSize);
+    for (auto& p : momenta)
+    {
+        p = uniform (generator);
+    }
+
+    //Compilation without plan files
+    setPlanDirectory ("");
+    clock_t tStart = clock();
+    EvaluationTape compiled (numberOfLegs);
+    real_t tCompile = (double)(clock() - tStart)/CLOCKS_PER_SEC;
+    std::vector <complex_t> reference (batchSize);
+    compiled.execute (momenta.data (), batchSize, 2, reference.data ());
+
+    //First start writes the plan, the second one maps it
+    setPlanDirectory (".");
+    std::string fileName = EvaluationTape::planFile (numberOfLegs,
+                                                     TapeInput::MOMENTA);
+    std::remove (fileName.c_str ());
+    tStart = clock();
+    EvaluationTape first (numberOfLegs);
+    real_t tSave = (double)(clock() - tStart)/CLOCKS_PER_SEC;
+
+    tStart = clock();
+    EvaluationTape second (numberOfLegs);
+    real_t tLoad = (double)(clock() - tStart)/CLOCKS_PER_SEC;
+
+    std::vector <complex_t> results (batchSize);
+    second.execute (momenta.data (), batchSize, 2, results.data ());
+    bool identical = true;
+    for (unsigned int i = 0; i < batchSize; i++)
+    {
+        identical = identical && results[i] == reference[i];
+    }
+    std::cout << fileName << ": " << second.numberOfInstructions ()
+        << " instructions, mapped: " << second.mapped ()
+        << ", results identical: " << identical << "\n";
+    std::cout << "Startup: compile " << tCompile << " s, compile and save "
+        << tSave << " s, map " << tLoad << " s\n";
+
+    //Amplitudes pick up the plan as well
+    tStart = clock();
+    ScalarTreeAmplitude amplitude (numberOfLegs, 1.5, 2);
+    std::cout << "Amplitude startup with plan: "
+        << (double)(clock() - tStart)/CLOCKS_PER_SEC << " s\n";
+
+    //A corrupted plan fails its checksum and is rebuilt
+    {
+        std::fstream file (fileName, std::ios::in | std::ios::out
+                                     | std::ios::binary);
+        file.seekp (1000);
+        file.put ('x');
+    }
+    EvaluationTape rebuilt (numberOfLegs);
+    EvaluationTape remapped (numberOfLegs);
+    std::cout << "Corrupted plan mapped: " << rebuilt.mapped ()
+        << ", rebuilt plan mapped: " << remapped.mapped () << "\n";
+
+    //A plan of another multiplicity under the wrong name is stale
+    std::string otherName = EvaluationTape::planFile (numberOfLegs - 1,
+                                                      TapeInput::MOMENTA);
+    std::rename (fileName.c_str (), otherName.c_str ());
+    EvaluationTape other (numberOfLegs - 1);
+    setPlanDirectory ("");
+    std::cout << "Wrong multiplicity mapped: " << other.mapped ()
+        << ", rebuilt tape matches: "
+        << (other.numberOfInstructions ()
+            == EvaluationTape (numberOfLegs - 1).numberOfInstructions ())
+        << "\n";
+
+    std::remove (fileName.c_str ());
+    std::remove (otherName.c_str ());
+    setPlanDirectory (previousDirectory);
+}
+
+void testLoopIntegrals ()
+{
+    std::cout << "\n*** Testing one-loop integrals ***\n";
+
+    const real_t pi = std::acos (-1.0);
+    const real_t mass = 1;
+    ScalarLoopIntegrals loops (mass, 1);
+    auto deviation = [] (const complex_t& value, const complex_t& reference)
+    {
+        return std::abs (value - reference) / std::abs (reference);
+    };
+
+    //Closed forms: B0 (0; m, m) = - ln m^2, B0 (p^2; 0, 0) = 2 - ln (- p^2),
+    //zero momenta C0 = - 1 / (2 m^2), D0 = 1 / (6 m^4)
+    std::cout << "B0 (0; 2, 2) deviation: "
+        << deviation (loops.bubble (0, {{2, 2}}), - std::log (4.0)) << "\n";
+    std::cout << "B0 (3; 0, 0) deviation: "
+        << deviation (loops.bubble (3, {{0, 0}}),
+                      complex_t (2 - std::log (3.0), pi)) << "\n";
+    std::cout << "C0, D0 at zero momenta deviation: "
+        << deviation (loops.triangle (0, 0, 0), -0.5) << ", "
+        << deviation (loops.box (0, 0, 0, 0, 0, 0), 1 / 6.0) << "\n";
+
+    //Reference values with massless and massive lines, below and above
+    //thresholds
+    struct Reference
+    {
+        std::array <real_t, 6> invariants;
+        std::array <real_t, 4> masses;
+        complex_t value;
+    };
+    const std::vector <Reference> triangles = {
+        {{{-1, -2, -3}}, {{1, 1, 1}}, -0.3378313332512846},
+        {{{3, -1, -4}}, {{0.5, 1, 2}},
+         complex_t (-0.4543028605716495, -0.19710033581689415)},
+        {{{20, -5, 3}}, {{1, 1, 1}},
+         complex_t (-0.029324579174182172, -0.48870126562319066)},
+        {{{0, 0, 5}}, {{1, 1, 1}},
+         complex_t (-0.8943345118780581, -0.6047086137711147)},
+        {{{-1, -2, -3}}, {{0, 0, 0}}, -1.2541386674114372}};
+    const std::vector <Reference> boxes = {
+        {{{-1, -2, -1, -0.5, -5, -3}}, {{0, 0, 0, 0}}, 0.742259625699653},
+        {{{1, 0.5, 2, 1, 5, -2}}, {{1, 1, 1, 1}},
+         complex_t (0.2411880620625845, 0.6886022285990575)},
+        {{{2, 3, 1, 0.5, 10, -4}}, {{1, 2, 1, 1.5}},
+         complex_t (-0.004016857558749082, 0.08562901990804025)},
+        {{{0, 0, 0, 0, 5, -2}}, {{1, 1, 1, 1}},
+         complex_t (0.2609491084469485, 0.26364039109015264)},
+        {{{3, 0, 0, 0, 8, -2}}, {{0.5, 1, 1, 1}},
+         complex_t (-0.23912754955964088, 0.18405858164845637)}};
+    real_t triangleDeviation = 0;
+    for (const auto& reference : triangles)
+    {
+        const auto& p = reference.invariants;
+        const auto& m = reference.masses;
+        triangleDeviation = std::max (triangleDeviation,
+            deviation (loops.triangle (p[0], p[1], p[2], {{m[0], m[1], m[2]}}),
+                       reference.value));
+    }
+    real_t boxDeviation = 0;
+    for (const auto& reference : boxes)
+    {
+        const auto& p = reference.invariants;
+        boxDeviation = std::max (boxDeviation,
+            deviation (loops.box (p[0], p[1], p[2], p[3], p[4], p[5],
+                                  reference.masses), reference.value));
+    }
+    std::cout << "Largest deviation from reference values, C0: "
+        << triangleDeviation << ", D0: " << boxDeviation << "\n";
+
+    //2 -> 2 with massless legs, p1 + p2 + p3 + p4 = 0
+    const real_t energy = 5;
+    const real_t angle = 0.7;
+    std::vector <FourVector <real_t>> momenta = {
+        FourVector <real_t> (energy, 0, 0, energy),
+        FourVector <real_t> (energy, 0, 0, - energy),
+        FourVector <real_t> (- energy, - energy * std::sin (angle), 0,
+                             - energy * std::cos (angle)),
+        FourVector <real_t> (- energy, energy * std::sin (angle), 0,
+                             energy * std::cos (angle))};
+    real_t s = (momenta[0] + momenta[1]).square ();
+    real_t t = (momenta[1] + momenta[2]).square ();
+    std::cout << "Box from momenta matches invariants: "
+        << (deviation (loops.box (momenta),
+                       loops.box (0, 0, 0, 0, s, t, {{mass, mass, mass, mass}}))
+            <= 1e-12) << "\n";
+
+    //Batch: boxes (s, t), (t, u), (u, s) and the image (t, s) of the first,
+    //the last one is taken from the cache
+    const unsigned int batchSize = 2000;
+    const unsigned int numberOfBoxes = 4;
+    std::mt19937_64 generator (42);
+    std::uniform_real_distribution <real_t> uniform (0, 1);
+    std::vector <real_t> invariants (numberOfBoxes * 6 * batchSize, 0);
+    for (unsigned int event = 0; event < batchSize; event++)
+    {
+        real_t sEvent = 4 + 96 * uniform (generator);
+        real_t tEvent = - sEvent * uniform (generator);
+        real_t uEvent = - sEvent - tEvent;
+        const real_t channels[numberOfBoxes][2] = {{sEvent, tEvent},
+            {tEvent, uEvent}, {uEvent, sEvent}, {tEvent, sEvent}};
+        for (unsigned int box = 0; box < numberOfBoxes; box++)
+        {
+            invariants[(box * 6 + 4) * batchSize + event] = channels[box][0];
+            invariants[(box * 6 + 5) * batchSize + event] = channels[box][1];
+        }
+    }
+    std::vector <complex_t> results (numberOfBoxes * batchSize);
+    unsigned long hits = loops.cacheHits ();
+    clock_t tStart = clock();
+    loops.boxes (invariants.data (), numberOfBoxes, batchSize, batchSize,
+                 results.data ());
+    real_t tBatch = (double)(clock() - tStart)/CLOCKS_PER_SEC;
+
+    real_t batchDeviation = 0;
+    for (unsigned int event = 0; event < batchSize; event += 97)
+    {
+        for (unsigned int box = 0; box < numberOfBoxes; box++)
+        {
+            complex_t single = loops.box (0, 0, 0, 0,
+                invariants[(box * 6 + 4) * batchSize + event],
+                invariants[(box * 6 + 5) * batchSize + event],
+                {{mass, mass, mass, mass}});
+            batchDeviation = std::max (batchDeviation,
+                deviation (results[box * batchSize + event], single));
+        }
+    }
+    std::cout << "Batch of " << numberOfBoxes * batchSize << " boxes: "
+        << tBatch << " s, cache hits " << loops.cacheHits () - hits
+        << ", largest deviation from single evaluation " << batchDeviation
+        << "\n";
+}
+
+void testCutFirstEvaluation ()
+{
+    std::cout << "\n*** Testing cut-first evaluation ***\n";
+
+    const unsigned int numberOfLegs = 10;
+    const unsigned int batchSize = 4096;
+    ScalarTreeAmplitude amplitude (numberOfLegs, 2.5, 3.5);
+
+    std::mt19937_64 generator (43);
+    std::uniform_real_distribution <real_t> uniform (-10, 10);
+    std::vector <real_t> momenta (4 * (numberOfLegs - 1) * batchSize);
+    for (auto& p : momenta)
+    {
+        p = uniform (generator);
+    }
+
+    //Transverse momentum of the first leg above 8, about half the events
+    CutPredicate cut = [] (const real_t* momenta,
+                           const unsigned int& batchSize,
+                           const unsigned int& stride,
+                           unsigned char* accepted)
+    {
+        const real_t* px = momenta + stride;
+        const real_t* py = momenta + 2 * stride;
+        for (unsigned int event = 0; event < batchSize; event++)
+        {
+            accepted[event] = px[event] * px[event] + py[event] * py[event]
+                              > 64;
+        }
+    };
+
+    //Reference: every event evaluated, cuts applied afterwards, after a
+    //first pass sizing the workspace
+    std::vector <complex_t> reference (batchSize);
+    std::vector <unsigned char> accepted (batchSize);
+    amplitude.amplitude (momenta.data (), batchSize, batchSize,
+                         reference.data ());
+    clock_t tStart = clock();
+    amplitude.amplitude (momenta.data (), batchSize, batchSize,
+                         reference.data ());
+    cut (momenta.data (), batchSize, batchSize, accepted.data ());
+    real_t tFull = (double)(clock() - tStart)/CLOCKS_PER_SEC;
+
+    std::vector <complex_t> results (batchSize);
+    std::vector <real_t> weights (batchSize, 1);
+    tStart = clock();
+    unsigned int numberOfAccepted = amplitude.amplitude
+        (momenta.data (), batchSize, batchSize, cut, results.data (),
+         weights.data ());
+    real_t tCutFirst = (double)(clock() - tStart)/CLOCKS_PER_SEC;
+
+    bool identical = true;
+    for (unsigned int event = 0; event < batchSize; event++)
+    {
+        complex_t expected = accepted[event] ? reference[event] : 0;
+        identical = identical && results[event] == expected
+                    && weights[event] == accepted[event];
+    }
+    std::cout << "Accepted " << numberOfAccepted << " of " << batchSize
+        << " events, results and weights identical: " << identical << "\n";
+    std::cout << "Evaluate then cut: " << tFull << " s, cut first: "
+        << tCutFirst << " s\n";
+}
+
+void testFlavouredAmplitude ()
+{
+    std::cout << "\n*** Testing FlavouredTreeAmplitude ***\n";
+
+    const unsigned int numberOfLegs = 9;
+    const unsigned int batchSize = 256;
+    std::mt19937_64 generator (44);
+    std::uniform_real_distribution <real_t> uniform (-10, 10);
+
+    //Momenta of all legs in SoA layout, last leg by conservation
+    std::vector <real_t> momenta (4 * numberOfLegs * batchSize, 0);
+    for (unsigned int event = 0; event < batchSize; event++)
+    {
+        for (unsigned int j = 0; j < 4; j++)
+        {
+            real_t last = 0;
+            for (unsigned int leg = 0; leg + 1 < numberOfLegs; leg++)
+            {
+                real_t value = uniform (generator);
+                momenta[(4 * leg + j) * batchSize + event] = value;
+                last -= value;
+            }
+            momenta[(4 * (numberOfLegs - 1) + j) * batchSize + event] = last;
+        }
+    }
+    auto deviation = [] (const std::vector <complex_t>& values,
+                         const std::vector <complex_t>& references)
+    {
+        real_t result = 0;
+        for (unsigned int i = 0; i < values.size (); i++)
+        {
+            result = std::max (result, std::abs (values[i] - references[i])
+                                       / std::abs (references[i]));
+        }
+        return result;
+    };
+
+    //One species reproduces phi^3 theory
+    ScalarTheory single ({3.5});
+    single.setCoupling (0, 0, 0, 2.5);
+    FlavouredTreeAmplitude flavoured
+        (single, std::vector <unsigned int> (numberOfLegs, 0));
+    ScalarTreeAmplitude reference (numberOfLegs, 2.5, 3.5);
+    std::vector <complex_t> results (batchSize);
+    std::vector <complex_t> references (batchSize);
+    flavoured.amplitude (momenta.data (), batchSize, batchSize,
+                         results.data ());
+    reference.amplitude (momenta.data (), batchSize, batchSize,
+                         references.data ());
+    std::cout << "One species, deviation from ScalarTreeAmplitude: "
+        << deviation (results, references) << "\n";
+
+    //Four species, a light one coupling to pairs of heavy ones and a
+    //few heavy self-couplings, against all couplings non-zero
+    const unsigned int numberOfSpecies = 4;
+    ScalarTheory sparse ({0.5, 2, 3, 4});
+    ScalarTheory dense ({0.5, 2, 3, 4});
+    for (unsigned int a = 1; a < numberOfSpecies; a++)
+    {
+        sparse.setCoupling (0, a, a, 1.5);
+    }
+    sparse.setCoupling (1, 2, 3, 0.8);
+    for (unsigned int a = 0; a < numberOfSpecies; a++)
+    {
+        for (unsigned int b = a; b < numberOfSpecies; b++)
+        {
+            for (unsigned int c = b; c < numberOfSpecies; c++)
+            {
+                dense.setCoupling (a, b, c, 1 + 0.1 * (a + b + c));
+            }
+        }
+    }
+    const std::vector <unsigned int> flavours = {1, 0, 1, 2, 3, 0, 2, 3, 0};
+    for (const ScalarTheory* theory : {&sparse, &dense})
+    {
+        FlavouredTreeAmplitude amplitude (*theory, flavours);
+
+        clock_t tStart = clock();
+        amplitude.amplitude (momenta.data (), batchSize, batchSize,
+                             results.data ());
+        real_t tBatch = (double)(clock() - tStart)/CLOCKS_PER_SEC;
+
+        //Exchanging the first and the last leg leaves the amplitude
+        //unchanged, but compiles a different recursion
+        std::vector <unsigned int> exchanged = flavours;
+        std::swap (exchanged.front (), exchanged.back ());
+        std::vector <real_t> exchangedMomenta = momenta;
+        for (unsigned int j = 0; j < 4 * batchSize; j++)
+        {
+            std::swap (exchangedMomenta[j],
+                       exchangedMomenta[4 * (numberOfLegs - 1) * batchSize
+                                        + j]);
+        }
+        FlavouredTreeAmplitude other (*theory, exchanged);
+        other.amplitude (exchangedMomenta.data (), batchSize, batchSize,
+                         references.data ());
+
+        std::cout << ((theory == &sparse) ? "Sparse" : "Dense")
+            << " couplings: " << amplitude.numberOfCurrents ()
+            << " currents, " << amplitude.numberOfTerms () << " terms, "
+            << tBatch << " s, leg exchange deviation "
+            << deviation (results, references) << "\n";
+    }
+}
+
+void testMemoryPlacement ()
+{
+    std::cout << "\n*** Testing memory placement ***\n";
+
+    std::cout << "NUMA nodes: " << numberOfNumaNodes ()
+        << ", pinned to node 0: " << pinThreadToNode (0)
+        << ", thread node: " << threadNumaNode () << "\n";
+
+    //Random gathers over 256 MiB stress the TLB
+    const unsigned int size = 1u << 25;
+    const unsigned int numberOfReads = 1u << 24;
+    const HugePages previous = hugePages ();
+    const char* names[3] = {"none", "transparent", "explicit"};
+    const HugePages policies[3] = {HugePages::NONE, HugePages::TRANSPARENT,
+                                   HugePages::EXPLICIT};
+    for (unsigned int k = 0; k < 3; k++)
+    {
+        setHugePages (policies[k]);
+
+        clock_t tStart = clock();
+        PlacedVector <real_t> buffer (size, 1);
+        real_t tTouch = (double)(clock() - tStart)/CLOCKS_PER_SEC;
+
+        tStart = clock();
+        uint64_t index = 0;
+        real_t sum = 0;
+        for (unsigned int i = 0; i < numberOfReads; i++)
+        {
+            index = index * 6364136223846793005ull + 1442695040888963407ull;
+            sum += buffer[(index >> 32) & (size - 1)];
+        }
+        real_t tGather = (double)(clock() - tStart)/CLOCKS_PER_SEC;
+
+        std::cout << "Huge pages " << names[k] << ": first touch " << tTouch
+            << " s, random gathers " << tGather << " s, page node "
+            << pageNumaNode (buffer.data ()) << ", sum correct: "
+            << (sum == numberOfReads) << "\n";
+    }
+    //A buffer freed after the backing changed unmaps what it mapped
+    {
+        setHugePages (HugePages::TRANSPARENT);
+        PlacedVector <real_t> mapped (size / 16 + 1, 1);
+        setHugePages (HugePages::NONE);
+        PlacedVector <real_t> next (size / 16 + 1, 2);
+        mapped = PlacedVector <real_t> ();
+        std::cout << "Backing changed before free, neighbour intact: "
+            << (next[size / 16] == 2) << "\n";
+    }
+    setHugePages (previous);
+
+    //Pinned pipeline with per-node pools gives the unpinned result
+    const unsigned int numberOfLegs = 5;
+    const unsigned int numberOfBlocks = 100;
+    GenerateStage generate = [=] (EventBlock& block, const unsigned int&)
+    {
+        if (block.index_ >= numberOfBlocks)
+        {
+            return false;
+        }
+
+        std::mt19937_64 generator (block.index_);
+        std::uniform_real_distribution <real_t> uniform (-10, 10);
+        block.size_ = block.capacity_;
+        for (auto& p : block.momenta_)
+        {
+            p = uniform (generator);
+        }
+        std::fill (block.weights_.begin (), block.weights_.end (), 1);
+        return true;
+    };
+    std::vector <real_t> blockSums (numberOfBlocks, 0);
+    BlockStage accumulate = [&] (EventBlock& block, const unsigned int&)
+    {
+        real_t sum = 0;
+        for (unsigned int event = 0; event < block.size_; event++)
+        {
+            sum += block.weights_[event] * std::norm (block.amplitudes_[event]);
+        }
+        blockSums[block.index_] = sum;
+    };
+
+    real_t totals[2] = {0, 0};
+    for (bool pinned : {false, true})
+    {
+        std::vector <ScalarTreeAmplitude> amplitudes
+            (2, ScalarTreeAmplitude (numberOfLegs, 2, 1));
+        BlockStage evaluate = [&] (EventBlock& block,
+                                   const unsigned int& thread)
+        {
+            amplitudes[thread].amplitude (block.momenta_.data (), block.size_,
+                                          block.capacity_,
+                                          block.amplitudes_.data ());
+        };
+
+        PipelineConfiguration configuration =
+            {numberOfLegs, 128, 16, 4, {2, 1, 2, 1}, pinned};
+        EventPipeline (configuration, generate, BlockStage (), evaluate,
+                       accumulate).run ();
+        for (real_t sum : blockSums)
+        {
+            totals[pinned] += sum;
+        }
+    }
+    std::cout << "Pinned pipeline matches unpinned: "
+        << (totals[0] == totals[1]) << "\n";
+}
+
+void testDipoleSubtraction ()
+{
+    std::cout << "\n*** Testing dipole subtraction ***\n";
+
+    const unsigned int numberOfLegs = 6;
+    const unsigned int batchSize = 256;
+    const unsigned int numberOfBatches = 20;
+    const real_t energy = 10;
+    const real_t coupling = 2.5;
+
+    //Massless real events
+    std::mt19937_64 generator (46);
+    std::uniform_real_distribution <real_t> uniform (0, 1);
+    MultiChannelSampler sampler (numberOfLegs, energy, 0, {0, 0, 0, 0});
+    std::vector <real_t> random (sampler.dimension () * batchSize);
+    std::vector <real_t> momenta (4 * numberOfLegs * batchSize);
+    std::vector <real_t> weights (batchSize);
+    for (auto& r : random)
+    {
+        r = uniform (generator);
+    }
+    sampler.generate (random.data (), batchSize, momenta.data (), batchSize,
+                      weights.data ());
+
+    DipoleSubtraction subtraction (numberOfLegs, coupling);
+    const unsigned int numberOfDipoles = subtraction.dipoles ().size ();
+    std::vector <real_t> counterterms (batchSize);
+    subtraction.counterterms (momenta.data (), batchSize, batchSize,
+                              counterterms.data ());
+    std::cout << numberOfDipoles << " dipoles\n";
+
+    //Mapped legs on-shell and momentum conserving
+    const unsigned int t = numberOfDipoles * batchSize;
+    const real_t* mapped = subtraction.mappedMomenta ();
+    real_t shell = 0;
+    real_t conservation = 0;
+    for (unsigned int i = 0; i < t; i++)
+    {
+        std::array <real_t, 4> sum = {0, 0, 0, 0};
+        for (unsigned int leg = 0; leg + 1 < numberOfLegs; leg++)
+        {
+            FourVector <real_t> p (mapped[4 * leg * t + i],
+                                   mapped[(4 * leg + 1) * t + i],
+                                   mapped[(4 * leg + 2) * t + i],
+                                   mapped[(4 * leg + 3) * t + i]);
+            shell = std::max (shell, std::abs (p.square ()));
+            for (unsigned int c = 0; c < 4; c++)
+            {
+                sum[c] += p (c);
+            }
+        }
+        for (unsigned int c = 0; c < 4; c++)
+        {
+            conservation = std::max (conservation, std::abs (sum[c]));
+        }
+    }
+    std::cout << "Mapped momenta, largest |p^2| / E^2: "
+        << shell / (energy * energy) << ", largest |sum p| / E: "
+        << conservation / energy << "\n";
+
+    //Initial-initial dipoles keep the spectator and leave the emitter
+    //along its beam, scaled by 0 < x < 1
+    real_t spectatorChange = 0;
+    real_t transverse = 0;
+    bool fractions = true;
+    unsigned int initialInitial = 0;
+    for (unsigned int d = 0; d < numberOfDipoles; d++)
+    {
+        const Dipole& dipole = subtraction.dipoles ()[d];
+        if (dipole.emitter_ >= 2 || dipole.spectator_ >= 2)
+        {
+            continue;
+        }
+        initialInitial++;
+        for (unsigned int event = 0; event < batchSize; event++)
+        {
+            const real_t* pi = momenta.data ()
+                             + 4 * dipole.emitter_ * batchSize + event;
+            const real_t* pk = momenta.data ()
+                             + 4 * dipole.spectator_ * batchSize + event;
+            const real_t* mi = mapped + 4 * dipole.emitter_ * t
+                             + d * batchSize + event;
+            const real_t* mk = mapped + 4 * dipole.spectator_ * t
+                             + d * batchSize + event;
+            real_t x = mi[0] / pi[0];
+            fractions = fractions && x > 0 && x < 1;
+            for (unsigned int c = 0; c < 4; c++)
+            {
+                spectatorChange = std::max (spectatorChange,
+                    std::abs (mk[c * t] - pk[c * batchSize]) / energy);
+                transverse = std::max (transverse,
+                    std::abs (mi[c * t] - x * pi[c * batchSize]) / energy);
+            }
+        }
+    }
+    std::cout << initialInitial << " initial-initial dipoles, spectator "
+        << "change: " << spectatorChange << ", emitter off its beam: "
+        << transverse << ", 0 < x < 1: " << fractions << "\n";
+
+    //Reference with four-vectors and one Born call per dipole and event
+    ScalarTreeAmplitude born (numberOfLegs - 1, coupling);
+    ScalarTreeAmplitude real (numberOfLegs, coupling);
+    auto reference = [&] (const unsigned int& event)
+    {
+        std::vector <FourVector <real_t>> p;
+        for (unsigned int leg = 0; leg < numberOfLegs; leg++)
+        {
+            p.push_back (FourVector <real_t>
+                (momenta[4 * leg * batchSize + event],
+                 momenta[(4 * leg + 1) * batchSize + event],
+                 momenta[(4 * leg + 2) * batchSize + event],
+                 momenta[(4 * leg + 3) * batchSize + event]));
+        }
+        auto s = [&] (const unsigned int& a, const unsigned int& b)
+        {
+            return 2 * (p[a] * p[b]);
+        };
+        std::vector <real_t> eikonal (numberOfLegs, 0);
+        real_t partition = 0;
+        for (unsigned int a = 0; a < numberOfLegs; a++)
+        {
+            for (unsigned int b = a + 1; b < numberOfLegs; b++)
+            {
+                eikonal[a] += 1 / s (a, b);
+                eikonal[b] += 1 / s (a, b);
+                partition += (b >= 2) ? std::pow (s (a, b), -4) : 0;
+            }
+        }
+
+        real_t sum = 0;
+        complex_t amplitude = real.amplitude (p);
+        for (const auto& dipole : subtraction.dipoles ())
+        {
+            unsigned int i = dipole.emitter_;
+            unsigned int j = dipole.emitted_;
+            unsigned int k = dipole.spectator_;
+            std::vector <FourVector <real_t>> mappedEvent (p);
+            if (i < 2 && k < 2)
+            {
+                real_t x = (p[i] * p[k] + p[i] * p[j] + p[j] * p[k])
+                         / (p[i] * p[k]);
+                FourVector <real_t> recoil = -(p[i] + p[j] + p[k]);
+                FourVector <real_t> mappedRecoil = -(x * p[i] + p[k]);
+                FourVector <real_t> sum = recoil + mappedRecoil;
+                mappedEvent[i] = x * p[i];
+                for (unsigned int leg = 2; leg < numberOfLegs; leg++)
+                {
+                    mappedEvent[leg] = p[leg]
+                        - (2 * (p[leg] * sum) / (sum * sum)) * sum
+                        + (2 * (p[leg] * recoil) / (recoil * recoil))
+                          * mappedRecoil;
+                }
+            }
+            else
+            {
+                bool swapped = (i < 2);
+                unsigned int a = swapped ? k : i;
+                unsigned int b = swapped ? i : k;
+                FourVector <real_t> pij = p[a] + p[j];
+                real_t lambda = (p[a] * p[j]) / (pij * p[b]);
+                mappedEvent[a] = pij - lambda * p[b];
+                mappedEvent[b] = (1 + lambda) * p[b];
+            }
+            mappedEvent.erase (mappedEvent.begin () + j);
+
+            //Singular part at the unmapped, off-shell merged momentum
+            std::vector <FourVector <real_t>> mergedEvent (p);
+            mergedEvent[i] = p[i] + p[j];
+            mergedEvent.erase (mergedEvent.begin () + j);
+            complex_t singular = -coupling * born.amplitude (mergedEvent)
+                               / s (i, j);
+
+            real_t rho2 = std::pow (eikonal[j] - 1 / s (i, j), 2);
+            if (i >= 2)
+            {
+                rho2 += std::pow (eikonal[i] - 1 / s (i, j), 2);
+            }
+            real_t weight = std::pow (s (i, j), -4)
+                          / ((numberOfLegs - 2) * partition);
+            sum += weight * (std::norm (amplitude)
+                             - std::norm (amplitude - singular)
+                             + coupling * coupling * rho2
+                               * std::norm (born.amplitude (mappedEvent)));
+        }
+        return sum;
+    };
+    real_t deviation = 0;
+    for (unsigned int event = 0; event < batchSize; event++)
+    {
+        real_t value = reference (event);
+        deviation = std::max (deviation,
+            std::abs (counterterms[event] - value) / std::abs (value));
+    }
+    std::cout << "Largest relative deviation from four-vector reference: "
+        << deviation << "\n";
+
+    //Every supported kernel variant gives the same counterterms and the
+    //same initial-initial mappings
+    std::vector <real_t> defaultMapped (mapped,
+                                        mapped + 4 * (numberOfLegs - 1) * t);
+    KernelVariant defaultVariant = kernelVariant ();
+    for (KernelVariant variant : {KernelVariant::SSE2, KernelVariant::AVX2,
+                                  KernelVariant::AVX512})
+    {
+        if (!kernelVariantSupported (variant))
+        {
+            std::cout << kernelVariantName (variant) << ": not supported\n";
+            continue;
+        }
+        setKernelVariant (variant);
+
+        std::vector <real_t> variantCounterterms (batchSize);
+        subtraction.counterterms (momenta.data (), batchSize, batchSize,
+                                  variantCounterterms.data ());
+        real_t variantDeviation = 0;
+        for (unsigned int event = 0; event < batchSize; event++)
+        {
+            variantDeviation = std::max (variantDeviation,
+                std::abs (variantCounterterms[event] - counterterms[event])
+                / std::abs (counterterms[event]));
+        }
+        real_t mappingDeviation = 0;
+        for (unsigned int d = 0; d < numberOfDipoles; d++)
+        {
+            const Dipole& dipole = subtraction.dipoles ()[d];
+            if (dipole.emitter_ >= 2 || dipole.spectator_ >= 2)
+            {
+                continue;
+            }
+            for (unsigned int row = 0; row < 4 * (numberOfLegs - 1); row++)
+            {
+                for (unsigned int event = 0; event < batchSize; event++)
+                {
+                    unsigned int index = row * t + d * batchSize + event;
+                    mappingDeviation = std::max (mappingDeviation,
+                        std::abs (subtraction.mappedMomenta ()[index]
+                                  - defaultMapped[index]) / energy);
+                }
+            }
+        }
+        std::cout << kernelVariantName (variant)
+            << ", largest relative deviation: " << variantDeviation
+            << ", initial-initial mapping: " << mappingDeviation << "\n";
+    }
+    setKernelVariant (defaultVariant);
+
+    //Timings per batch: real matrix element, batched counterterms and
+    //the four-vector reference
+    std::vector <complex_t> amplitudes (batchSize);
+    clock_t tStart = clock();
+    for (unsigned int i = 0; i < numberOfBatches; i++)
+    {
+        real.amplitude (momenta.data (), batchSize, batchSize,
+                        amplitudes.data ());
+    }
+    real_t tReal = (double)(clock() - tStart)/CLOCKS_PER_SEC;
+    tStart = clock();
+    for (unsigned int i = 0; i < numberOfBatches; i++)
+    {
+        subtraction.counterterms (momenta.data (), batchSize, batchSize,
+                                  counterterms.data ());
+    }
+    real_t tBatch = (double)(clock() - tStart)/CLOCKS_PER_SEC;
+    tStart = clock();
+    real_t checksum = 0;
+    for (unsigned int i = 0; i < numberOfBatches; i++)
+    {
+        for (unsigned int event = 0; event < batchSize; event++)
+        {
+            checksum += reference (event);
+        }
+    }
+    real_t tReference = (double)(clock() - tStart)/CLOCKS_PER_SEC;
+    std::cout << "Time per batch: real " << tReal / numberOfBatches
+        << " s, counterterms " << tBatch / numberOfBatches
+        << " s, four-vector reference " << tReference / numberOfBatches
+        << " s (checksum " << (checksum > 0) << ")\n";
+
+    //Real events approaching a limit of a Born event: p_e and p_j with
+    //momentum fractions z and 1 - z of the emitter, the spectator rescaled
+    //by 1 - y, k_T^2 = -2 y z (1 - z) p_e.p_s
+    MultiChannelSampler bornSampler (numberOfLegs - 1, energy, 0,
+                                     {0, 0, 0, 0});
+    std::vector <real_t> bornMomenta (4 * (numberOfLegs - 1));
+    bornSampler.generate (random.data (), 1, bornMomenta.data (), 1,
+                          weights.data ());
+    std::vector <FourVector <real_t>> bornEvent;
+    for (unsigned int leg = 0; leg + 1 < numberOfLegs; leg++)
+    {
+        bornEvent.push_back (FourVector <real_t>
+            (bornMomenta[4 * leg], bornMomenta[4 * leg + 1],
+             bornMomenta[4 * leg + 2], bornMomenta[4 * leg + 3]));
+    }
+    auto realEvent = [&] (const unsigned int& emitter,
+                          const unsigned int& spectator, const real_t& y,
+                          const real_t& z)
+    {
+        const FourVector <real_t>& pe = bornEvent[emitter];
+        const FourVector <real_t>& ps = bornEvent[spectator];
+        FourVector <real_t> r (0, 0.3, 1, -0.7);
+        real_t es = pe * ps;
+        FourVector <real_t> kT = r - ((r * ps) / es) * pe
+                               - ((r * pe) / es) * ps;
+        kT = std::sqrt (2 * y * z * (1 - z) * es / (-kT.square ())) * kT;
+
+        std::vector <FourVector <real_t>> p (bornEvent);
+        p[emitter] = z * pe + y * (1 - z) * ps + kT;
+        p[spectator] = (1 - y) * ps;
+        p.push_back ((1 - z) * pe + y * z * ps - kT);
+        return p;
+    };
+    std::vector <real_t> single (4 * numberOfLegs);
+    std::vector <real_t> counterterm (1);
+    auto evaluate = [&] (const std::vector <FourVector <real_t>>& p)
+    {
+        for (unsigned int leg = 0; leg < numberOfLegs; leg++)
+        {
+            for (unsigned int c = 0; c < 4; c++)
+            {
+                single[4 * leg + c] = p[leg](c);
+            }
+        }
+        subtraction.counterterms (single.data (), 1, 1, counterterm.data ());
+        return std::norm (real.amplitude (p));
+    };
+    auto ratio = [&] (const std::vector <FourVector <real_t>>& p)
+    {
+        return evaluate (p) / counterterm[0];
+    };
+    //s_ij (|M_real|^2 - sum D) of the collinear pair, the emitted leg is
+    //the last one
+    auto remainder = [&] (const std::vector <FourVector <real_t>>& p,
+                          const unsigned int& emitter)
+    {
+        real_t squared = evaluate (p);
+        return 2 * (p[emitter] * p.back ()) * (squared - counterterm[0]);
+    };
+
+    std::cout << "|M_real|^2 / sum of dipoles:\n";
+    for (real_t lambda : {1e-1, 1e-2, 1e-3, 1e-4, 1e-5})
+    {
+        std::cout << "  lambda = " << lambda << ": final collinear "
+            << ratio (realEvent (4, 2, lambda, 0.3)) << ", soft "
+            << ratio (realEvent (4, 2, lambda, 1 - lambda))
+            << ", initial collinear "
+            << ratio (realEvent (2, 0, -2.0 / 3, 1 - lambda)) << "\n";
+    }
+
+    //The remainder is integrable if s_ij (|M_real|^2 - sum D) vanishes in
+    //the collinear limits
+    std::cout << "s_ij (|M_real|^2 - sum of dipoles):\n";
+    real_t finalFirst = 0, initialFirst = 0, finalLast = 0, initialLast = 0;
+    for (real_t lambda : {1e-1, 1e-2, 1e-3, 1e-4, 1e-5})
+    {
+        finalLast = remainder (realEvent (4, 2, lambda, 0.3), 4);
+        initialLast = remainder (realEvent (2, 0, -2.0 / 3, 1 - lambda), 0);
+        if (lambda == 1e-1)
+        {
+            finalFirst = finalLast;
+            initialFirst = initialLast;
+        }
+        std::cout << "  lambda = " << lambda << ": final collinear "
+            << finalLast << ", initial collinear " << initialLast << "\n";
+    }
+    std::cout << "Vanishing in the collinear limits: "
+        << (std::abs (finalLast) < 1e-3 * std::abs (finalFirst)
+            && std::abs (initialLast) < 1e-3 * std::abs (initialFirst))
+        << "\n";
+}
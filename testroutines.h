@@ -5,5 +5,20 @@
 void testUtilities ();
 void testFourVector ();
 void testScalarTreeAmplitude ();
+void testEvaluationTape ();
+void testShardedIntegration ();
+void testEventPipeline ();
+void testHistogram ();
+void testLorentzTransformations ();
+void testUnweighting ();
+void testCInterface ();
+void testComplexMomenta ();
+void testMultiChannel ();
+void testEvaluationPlans ();
+void testLoopIntegrals ();
+void testCutFirstEvaluation ();
+void testFlavouredAmplitude ();
+void testMemoryPlacement ();
+void testDipoleSubtraction ();
 
 #endif
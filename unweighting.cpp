@@ -0,0 +1,247 @@
+/*
+    Hit-or-miss unweighting of event blocks in a single streaming pass.
+    The maximum weight is estimated from a warm-up sample with a cap that
+    leaves a given fraction of the cross section to overweight events.
+    Acceptance uses one random number per event derived from the block
+    index, so the accepted events do not depend on the thread schedule.
+*/
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+#include "definitions.h"
+#include "pipeline.h"
+#include "unweighting.h"
+
+namespace
+{
+    //Random number of an event, splitmix64 finalizer over seed and index
+    real_t eventRandom (const uint64_t& seed, const uint64_t& event)
+    {
+        uint64_t z = seed + 0x9e3779b97f4a7c15ull * (event + 1);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        z = z ^ (z >> 31);
+
+        //Uniform number in [0,1) from the upper 53 bits
+        return (z >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+    void clear (UnweightingStatistics& statistics)
+    {
+        std::memset (&statistics, 0, sizeof (UnweightingStatistics));
+    }
+}
+
+//Constructor
+Unweighter::Unweighter (const unsigned int& numberOfThreads,
+                        const unsigned long long& seed,
+                        const real_t& overweightFraction)
+    : warmUpWeights_ (std::max (numberOfThreads, 1u)),
+      statistics_ (std::max (numberOfThreads, 1u)),
+      buffers_ (std::max (numberOfThreads, 1u)),
+      maximumWeight_ (0), warmUpEvents_ (0), seed_ (seed),
+      overweightFraction_ (overweightFraction)
+{
+    clearStatistics ();
+}
+
+//Full event weights of a block into the buffer of a thread
+void Unweighter::blockWeights (EventBlock& block, const unsigned int& thread)
+{
+    std::vector <real_t>& buffer = buffers_[thread];
+    buffer.resize (block.capacity_);
+
+    for (unsigned int event = 0; event < block.size_; event++)
+    {
+        buffer[event] = block.weights_[event]
+                      * std::norm (block.amplitudes_[event]);
+    }
+}
+
+//Warm-up: collect the event weights of a block
+void Unweighter::warmUp (EventBlock& block, const unsigned int& thread)
+{
+    blockWeights (block, thread);
+
+    std::vector <real_t>& weights = warmUpWeights_[thread];
+    for (unsigned int event = 0; event < block.size_; event++)
+    {
+        weights.push_back (std::abs (buffers_[thread][event]));
+    }
+}
+
+//Cap such that the excess of the weights above it is at most the given
+//fraction of the total: with the k largest weights above the cap,
+//excess = S_k - k * cap
+bool Unweighter::finishWarmUp ()
+{
+    std::vector <real_t> weights;
+    for (auto& threadWeights : warmUpWeights_)
+    {
+        weights.insert (weights.end (), threadWeights.begin (),
+                        threadWeights.end ());
+        threadWeights.clear ();
+        threadWeights.shrink_to_fit ();
+    }
+
+    warmUpEvents_ = weights.size ();
+    std::sort (weights.begin (), weights.end (), std::greater <real_t> ());
+
+    real_t total = 0;
+    for (auto weight : weights)
+    {
+        total += weight;
+    }
+
+    if (weights.empty () || total <= 0)
+    {
+        std::cout << "Error: no weights to estimate maximum weight\n";
+        maximumWeight_ = 0;
+        return false;
+    }
+
+    real_t allowed = overweightFraction_ * total;
+    real_t largest = 0;
+    maximumWeight_ = weights[0];
+
+    for (unsigned int k = 1; k <= weights.size (); k++)
+    {
+        largest += weights[k - 1];
+        real_t next = (k < weights.size ()) ? weights[k] : 0;
+        real_t cap = (largest - allowed) / k;
+
+        //Cap lies between the k-th and the (k+1)-th largest weight
+        if (cap >= next)
+        {
+            maximumWeight_ = std::min (cap, weights[0]);
+            break;
+        }
+    }
+
+    return true;
+}
+
+//Set the cap directly
+void Unweighter::setMaximumWeight (const real_t& maximumWeight)
+{
+    maximumWeight_ = maximumWeight;
+}
+
+//Unweight a block in place
+void Unweighter::unweight (EventBlock& block, const unsigned int& thread)
+{
+    blockWeights (block, thread);
+    unweight (buffers_[thread].data (),
+              block.index_ * block.capacity_, block.size_,
+              block.weights_.data (), thread);
+}
+
+//Unweight plain arrays
+void Unweighter::unweight (const real_t* weights,
+                           const unsigned long long& firstEvent,
+                           const unsigned int& size, real_t* unweighted,
+                           const unsigned int& thread)
+{
+    UnweightingStatistics& statistics = statistics_[thread];
+    const real_t cap = maximumWeight_;
+
+    for (unsigned int event = 0; event < size; event++)
+    {
+        real_t weight = weights[event];
+        real_t magnitude = std::abs (weight);
+
+        statistics.events_++;
+        statistics.weightSum_ += weight;
+        unweighted[event] = 0;
+
+        if (magnitude == 0 || cap <= 0
+            || eventRandom (seed_, firstEvent + event) * cap >= magnitude)
+        {
+            continue;
+        }
+
+        statistics.accepted_++;
+        if (magnitude > cap)
+        {
+            statistics.overweight_++;
+            statistics.overweightSum_ += magnitude - cap;
+            unweighted[event] = weight;
+        }
+        else
+        {
+            unweighted[event] = (weight > 0) ? cap : - cap;
+        }
+    }
+}
+
+//Statistics summed over threads
+UnweightingStatistics Unweighter::statistics () const
+{
+    UnweightingStatistics sum;
+    clear (sum);
+
+    for (auto& statistics : statistics_)
+    {
+        sum.events_ += statistics.events_;
+        sum.accepted_ += statistics.accepted_;
+        sum.overweight_ += statistics.overweight_;
+        sum.weightSum_ += statistics.weightSum_;
+        sum.overweightSum_ += statistics.overweightSum_;
+    }
+
+    return sum;
+}
+
+void Unweighter::clearStatistics ()
+{
+    for (auto& statistics : statistics_)
+    {
+        clear (statistics);
+    }
+}
+
+//Accepted over seen events
+real_t Unweighter::efficiency () const
+{
+    UnweightingStatistics sum = statistics ();
+    return (sum.events_ > 0) ? (real_t) sum.accepted_ / sum.events_ : 0;
+}
+
+//Overweight over accepted events
+real_t Unweighter::overweightFraction () const
+{
+    UnweightingStatistics sum = statistics ();
+    return (sum.accepted_ > 0) ? (real_t) sum.overweight_ / sum.accepted_ : 0;
+}
+
+//Getters
+real_t Unweighter::maximumWeight () const
+{
+    return maximumWeight_;
+}
+
+unsigned long long Unweighter::warmUpEvents () const
+{
+    return warmUpEvents_;
+}
+
+//Print a summary
+void Unweighter::print (std::ostream& out) const
+{
+    UnweightingStatistics sum = statistics ();
+
+    out << "Maximum weight: " << maximumWeight_ << " from "
+        << warmUpEvents_ << " warm-up events\n";
+    out << "Accepted " << sum.accepted_ << " of " << sum.events_
+        << " events, efficiency " << efficiency () << "\n";
+    out << "Overweight events: " << overweightFraction ()
+        << " of accepted, carrying "
+        << ((sum.weightSum_ != 0) ? sum.overweightSum_ / sum.weightSum_ : 0)
+        << " of the cross section above the cap\n";
+}
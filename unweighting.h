@@ -0,0 +1,92 @@
+/*
+    Hit-or-miss unweighting of event blocks in a single streaming pass.
+    The maximum weight is estimated from a warm-up sample with a cap that
+    leaves a given fraction of the cross section to overweight events.
+    Acceptance uses one random number per event derived from the block
+    index, so the accepted events do not depend on the thread schedule.
+*/
+
+#ifndef UNWEIGHTING
+#define UNWEIGHTING
+
+#include <complex>
+#include <iostream>
+#include <vector>
+
+#include "definitions.h"
+#include "pipeline.h"
+
+struct UnweightingStatistics
+{
+    //Events seen, including events failing cuts
+    unsigned long long events_;
+    unsigned long long accepted_;
+    //Accepted events with a weight above the cap
+    unsigned long long overweight_;
+    //Sum of the event weights and of their excess over the cap
+    real_t weightSum_;
+    real_t overweightSum_;
+
+    //Keep per thread copies on separate cache lines
+    char padding_[64];
+};
+
+class Unweighter
+{
+public:
+    //Constructor: overweight events may carry up to 'overweightFraction'
+    //of the cross section of the warm-up sample
+    Unweighter (const unsigned int& numberOfThreads,
+                const unsigned long long& seed,
+                const real_t& overweightFraction = 1e-3);
+
+    //Warm-up: collect the event weights of a block
+    void warmUp (EventBlock& block, const unsigned int& thread);
+    //Estimate the cap from the warm-up sample, false if it is empty
+    bool finishWarmUp ();
+    //Set the cap directly, e.g. from a previous run
+    void setMaximumWeight (const real_t& maximumWeight);
+
+    //Accept or reject the events of a block. Afterwards weights_ holds
+    //the unweighted event weight: 0 if rejected, +-cap if accepted, or
+    //the event weight itself for overweight events.
+    void unweight (EventBlock& block, const unsigned int& thread);
+    //Same on plain arrays, 'firstEvent' is the global index of weights[0]
+    void unweight (const real_t* weights, const unsigned long long& firstEvent,
+                   const unsigned int& size, real_t* unweighted,
+                   const unsigned int& thread);
+
+    //Statistics summed over threads
+    UnweightingStatistics statistics () const;
+    void clearStatistics ();
+    //Accepted over seen events
+    real_t efficiency () const;
+    //Overweight over accepted events
+    real_t overweightFraction () const;
+
+    //Getters
+    real_t maximumWeight () const;
+    unsigned long long warmUpEvents () const;
+
+    //Print a summary
+    void print (std::ostream& out) const;
+
+private:
+    //Full event weight: phase space weight times |amplitude|^2
+    void blockWeights (EventBlock& block, const unsigned int& thread);
+
+    //Per thread warm-up weights, statistics and weight buffers
+    std::vector <std::vector <real_t>> warmUpWeights_;
+    std::vector <UnweightingStatistics> statistics_;
+    std::vector <std::vector <real_t>> buffers_;
+
+    real_t maximumWeight_;
+    unsigned long long warmUpEvents_;
+
+    //Parameters
+    const unsigned long long seed_;
+    const real_t overweightFraction_;
+
+};
+
+#endif